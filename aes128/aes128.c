@@ -6,8 +6,9 @@
  * Description:
  *  This program enc/decrypts a file and produces a new file with the result.
  *  Proper command line options and arguments must be provided:
- *      Usage: ./aes128 [-vhtsndr] [-p interval] [-f nbytes] [-k keyfile] [-i infile] [-o outfile]
+ *      Usage: ./aes128 [-vhtsndrcgmuPa] [-b manifest] [-E engine] [-T tracefile] [-l latency] [-j nthreads] [-x pc] [-B kbytes] [-p interval] [-f nbytes] [-k keyfile] [-i infile] [-o outfile]
  */
+#define _GNU_SOURCE     /* O_DIRECT */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,11 +17,24 @@
 #include <time.h>
 #include <sysexits.h>
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <errno.h>
+#include <limits.h>
 
 #include "dma_driver.h"
 #include "sw_aes.h"
+#include "crc32c.h"
+#include "dma_slab.h"
+#include "uring.h"
+#include "sw_pipeline.h"
+#include "profile.h"
+#include "sw_engine.h"
+#include "dma_cmac.h"
+#include "dma_probe.h"
+#include "trace.h"
 
-#define USAGE_LINE "Usage: aes128 [-vhtsndr] [-p interval] [-f nbytes] [-k keyfile] [-i infile] [-o outfile] \n"
+#define USAGE_LINE "Usage: aes128 [-vhtsndrcgmuPa] [-b manifest] [-E engine] [-T tracefile] [-l latency] [-j nthreads] [-x pc] [-B kbytes] [-p interval] [-f nbytes] [-k keyfile] [-i infile] [-o outfile] \n"
 
 #define HELP "AES128: Encrypt a FILE with AES128 in CBC mode. Options...\n\n\
 \t-v: Print a version line. \n\n\
@@ -30,13 +44,34 @@
 \t-n: No hardward encryptor. Don't try to init hardware AES. \n\n\
 \t-d: Do software decryption. \n\n\
 \t-r: Reverse the byte order of each 16 bytes block. \n\n\
+\t-c: Use software AES-CTR instead of CBC (no padding) from a random counter block, \n\
+\t   written ahead of the ciphertext. Decrypt with -c -d. \n\n\
+\t-g: Use software AES-GCM under a random nonce. Writes the nonce, the ciphertext \n\
+\t   and the tag. With -d, nothing is kept unless the tag matches. \n\n\
+\t-m: Compute the AES-CMAC tag of the input on the hardware. Writes the tag in hex. \n\n\
+\t-x sides: Print the CRC32C of the plaintext ('p') and/or ciphertext ('c'), \n\
+\t   computed in the same pass as the CBC enc/decryption. Not with -c, -g, -m, -b or -a. \n\n\
+\t-B kbytes: Size of the private DMA buffer to ask rsvmem for. The default is 1024. \n\n\
+\t-u: Overlap file I/O with the DMA through io_uring (O_DIRECT when aligned and pinnable). \n\n\
+\t-l latency: Stream the input. Dispatch whatever complete blocks have arrived \n\
+\t   once 'latency' us have passed since the chunk began, or when it is full. \n\n\
+\t-E engine: Run the software paths on 'engine' instead of the one in the profile. \n\
+\t   'auto' benchmarks the engines again and saves the fastest. \n\n\
+\t-P: With -s or -d, read, cipher and write on separate threads. \n\n\
+\t-a: Measure the hardware throughput and latency for each chunk size and save \n\
+\t   the best one to the profile. Later runs use it unless -f is given. \n\n\
+\t-b manifest: Encrypt every \"infile outfile\" pair listed in 'manifest', each one \n\
+\t   from the IV. Small files are packed into one buffer and run back to back. \n\n\
+\t-T tracefile: Record when each chunk is read, in the DMA, ciphered and written, \n\
+\t   and save the timeline to 'tracefile' as Chrome trace-event JSON at exit. \n\n\
+\t-j nthreads: Number of threads for CTR mode and -P decryption. The default is one per CPU. \n\n\
 \t-p num: Set the DMA polling interval to 'num' us. \n\n\
-\t-f nbytes: Force encryption chunck size to 'nbytes'. Must be multiples of 16, \n\n\
+\t-f nbytes: Force encryption chunck size to 'nbytes'. Must be a positive multiple of 16. \n\n\
 \t-k keyfile: Specify the path to the key file. \n\n\
 \t-i infile: Read the input from 'infile'. The default is STDIN. \n\n\
 \t-o outfile: Write the output to 'outfile'. The defailt is STDOUT. \n\n"
 
-#define OPTIONS "vhtsndrp:f:k:i:o:" /* Options for getopt(3) */
+#define OPTIONS "vhtsndrcgmuPab:E:T:l:j:x:B:p:f:k:i:o:" /* Options for getopt(3) */
 #define VERSION "aes128 version 1.2 by Hsiang-Ju Lai\n"
 
 /* Key = 0x000102030405060708090A0B0C0D0E0F */
@@ -63,6 +98,9 @@ static inline uint64_t time_diff_in_us(struct timespec *start, struct timespec *
                        - (start->tv_sec * 1000000 + (uint64_t)(start->tv_nsec / 1000)));
 }
 
+/* Chunk size measured by -a, 0 if none */
+static u32 tuned_chunk_len;
+
 /* This method encrypts the file indicating by fdin and writes
  * to the file indicating by fdout.
  * Parameters: fdin, the file descriptor of the infile
@@ -77,21 +115,49 @@ int encrypt_file(int fdin, int fdout, u32 *key, int forced_buffer_len, int timin
     struct timespec begin_t, end_t;
     clock_t start = 0, end;
     double cpu_time_used;
-    size_t read_len = (size_t) (forced_buffer_len > 0 ? forced_buffer_len : MAX_SRC_LEN);
+    size_t read_len = forced_buffer_len > 0 ? (size_t) forced_buffer_len : (size_t) MAX_SRC_LEN;
+    char *in = psrc, *out = pdest;
+    char *stage = NULL;
+    uint64_t seq = 0;
 
     if (FAILURE == aes_set_key(key))
         return FAILURE;
 
+    if (forced_buffer_len <= 0 && tuned_chunk_len >= 16 && tuned_chunk_len <= MAX_SRC_LEN)
+    {
+        read_len = tuned_chunk_len & ~15U;
+        fprintf(stderr,"[INFO] Using the tuned chunk size of %u bytes.\n", (u32) read_len);
+    }
+
+    /* Chunks larger than one transfer are staged and split by dma_transfer */
+    if (read_len > MAX_SRC_LEN)
+    {
+        if (NULL == (stage = malloc(read_len)))
+        {
+            perror("malloc");
+            return FAILURE;
+        }
+        in = out = stage;
+        fprintf(stderr,"[INFO] Chunks of %lu bytes are split into %d KB transfers.\n", (unsigned long) read_len, MAX_SRC_LEN / 1024);
+    }
+
     /* Read from infile to buffer, enc/decrypt buffer, and outputs to outfile */
-    while((cnt = (u32)read(fdin, psrc, read_len)) > 0)
+    for (;;)
     {
+        dma_probe0(hw_read_start);
+        trace_begin(TRACE_READ, seq);
+        if ((cnt = (u32)read(fdin, in, read_len)) <= 0)
+        {
+            trace_end(TRACE_READ, seq);
+            break;
+        }
         if (forced_buffer_len > 0)
         {
             size_t n_left = forced_buffer_len - cnt;
             while(n_left > 0)
             {
                 usleep(10);
-                ssize_t n = read(fdin, psrc + cnt, n_left);
+                ssize_t n = read(fdin, in + cnt, n_left);
                 n_left -= n;
                 cnt += n;
             }
@@ -102,10 +168,12 @@ int encrypt_file(int fdin, int fdout, u32 *key, int forced_buffer_len, int timin
             {
                 for (; cnt % 16 != 0; cnt++)
                 {
-                    psrc[cnt] = 0;
+                    in[cnt] = 0;
                 }
             }
         }
+        dma_probe1(hw_read_done, cnt);
+        trace_end(TRACE_READ, seq);
 
 
         if (timing)
@@ -116,8 +184,16 @@ int encrypt_file(int fdin, int fdout, u32 *key, int forced_buffer_len, int timin
 
 
         /* encryption happens here */
-        if (FAILURE == dma_start(cnt))
-            return FAILURE;
+        trace_begin(TRACE_DMA, seq);
+        if (stage)
+        {
+            if (checksum_mode & CKSUM_PLAIN)
+                checksum_plain = crc32c_update(checksum_plain, in, cnt);
+            if (FAILURE == dma_transfer(in, out, cnt))
+                goto fail;
+        }
+        else if (FAILURE == dma_start(cnt))
+            goto fail;
 
         if (timing)
         {
@@ -126,8 +202,19 @@ int encrypt_file(int fdin, int fdout, u32 *key, int forced_buffer_len, int timin
             fprintf(stderr,"[TIMING] It takes %lf seconds to start the DMA transfer.\n", cpu_time_used);
         }
 
-        if (FAILURE == dma_sync())
-            return FAILURE;
+        if (!stage)
+        {
+            /* The CPU is otherwise idle while the DMA runs */
+            if (checksum_mode & CKSUM_PLAIN)
+                checksum_plain = crc32c_update(checksum_plain, in, cnt);
+
+            if (FAILURE == dma_sync())
+                goto fail;
+        }
+        trace_end(TRACE_DMA, seq);
+
+        if (checksum_mode & CKSUM_CIPHER)
+            checksum_cipher = crc32c_update(checksum_cipher, out, cnt);
 
         if (timing)
         {
@@ -138,17 +225,798 @@ int encrypt_file(int fdin, int fdout, u32 *key, int forced_buffer_len, int timin
             fprintf(stderr,"[TIMING] Total Time: %ld micro-seconds.\n", time_diff_in_us(&begin_t, &end_t));
         }
 
-        if(write(fdout, pdest, cnt) != cnt) //write exactly how many it reads
+        dma_probe1(hw_write_start, cnt);
+        trace_begin(TRACE_WRITE, seq);
+        ssize_t written = write(fdout, out, cnt);
+        trace_end(TRACE_WRITE, seq++);
+        dma_probe1(hw_write_done, written);
+        if(written != cnt) //write exactly how many it reads
         {
             perror("outfile");
-            return FAILURE;
+            goto fail;
+        }
+    }
+
+    free(stage);
+    dma_clean_up();
+    return SUCCESS;
+
+fail:
+    free(stage);
+    return FAILURE;
+}
+
+
+/* -------------------- deadline-driven streaming -------------------- */
+
+static inline uint64_t now_in_us(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000 + (uint64_t) (t.tv_nsec / 1000);
+}
+
+/* This method encrypts a stream (e.g. STDIN from a slow producer) without
+ * waiting for whole chunks. Input is gathered with poll() into psrc until
+ * the chunk is full or 'latency' us have passed since its first byte, then
+ * every complete block is dispatched. Only the partial-block tail (< 16
+ * bytes) is held back for the next chunk; it is zero padded at EOF. The
+ * hardware CBC chain carries over between transfers, so the output is the
+ * same as encrypt_file's.
+ * Parameters: latency, the deadline in us. 0 dispatches whatever is there.
+ * Return: SUCCESS or FAILURE
+ */
+int encrypt_file_stream(int fdin, int fdout, u32 *key, int forced_buffer_len, int latency)
+{
+    u32 max_len = (forced_buffer_len > 0 && (u32) forced_buffer_len < MAX_SRC_LEN) ? (u32) forced_buffer_len : MAX_SRC_LEN;
+    u32 have = 0, full;
+    uint64_t deadline = 0;
+    int fl, eof = 0;
+    ssize_t n;
+
+    max_len &= ~15U;
+    if (FAILURE == aes_set_key(key))
+        return FAILURE;
+
+    fl = fcntl(fdin, F_GETFL);
+    if (fl < 0 || fcntl(fdin, F_SETFL, fl | O_NONBLOCK) < 0)
+    {
+        perror("fcntl");
+        return FAILURE;
+    }
+
+    while (!eof || have > 0)
+    {
+        /* Coalesce until the chunk is full, the deadline passes or EOF */
+        while (!eof && have < max_len)
+        {
+            struct pollfd pfd = { fdin, POLLIN, 0 };
+            int timeout = -1;
+
+            if (have >= 16)
+            {
+                uint64_t now = now_in_us();
+                if (now >= deadline)
+                    break;
+                timeout = (int) ((deadline - now + 999) / 1000);
+            }
+            if (poll(&pfd, 1, timeout) < 0)
+            {
+                if (EINTR == errno)
+                    continue;
+                perror("poll");
+                goto fail;
+            }
+            n = read(fdin, psrc + have, max_len - have);
+            if (n > 0)
+            {
+                /* The clock starts with the chunk's first complete block */
+                if (have < 16 && have + (u32) n >= 16)
+                    deadline = now_in_us() + (uint64_t) latency;
+                have += (u32) n;
+            }
+            else if (0 == n)
+                eof = 1;
+            else if (EAGAIN != errno && EINTR != errno)
+            {
+                perror("infile");
+                goto fail;
+            }
+        }
+
+        if (eof)
+            for (; have % 16 != 0; have++)
+                psrc[have] = 0;
+        full = have & ~15U;
+        if (0 == full)
+            continue;
+
+        if (FAILURE == dma_start(full))
+            goto fail;
+        if (checksum_mode & CKSUM_PLAIN)
+            checksum_plain = crc32c_update(checksum_plain, psrc, full);
+        if (FAILURE == dma_sync())
+            goto fail;
+        if (checksum_mode & CKSUM_CIPHER)
+            checksum_cipher = crc32c_update(checksum_cipher, pdest, full);
+
+        if (write(fdout, pdest, full) != (ssize_t) full)
+        {
+            perror("outfile");
+            goto fail;
+        }
+
+        /* Keep the partial block for the next chunk */
+        memmove(psrc, psrc + full, have - full);
+        have -= full;
+    }
+
+    fcntl(fdin, F_SETFL, fl);
+    dma_clean_up();
+    return SUCCESS;
+
+fail:
+    fcntl(fdin, F_SETFL, fl);
+    return FAILURE;
+}
+
+
+/* -------------------- io_uring path -------------------- */
+
+#define URING_MAX_SLOTS     4       /* source and destination slots each */
+#define URING_OP_READ       1
+#define URING_OP_WRITE      2
+#define DIRECT_IO_ALIGN     4096
+
+enum { SLOT_FREE, SLOT_BUSY, SLOT_READY };
+
+struct uring_slot
+{
+    struct dma_buf *buf;
+    int state;
+    u32 len;        /* bytes read (source) or to write (destination) */
+    u32 done;       /* bytes already written */
+    uint64_t seq;   /* chunk number, keeps the stream in order */
+    off_t off;      /* file offset of the chunk */
+};
+
+/* Queue a read or write of slot s; fixed buffers are indexed src first, then dst */
+static int uring_queue_io(struct uring *ring, int op, int fd, struct uring_slot *s,
+                          int index, int fixed, u32 pos, u32 len, off_t off)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+    if (NULL == sqe)
+        return FAILURE;
+    if (fixed)
+    {
+        sqe->opcode = op == URING_OP_READ ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+        sqe->buf_index = (uint16_t) index;
+    }
+    else
+        sqe->opcode = op == URING_OP_READ ? IORING_OP_READ : IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) ((char *) s->buf->vaddr + pos);
+    sqe->len = len;
+    sqe->off = (uint64_t) off;
+    sqe->user_data = ((uint64_t) op << 32) | (uint32_t) index;
+    return SUCCESS;
+}
+
+/* Toggle O_DIRECT on an open file; returns 1 if it is now set */
+static int set_direct_io(int fd, int on)
+{
+    int fl = fcntl(fd, F_GETFL);
+
+    if (fl < 0 || fcntl(fd, F_SETFL, on ? (fl | O_DIRECT) : (fl & ~O_DIRECT)) < 0)
+        return 0;
+    return on;
+}
+
+/* This method does the same as encrypt_file, but keeps reads of upcoming
+ * chunks and writes of finished chunks in flight with io_uring while the
+ * current chunk is in the DMA. Chunks live in DMA slots (dma_slab), which
+ * are registered as fixed buffers when the kernel accepts them.
+ * Return: SUCCESS or FAILURE
+ */
+int encrypt_file_uring(int fdin, int fdout, u32 *key, int forced_buffer_len)
+{
+    struct uring ring;
+    struct stat st;
+    struct uring_slot src[URING_MAX_SLOTS], dst[URING_MAX_SLOTS];
+    struct iovec iov[2 * URING_MAX_SLOTS];
+    struct io_uring_cqe *cqe;
+    u32 want, chunk, slot_len = 4096;
+    int nslots, fixed, in_seek, out_seek, in_direct = 0, out_direct = 0;
+    int eof = 0, reads_inflight = 0, writes_inflight = 0, dma_src = -1, dma_dst = -1;
+    uint64_t next_read_seq = 0, next_dma_seq = 0, next_write_seq = 0;
+    off_t read_off = 0, write_off = 0;
+    int ret = FAILURE, err;
+
+    want = (u32) (forced_buffer_len > 0 ? (u32) forced_buffer_len : MAX_SRC_LEN);
+    if (want > MAX_SRC_LEN)
+        want = MAX_SRC_LEN;
+
+    /* Power-of-two slots big enough for a chunk, at least two per side */
+    while (slot_len < want)
+        slot_len <<= 1;
+    while (slot_len > 4096 && RSV_BUF_LEN / slot_len < 4)
+        slot_len >>= 1;
+    chunk = (want < slot_len ? want : slot_len) & ~15U;
+    if (FAILURE == dma_slab_init(slot_len))
+        return FAILURE;
+    nslots = (int) (RSV_BUF_LEN / slot_len / 2);
+    if (nslots > URING_MAX_SLOTS)
+        nslots = URING_MAX_SLOTS;
+
+    if ((err = uring_init(&ring, 2 * URING_MAX_SLOTS)) < 0)
+    {
+        fprintf(stderr, "[ERROR] io_uring is not available: %s\n", strerror(-err));
+        dma_slab_destroy();
+        return FAILURE;
+    }
+
+    memset(src, 0, sizeof(src));
+    memset(dst, 0, sizeof(dst));
+    for (int i = 0; i < nslots; i++)
+    {
+        src[i].buf = dma_buf_alloc(chunk);
+        dst[i].buf = dma_buf_alloc(chunk);
+        if (NULL == src[i].buf || NULL == dst[i].buf)
+        {
+            fprintf(stderr, "[ERROR] Failed to allocate DMA slots\n");
+            nslots = i + 1;
+            goto out;
         }
+        iov[i].iov_base = src[i].buf->vaddr;
+        iov[i].iov_len = src[i].buf->len;
+        iov[nslots + i].iov_base = dst[i].buf->vaddr;
+        iov[nslots + i].iov_len = dst[i].buf->len;
+    }
+    /* Device memory mappings can't always be pinned; plain reads still work */
+    fixed = (0 == uring_register_buffers(&ring, iov, (unsigned) (2 * nslots)));
+
+    in_seek = (0 == fstat(fdin, &st) && S_ISREG(st.st_mode));
+    out_seek = (0 == fstat(fdout, &st) && S_ISREG(st.st_mode));
+    /* O_DIRECT has to pin the slots too; /dev/mem and dma_mmap_coherent
+     * mappings can't be, so it is only tried once registration worked */
+    if (fixed && chunk % DIRECT_IO_ALIGN == 0)
+    {
+        if (in_seek)
+            in_direct = set_direct_io(fdin, 1);
+        if (out_seek)
+            out_direct = set_direct_io(fdout, 1);
     }
+    fprintf(stderr, "[INFO] io_uring: %d x %u KB slots per side, %s buffers, O_DIRECT in/out: %d/%d\n",
+            nslots, chunk / 1024, fixed ? "fixed" : "unregistered", in_direct, out_direct);
+
+    if (FAILURE == aes_set_key(key))
+        goto out;
+
+    for (;;)
+    {
+        int progress = 0;
+
+        /* 1. Keep reads in flight; a pipe only allows one at a time */
+        for (int i = 0; i < nslots && !eof && (in_seek || reads_inflight == 0); i++)
+        {
+            if (src[i].state != SLOT_FREE)
+                continue;
+            src[i].state = SLOT_BUSY;
+            src[i].len = 0;
+            src[i].seq = next_read_seq++;
+            src[i].off = in_seek ? read_off : -1;
+            read_off += chunk;
+            if (FAILURE == uring_queue_io(&ring, URING_OP_READ, fdin, &src[i], i, fixed, 0, chunk, src[i].off))
+                goto out;
+            trace_begin(TRACE_READ, src[i].seq);
+            reads_inflight++;
+        }
 
+        /* 2. Feed the next chunk in order to the DMA */
+        if (dma_src < 0)
+        {
+            for (int i = 0; i < nslots; i++)
+            {
+                if (src[i].state != SLOT_READY || src[i].seq != next_dma_seq)
+                    continue;
+                if (0 == src[i].len)
+                {
+                    /* End of stream marker */
+                    src[i].state = SLOT_FREE;
+                    next_dma_seq++;
+                    progress = 1;
+                    break;
+                }
+                for (int j = 0; j < nslots; j++)
+                {
+                    if (dst[j].state == SLOT_FREE)
+                    {
+                        dma_dst = j;
+                        break;
+                    }
+                }
+                if (dma_dst < 0)
+                    break;
+
+                for (; src[i].len % 16 != 0; src[i].len++)
+                    ((char *) src[i].buf->vaddr)[src[i].len] = 0;
+                if (FAILURE == dma_start_buf(src[i].buf, dst[dma_dst].buf, src[i].len))
+                    goto out;
+                trace_begin(TRACE_DMA, src[i].seq);
+                dma_src = i;
+                dst[dma_dst].state = SLOT_BUSY;
+                break;
+            }
+        }
+
+        /* 3. Let the kernel work on the I/O while the DMA runs */
+        if (uring_submit(&ring, 0) < 0)
+            goto out;
+
+        if (dma_src >= 0)
+        {
+            if (checksum_mode & CKSUM_PLAIN)
+                checksum_plain = crc32c_update(checksum_plain, src[dma_src].buf->vaddr, src[dma_src].len);
+            if (FAILURE == dma_sync())
+                goto out;
+            trace_end(TRACE_DMA, src[dma_src].seq);
+            dst[dma_dst].len = src[dma_src].len;
+            dst[dma_dst].done = 0;
+            dst[dma_dst].seq = src[dma_src].seq;
+            dst[dma_dst].state = SLOT_READY;
+            if (checksum_mode & CKSUM_CIPHER)
+                checksum_cipher = crc32c_update(checksum_cipher, dst[dma_dst].buf->vaddr, dst[dma_dst].len);
+            src[dma_src].state = SLOT_FREE;
+            next_dma_seq++;
+            dma_src = dma_dst = -1;
+            progress = 1;
+        }
+
+        /* 4. Write finished chunks in order */
+        for (int i = 0; i < nslots; i++)
+        {
+            if (dst[i].state != SLOT_READY || dst[i].seq != next_write_seq)
+                continue;
+            if (!out_seek && writes_inflight > 0)
+                break;
+            if (out_direct && dst[i].len % DIRECT_IO_ALIGN != 0)
+            {
+                /* The unaligned tail goes through the page cache */
+                if (writes_inflight > 0)
+                    break;
+                out_direct = set_direct_io(fdout, 0);
+            }
+            dst[i].state = SLOT_BUSY;
+            dst[i].off = out_seek ? write_off : -1;
+            write_off += dst[i].len;
+            next_write_seq++;
+            if (FAILURE == uring_queue_io(&ring, URING_OP_WRITE, fdout, &dst[i], nslots + i, fixed,
+                                          0, dst[i].len, dst[i].off))
+                goto out;
+            trace_begin(TRACE_WRITE, dst[i].seq);
+            writes_inflight++;
+            i = -1; /* the next chunk may be in an earlier slot */
+        }
+
+        /* 5. Reap completions; block only when nothing else can move */
+        if (uring_submit(&ring, (!progress && (reads_inflight + writes_inflight) > 0) ? 1 : 0) < 0)
+            goto out;
+        while (NULL != (cqe = uring_peek_cqe(&ring)))
+        {
+            int op = (int) (cqe->user_data >> 32);
+            int idx = (int) (cqe->user_data & 0xffffffff);
+            int res = cqe->res;
+
+            uring_cqe_seen(&ring);
+            if (res < 0)
+            {
+                fprintf(stderr, "[ERROR] io_uring %s failed: %s\n", op == URING_OP_READ ? "read" : "write", strerror(-res));
+                goto out;
+            }
+
+            if (op == URING_OP_READ)
+            {
+                struct uring_slot *s = &src[idx];
+
+                reads_inflight--;
+                s->len += (u32) res;
+                /* A pipe delivers what it has; keep filling until the chunk is full */
+                if (res > 0 && !in_seek && s->len < chunk)
+                {
+                    if (FAILURE == uring_queue_io(&ring, URING_OP_READ, fdin, s, idx, fixed, s->len, chunk - s->len, -1))
+                        goto out;
+                    reads_inflight++;
+                    continue;
+                }
+                if (res == 0 || (in_seek && s->len < chunk))
+                    eof = 1;
+                trace_end(TRACE_READ, s->seq);
+                s->state = SLOT_READY;
+            }
+            else
+            {
+                struct uring_slot *s = &dst[idx - nslots];
+
+                s->done += (u32) res;
+                if (s->done < s->len)
+                {
+                    if (FAILURE == uring_queue_io(&ring, URING_OP_WRITE, fdout, s, idx, fixed, s->done,
+                                                  s->len - s->done, s->off < 0 ? -1 : s->off + s->done))
+                        goto out;
+                    continue;
+                }
+                trace_end(TRACE_WRITE, s->seq);
+                writes_inflight--;
+                s->state = SLOT_FREE;
+            }
+        }
+
+        if (eof && reads_inflight == 0 && writes_inflight == 0 && dma_src < 0)
+        {
+            int busy = 0;
+            for (int i = 0; i < nslots; i++)
+                busy |= (src[i].state != SLOT_FREE) | (dst[i].state != SLOT_FREE);
+            if (!busy)
+                break;
+        }
+    }
+    ret = SUCCESS;
+
+out:
+    if (in_direct)
+        set_direct_io(fdin, 0);
+    if (out_direct)
+        set_direct_io(fdout, 0);
+    uring_exit(&ring);
+    for (int i = 0; i < nslots; i++)
+    {
+        dma_buf_put(src[i].buf);
+        dma_buf_put(dst[i].buf);
+    }
+    dma_slab_destroy();
+    if (SUCCESS == ret)
+        dma_clean_up();
+    return ret;
+}
+
+/* -------------------- chunk-size autotuning -------------------- */
+
+#define AUTOTUNE_MIN_CHUNK  4096
+#define AUTOTUNE_BYTES      (8 * 1024 * 1024)   /* moved per chunk size */
+#define AUTOTUNE_MIN_RUNS   8
+#define AUTOTUNE_SLACK      0.95    /* a smaller chunk wins within 5% of the best rate */
+#define AUTOTUNE_MAX_SIZES  32
+
+/* This method measures the hardware path on the live device for chunk
+ * sizes from AUTOTUNE_MIN_CHUNK up to MAX_SRC_LEN, the way encrypt_file
+ * runs a chunk: copy in, transfer, copy out. The smallest chunk within
+ * 5% of the best throughput has the lowest latency for about the same
+ * rate; it is saved to the profile as hw.chunk.
+ * Parameters: key, pointer to the key
+ *             iv, the IV
+ * Return: SUCCESS or FAILURE
+ */
+int autotune_chunk(u32 *key, u32 *iv)
+{
+    u32 sizes[AUTOTUNE_MAX_SIZES], runs, n = 0, best = 0, pick;
+    double mbps[AUTOTUNE_MAX_SIZES], lat_us[AUTOTUNE_MAX_SIZES];
+    struct timespec begin_t, end_t;
+    char *data;
+    uint64_t us;
+    char value[32];
+
+    if (NULL == (data = malloc(MAX_SRC_LEN)))
+    {
+        perror("malloc");
+        return FAILURE;
+    }
+    for (u32 i = 0; i < MAX_SRC_LEN; i++)
+        data[i] = (char) rand();
+    if (FAILURE == aes_set_key(key) || FAILURE == aes_set_iv(iv))
+        goto fail;
+
+    for (u32 chunk = AUTOTUNE_MIN_CHUNK; n < AUTOTUNE_MAX_SIZES; chunk *= 2)
+    {
+        if (chunk > MAX_SRC_LEN)
+            chunk = MAX_SRC_LEN & ~15U;
+        runs = AUTOTUNE_BYTES / chunk;
+        if (runs < AUTOTUNE_MIN_RUNS)
+            runs = AUTOTUNE_MIN_RUNS;
+
+        clock_gettime(CLOCK_MONOTONIC_RAW, &begin_t);
+        for (u32 r = 0; r < runs; r++)
+        {
+            memcpy(psrc, data, chunk);
+            if (FAILURE == dma_start(chunk) || FAILURE == dma_sync())
+                goto fail;
+            memcpy(data, pdest, chunk);
+        }
+        clock_gettime(CLOCK_MONOTONIC_RAW, &end_t);
+        us = time_diff_in_us(&begin_t, &end_t);
+        if (0 == us)
+            us = 1;
+
+        sizes[n] = chunk;
+        mbps[n] = (double) chunk * runs / us;    /* bytes/us == MB/s */
+        lat_us[n] = (double) us / runs;
+        fprintf(stderr, "[INFO] %8u bytes: %8.1f MB/s, %8.1f us per chunk\n", chunk, mbps[n], lat_us[n]);
+        if (mbps[n] > mbps[best])
+            best = n;
+        n++;
+        if (chunk == (MAX_SRC_LEN & ~15U))
+            break;
+    }
+
+    for (pick = 0; mbps[pick] < AUTOTUNE_SLACK * mbps[best]; pick++)
+        ;
+    fprintf(stderr, "[INFO] Best rate %.1f MB/s at %u bytes. Using %u bytes (%.1f MB/s, %.1f us).\n",
+            mbps[best], sizes[best], sizes[pick], mbps[pick], lat_us[pick]);
+
+    profile_set_u32("hw.chunk", sizes[pick]);
+    snprintf(value, sizeof(value), "%.1f", mbps[pick]);
+    profile_set("hw.mbps", value);
+    profile_set_u32("hw.latency_us", (u32) lat_us[pick]);
+    profile_set_u32("hw.buffer", RSV_BUF_LEN);
+    free(data);
     dma_clean_up();
+    return 0 == profile_save() ? SUCCESS : FAILURE;
+
+fail:
+    free(data);
+    return FAILURE;
+}
+
+/* -------------------- manifest batch mode -------------------- */
+
+#define MANIFEST_MAX_BATCH  256     /* objects staged together */
+
+struct manifest_obj
+{
+    char *outfile;
+    u32 off, len;   /* padded object at psrc + off, result at pdest + off */
+};
+
+/* Read up to len bytes, or to EOF.
+ * Return: the number of bytes read, or -1 */
+static ssize_t read_full(int fd, char *buf, size_t len)
+{
+    size_t got = 0;
+    ssize_t n;
+
+    while (got < len && (n = read(fd, buf + got, len - got)) != 0)
+    {
+        if (n < 0)
+        {
+            if (EINTR == errno)
+                continue;
+            return -1;
+        }
+        got += (size_t) n;
+    }
+    return (ssize_t) got;
+}
+
+static int write_full(int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    for (size_t done = 0; done < len; done += (size_t) n)
+    {
+        if ((n = write(fd, buf + done, len - done)) < 0)
+        {
+            if (EINTR == errno)
+            {
+                n = 0;
+                continue;
+            }
+            return FAILURE;
+        }
+    }
     return SUCCESS;
 }
 
+static int write_object(struct manifest_obj *obj)
+{
+    int fd = open(obj->outfile, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+    if (fd < 0 || FAILURE == write_full(fd, pdest + obj->off, obj->len))
+    {
+        perror(obj->outfile);
+        if (fd >= 0)
+            close(fd);
+        return FAILURE;
+    }
+    close(fd);
+    return SUCCESS;
+}
+
+/* Run the staged objects back to back, each from the IV, and scatter the
+ * results: an object is written out while the next one is in flight. */
+static int run_manifest_batch(struct manifest_obj *objs, int n, u32 *iv)
+{
+    int i, ret = SUCCESS;
+
+    if (FAILURE == dma_arb_acquire())
+        ret = FAILURE;
+    for (i = 0; SUCCESS == ret && i < n; i++)
+    {
+        /* The IV registers may only change while the DMA is idle */
+        if (FAILURE == aes_set_iv(iv)
+            || (objs[i].len > 0 && FAILURE == dma_start_addr(dma_phys_addr(psrc + objs[i].off),
+                                                            dma_phys_addr(pdest + objs[i].off), objs[i].len)))
+        {
+            ret = FAILURE;
+            break;
+        }
+        if (i > 0 && FAILURE == write_object(&objs[i - 1]))
+            ret = FAILURE;
+        if (objs[i].len > 0 && FAILURE == dma_sync())
+            ret = FAILURE;
+    }
+    if (SUCCESS == ret && n > 0)
+        ret = write_object(&objs[n - 1]);
+    dma_arb_release();
+
+    for (i = 0; i < n; i++)
+        free(objs[i].outfile);
+    return ret;
+}
+
+/* An object larger than the buffer runs on its own, one chunk at a time */
+static int encrypt_object(int fdin, const char *outfile, u32 *iv)
+{
+    ssize_t n;
+    u32 cnt;
+    int fdout = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+    if (fdout < 0)
+    {
+        perror(outfile);
+        return FAILURE;
+    }
+    if (FAILURE == aes_set_iv(iv))
+        goto fail;
+    while ((n = read_full(fdin, psrc, MAX_SRC_LEN)) > 0)
+    {
+        for (cnt = (u32) n; cnt % 16 != 0; cnt++)
+            psrc[cnt] = 0;
+        if (FAILURE == dma_start(cnt) || FAILURE == dma_sync())
+            goto fail;
+        if (FAILURE == write_full(fdout, pdest, cnt))
+        {
+            perror(outfile);
+            goto fail;
+        }
+    }
+    if (n < 0)
+        goto fail;
+    close(fdout);
+    return SUCCESS;
+
+fail:
+    close(fdout);
+    return FAILURE;
+}
+
+/* This method encrypts every "infile outfile" pair listed in the manifest,
+ * each as its own CBC message starting from iv. Small objects are packed
+ * into the buffer together and run back to back, so the process setup and
+ * the key load are paid once for the whole manifest. Blank lines and lines
+ * starting with '#' are skipped.
+ * Parameters: manifest, path to the manifest
+ *             key, pointer to the key
+ *             iv, the IV every object starts from
+ * Return: SUCCESS or FAILURE
+ */
+int encrypt_manifest(const char *manifest, u32 *key, u32 *iv)
+{
+    struct manifest_obj objs[MANIFEST_MAX_BATCH];
+    char line[2 * PATH_MAX + 16], in_path[PATH_MAX], out_path[PATH_MAX];
+    struct stat st;
+    FILE *mf;
+    u32 pos = 0, padded;
+    unsigned long nobjs = 0, nbatches = 0, bytes = 0;
+    int n = 0, fd, fields, lineno = 0, ret = SUCCESS;
+    ssize_t got;
+
+    if (NULL == (mf = fopen(manifest, "r")))
+    {
+        perror(manifest);
+        return FAILURE;
+    }
+    if (FAILURE == aes_set_key(key))
+    {
+        fclose(mf);
+        return FAILURE;
+    }
+
+    while (SUCCESS == ret && fgets(line, sizeof(line), mf))
+    {
+        lineno++;
+        if ('#' == line[strspn(line, " \t")] || (fields = sscanf(line, "%4095s %4095s", in_path, out_path)) < 1)
+            continue;
+        if (fields != 2)
+        {
+            fprintf(stderr, "[ERROR] %s:%d: expected \"infile outfile\"\n", manifest, lineno);
+            ret = FAILURE;
+            break;
+        }
+        if ((fd = open(in_path, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+        {
+            perror(in_path);
+            if (fd >= 0)
+                close(fd);
+            ret = FAILURE;
+            break;
+        }
+
+        padded = S_ISREG(st.st_mode) && (unsigned long long) st.st_size <= MAX_SRC_LEN
+                 ? ((u32) st.st_size + 15) & ~15U : MAX_SRC_LEN + 1;
+
+        /* Flush when the object doesn't fit behind the staged ones */
+        if (n > 0 && (n == MANIFEST_MAX_BATCH || padded > MAX_SRC_LEN - pos))
+        {
+            ret = run_manifest_batch(objs, n, iv);
+            nbatches++;
+            n = 0;
+            pos = 0;
+        }
+
+        if (SUCCESS == ret && padded > MAX_SRC_LEN)
+        {
+            ret = encrypt_object(fd, out_path, iv);
+            nbatches++;
+        }
+        else if (SUCCESS == ret)
+        {
+            if ((got = read_full(fd, psrc + pos, padded)) < 0)
+            {
+                perror(in_path);
+                ret = FAILURE;
+            }
+            else if (NULL == (objs[n].outfile = strdup(out_path)))
+            {
+                perror("strdup");
+                ret = FAILURE;
+            }
+            else
+            {
+                for (; (u32) got < padded; got++)
+                    psrc[pos + (u32) got] = 0;
+                objs[n].off = pos;
+                objs[n].len = padded;
+                pos += padded;
+                n++;
+            }
+        }
+        close(fd);
+        nobjs++;
+        bytes += (unsigned long) st.st_size;
+    }
+    fclose(mf);
+
+    if (n > 0)
+    {
+        if (SUCCESS == ret)
+        {
+            ret = run_manifest_batch(objs, n, iv);
+            nbatches++;
+        }
+        else
+        {
+            for (int i = 0; i < n; i++)
+                free(objs[i].outfile);
+        }
+    }
+
+    if (SUCCESS == ret)
+        fprintf(stderr, "[INFO] Encrypted %lu objects (%lu KB) in %lu batches.\n", nobjs, bytes / 1024, nbatches);
+    dma_clean_up();
+    return ret;
+}
+
 
 /* This method prints the passed-in error message on stderr if not NULL.
  * It then prints the usage line and exit with code EX_USAGE.
@@ -172,14 +1040,20 @@ void args_error(const char* err_msg)
  */
 int main(int argc, char *argv[])
 {
-    int opt; /* option and error return code holders */
+    int opt, status; /* option and error return code holders */
     int fdin, fdout, fdkey; /* file descriptors of in/outfile */
     int forced_transfer_len = -1;
     int interval = -1;
+    int latency = -1;
+    int nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
     char *keyfile = NULL; /* char pointer to the password */
     char *infile = NULL;
     char *outfile = NULL;
+    char *manifest = NULL;
+    char *engine = NULL;
+    char *tracefile = NULL;
     char *buf = NULL;
+    char outtmp[PATH_MAX] = ""; /* -g -d output until the tag is checked */
     clock_t start = 0, end;
     double cpu_time_used;
     struct timespec begin_t, end_t;
@@ -198,6 +1072,19 @@ int main(int argc, char *argv[])
         unsigned int f : 1;
         unsigned int p : 1;
         unsigned int r : 1;
+        unsigned int c : 1;
+        unsigned int g : 1;
+        unsigned int m : 1;
+        unsigned int j : 1;
+        unsigned int x : 1;
+        unsigned int B : 1;
+        unsigned int u : 1;
+        unsigned int l : 1;
+        unsigned int P : 1;
+        unsigned int b : 1;
+        unsigned int a : 1;
+        unsigned int E : 1;
+        unsigned int T : 1;
     } flags; /* flags for command line options */
     memset(&flags, 0, sizeof(flags)); /* zero the flags */
     memset(iv, 0, sizeof(u32) * 4); /* zero the iv */
@@ -228,6 +1115,56 @@ int main(int argc, char *argv[])
             case 'r':
                 flags.r = 1;
                 break;
+            case 'c':
+                flags.c = 1;
+                break;
+            case 'g':
+                flags.g = 1;
+                break;
+            case 'm':
+                flags.m = 1;
+                break;
+            case 'u':
+                flags.u = 1;
+                break;
+            case 'P':
+                flags.P = 1;
+                break;
+            case 'a':
+                flags.a = 1;
+                break;
+            case 'j':
+                if(flags.j == 0)  /* make sure -j hasn't been provided yet */
+                {
+                    nthreads = atoi(optarg);
+                    flags.j = 1;
+                }
+                else
+                    args_error("[ERROR] Option -j should only be provided once.\n");
+                break;
+            case 'x':
+                if(flags.x == 0)  /* make sure -x hasn't been provided yet */
+                {
+                    if (strchr(optarg, 'p'))
+                        checksum_mode |= CKSUM_PLAIN;
+                    if (strchr(optarg, 'c'))
+                        checksum_mode |= CKSUM_CIPHER;
+                    if (checksum_mode == 0)
+                        args_error("[ERROR] Option -x expects 'p', 'c' or 'pc'.\n");
+                    flags.x = 1;
+                }
+                else
+                    args_error("[ERROR] Option -x should only be provided once.\n");
+                break;
+            case 'B':
+                if(flags.B == 0)  /* make sure -B hasn't been provided yet */
+                {
+                    dma_buf_request = (u32) atoi(optarg) * 1024;
+                    flags.B = 1;
+                }
+                else
+                    args_error("[ERROR] Option -B should only be provided once.\n");
+                break;
             case 'k':
                 if(flags.k == 0)  /* make sure -k hasn't been provided yet */
                 {
@@ -247,6 +1184,8 @@ int main(int argc, char *argv[])
                 if(flags.f == 0)  /* make sure -k hasn't been provided yet */
                 {
                     forced_transfer_len = atoi(optarg);
+                    if (forced_transfer_len <= 0 || forced_transfer_len % 16 != 0)
+                        args_error("[ERROR] The transfer length should be a positive multiple of 16.\n");
                     flags.f = 1;
                 }
                 else
@@ -261,6 +1200,44 @@ int main(int argc, char *argv[])
                 else
                     args_error("[ERROR] Option -p should only be provided once.\n");
                 break;
+            case 'b':
+                if(flags.b == 0)
+                {
+                    manifest = optarg;
+                    flags.b = 1;
+                }
+                else
+                    args_error("[ERROR] Option -b should only be provided once.\n");
+                break;
+            case 'E':
+                if(flags.E == 0)
+                {
+                    engine = optarg;
+                    flags.E = 1;
+                }
+                else
+                    args_error("[ERROR] Option -E should only be provided once.\n");
+                break;
+            case 'T':
+                if(flags.T == 0)
+                {
+                    tracefile = optarg;
+                    flags.T = 1;
+                }
+                else
+                    args_error("[ERROR] Option -T should only be provided once.\n");
+                break;
+            case 'l':
+                if(flags.l == 0)
+                {
+                    latency = atoi(optarg);
+                    if (latency < 0)
+                        args_error("[ERROR] The latency should not be negative.\n");
+                    flags.l = 1;
+                }
+                else
+                    args_error("[ERROR] Option -l should only be provided once.\n");
+                break;
             case 'i':
                 if(flags.i == 0)  /* make sure -p hasn't been provided yet */
                 {
@@ -313,11 +1290,28 @@ int main(int argc, char *argv[])
     if(argc - optind != 0)
         args_error("[ERROR] Extra arguments are provided.\n");
 
+    /* Only the CBC paths update the checksums */
+    if(flags.x && (flags.c || flags.g || flags.m || flags.b || flags.a))
+        args_error("[ERROR] Option -x can't be used with -c, -g, -m, -b or -a.\n");
+
+
+    if(flags.E && 0 != sw_engine_force(engine))
+    {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "[ERROR] Unknown or unsupported engine '%s'. Built in: %s.\n",
+                 engine, sw_engine_names());
+        args_error(msg);
+    }
 
     /* -------- arguments checking is done by here --------- */
 
+    if (flags.T && 0 != trace_open(tracefile))
+        exit(EX_CANTCREAT);
+
     if (flags.f)
         fprintf(stderr,"[INFO] Forced transfer length to be exact %d bytes.\n", forced_transfer_len);
+    else if (!flags.a && 0 == profile_load())
+        tuned_chunk_len = profile_get_u32("hw.chunk", 0);
 
     /* If -p is provided, open the password file */
     if(flags.k)
@@ -373,15 +1367,25 @@ int main(int argc, char *argv[])
     /* If -o is provided, open the outfile */
     if(flags.o)
     {
-        if((fdout = open(outfile, O_RDWR|O_CREAT, 0666)) < 0)
+        /* GCM plaintext goes to a temporary file, renamed once the tag matches */
+        if (flags.g && flags.d)
+        {
+            mode_t mask = umask(0);
+
+            umask(mask);
+            snprintf(outtmp, sizeof(outtmp), "%s.XXXXXX", outfile);
+            if ((fdout = mkstemp(outtmp)) >= 0)
+                fchmod(fdout, 0666 & ~mask);
+        }
+        else
+            fdout = open(outfile, O_RDWR|O_CREAT, 0666);
+        if(fdout < 0)
         {
             perror(outfile);
             close(fdin);
             exit(EX_CANTCREAT);
         }
         fprintf(stderr,"[INFO] Output is set to %s\n", outfile);
-        free(outfile);
-        outfile = NULL;
     }
     else
     {
@@ -397,6 +1401,14 @@ int main(int argc, char *argv[])
             close(fdout);
             exit(1);
         }
+
+        /* The buffer size is only known now; a chunk tuned for another one doesn't apply */
+        if (tuned_chunk_len > 0 && profile_get_u32("hw.buffer", 0) != RSV_BUF_LEN)
+        {
+            fprintf(stderr,"[INFO] The profile's chunk size was tuned for a %u byte buffer, not %u. "
+                    "Ignoring it; re-run -a.\n", profile_get_u32("hw.buffer", 0), RSV_BUF_LEN);
+            tuned_chunk_len = 0;
+        }
     }
 
     if (flags.p)
@@ -411,7 +1423,68 @@ int main(int argc, char *argv[])
         start = clock();
     }
 
-    if (flags.s)
+    if (flags.g)
+    {
+        if (flags.n)
+        {
+            if (NULL == (buf = malloc(1024 * 1024)))
+            {
+                perror("malloc");
+                close(fdin);
+                close(fdout);
+                exit(1);
+            }
+        }
+        else
+            buf = psrc;
+
+        fprintf(stderr,"[INFO] Option -g is set. Use software GCM %scryption.\n", flags.d ? "de" : "en");
+        if (0 != (flags.d ? decrypt_file_gcm_sw(fdin, fdout, key, buf, forced_transfer_len)
+                          : encrypt_file_gcm_sw(fdin, fdout, key, buf, forced_transfer_len)))
+        {
+            fprintf(stderr, "[ERROR] GCM %scryption failed.\n", flags.d ? "de" : "en");
+            if (outtmp[0])
+                unlink(outtmp);
+            close(fdin);
+            close(fdout);
+            exit(1);
+        }
+        if (outtmp[0] && 0 != rename(outtmp, outfile))
+        {
+            perror(outfile);
+            unlink(outtmp);
+            close(fdin);
+            close(fdout);
+            exit(EX_CANTCREAT);
+        }
+    }
+    else if (flags.c)
+    {
+        if (flags.n)
+        {
+            if (NULL == (buf = malloc(1024 * 1024)))
+            {
+                perror("malloc");
+                close(fdin);
+                close(fdout);
+                exit(1);
+            }
+        }
+        else
+            buf = psrc;
+
+        /* axis_aes128 only chains CBC, so CTR always runs on the CPU */
+        fprintf(stderr,"[INFO] Option -c is set. Use software CTR %scryption.\n", flags.d ? "de" : "en");
+        if (0 != (flags.d ? decrypt_file_ctr_sw(fdin, fdout, key, buf, forced_transfer_len, nthreads > 0 ? nthreads : 1)
+                          : encrypt_file_ctr_sw(fdin, fdout, key, buf, forced_transfer_len, nthreads > 0 ? nthreads : 1)))
+        {
+            fprintf(stderr, "[ERROR] CTR %scryption failed.\n", flags.d ? "de" : "en");
+            close(fdin);
+            close(fdout);
+            exit(1);
+        }
+    }
+    else if (flags.s)
     {
         if (flags.n)
         {
@@ -427,7 +1500,11 @@ int main(int argc, char *argv[])
             buf = psrc;
 
         fprintf(stderr,"[INFO] Option -s is set. Use software encryption.\n");
-        if (0 != encrypt_file_sw(fdin, fdout, key, iv, buf, flags.r, forced_transfer_len))
+        if (flags.P)
+            status = cipher_file_pipelined(fdin, fdout, key, iv, flags.r, 0, forced_transfer_len, 1);
+        else
+            status = encrypt_file_sw(fdin, fdout, key, iv, buf, flags.r, forced_transfer_len);
+        if (0 != status)
         {
             perror("encryption");
             close(fdin);
@@ -451,7 +1528,11 @@ int main(int argc, char *argv[])
             buf = psrc;
 
         fprintf(stderr,"[INFO] Option -d is set. Use software decryption.\n");
-        if (0 != decrypt_file_sw(fdin, fdout, key, iv, buf, flags.r, forced_transfer_len))
+        if (flags.P)
+            status = cipher_file_pipelined(fdin, fdout, key, iv, flags.r, 1, forced_transfer_len, nthreads);
+        else
+            status = decrypt_file_sw(fdin, fdout, key, iv, buf, flags.r, forced_transfer_len);
+        if (0 != status)
         {
             perror("decryption");
             close(fdin);
@@ -459,6 +1540,56 @@ int main(int argc, char *argv[])
             exit(1);
         }
     }
+    else if (flags.a && !flags.n)
+    {
+        fprintf(stderr,"[INFO] Option -a is set. Tune the chunk size.\n");
+        if(FAILURE == autotune_chunk(key, iv))
+        {
+            close(fdin);
+            close(fdout);
+            exit(1);
+        }
+    }
+    else if (flags.b && !flags.n)
+    {
+        fprintf(stderr,"[INFO] Option -b is set. Encrypt the files listed in %s.\n", manifest);
+        if(FAILURE == encrypt_manifest(manifest, key, iv))
+        {
+            close(fdin);
+            close(fdout);
+            exit(1);
+        }
+    }
+    else if (flags.m && !flags.n)
+    {
+        fprintf(stderr,"[INFO] Option -m is set. Compute AES-CMAC on the hardware.\n");
+        if(FAILURE == mac_file(fdin, fdout, key, forced_transfer_len))
+        {
+            close(fdin);
+            close(fdout);
+            exit(1);
+        }
+    }
+    else if (flags.l && !flags.n)
+    {
+        fprintf(stderr,"[INFO] Option -l is set. Streaming with a %d us deadline.\n", latency);
+        if(FAILURE == encrypt_file_stream(fdin, fdout, key, forced_transfer_len, latency))
+        {
+            close(fdin);
+            close(fdout);
+            exit(1);
+        }
+    }
+    else if (flags.u && !flags.n)
+    {
+        fprintf(stderr,"[INFO] Option -u is set. Use io_uring for file I/O.\n");
+        if(FAILURE == encrypt_file_uring(fdin, fdout, key, forced_transfer_len))
+        {
+            close(fdin);
+            close(fdout);
+            exit(1);
+        }
+    }
     else if (!flags.n)
     {
         if(FAILURE == encrypt_file(fdin, fdout, key, forced_transfer_len, flags.t))
@@ -473,6 +1604,9 @@ int main(int argc, char *argv[])
         fprintf(stderr,"[INFO] Option -n is set. No actions are performed.\n");
     }
 
+    if (flags.x)
+        checksum_report();
+
     if (flags.t)
     {
         end = clock();
@@ -487,6 +1621,7 @@ int main(int argc, char *argv[])
 
     close(fdin);
     close(fdout);
+    free(outfile);
 
     return 0; /* exit(0) */
 }
@@ -0,0 +1,445 @@
+/*
+ * File name: aes128load.c
+ * Program name: aes128load
+ * Version: 1.0
+ * Author: Hsiang-Ju Lai
+ * Description:
+ *  Replays a captured workload against a backend and reports the
+ *  throughput and the latency distribution. A workload is a text file of
+ *  "<time_ns> <bytes>" lines, one per request, as printed by
+ *  scripts/aes128_capture.sh from a running process or by -C from a
+ *  register trace (see dma_regtrace.h). Requests keep their recorded
+ *  spacing (scaled by -s) and are dealt round-robin to the client
+ *  threads. Latency is measured from when a request was due, so a
+ *  backend that falls behind is charged for the backlog too.
+ *      Usage: aes128load [-h] [-C regtrace] [-b backend] [-c clients] [-s speed] [-r repeat] [-k keyfile] workload
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sysexits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dma_driver.h"
+#include "dma_queue.h"
+#include "dma_regtrace.h"
+#include "sw_aes.h"
+#include "sw_engine.h"
+
+#define USAGE_LINE "Usage: aes128load [-h] [-C regtrace] [-b backend] [-c clients] [-s speed] [-r repeat] [-k keyfile] workload\n"
+
+#define HELP "AES128LOAD: Replay a captured workload and report throughput and tail latency. Options...\n\n\
+\t-h: Display the help (this) message. \n\n\
+\t-C regtrace: Print the transfers of a register trace as a workload and exit. \n\n\
+\t-b backend: 'hw' (the DMA queue), 'sw' (software CBC) or 'null' (no work). The default is hw. \n\n\
+\t-c clients: Number of client threads. The default is 4. \n\n\
+\t-s speed: Scale the arrival rate by 'speed'. 0 sends every request as soon as \n\
+\t   its client is free. The default is 1. \n\n\
+\t-r repeat: Play the workload 'repeat' times back to back. The default is 1. \n\n\
+\t-k keyfile: Specify the path to the key file. \n\n"
+
+#define OPTIONS "hC:b:c:s:r:k:" /* Options for getopt(3) */
+
+#define MAX_CLIENTS         256
+#define QUEUE_DEPTH         256
+#define MM2S_LEN_REG        0x28    /* as in dma_driver.c */
+
+/* Key = 0x000102030405060708090A0B0C0D0E0F */
+#define TEST_KEY_HH    0x00010203
+#define TEST_KEY_HL    0x04050607
+#define TEST_KEY_LH    0x08090A0B
+#define TEST_KEY_LL    0x0C0D0E0F
+
+enum { BACKEND_HW, BACKEND_SW, BACKEND_NULL };
+
+struct request
+{
+    uint64_t at;        /* ns after the start of the run */
+    u32 len;
+};
+
+struct client
+{
+    pthread_t thread;
+    int id;
+    uint8_t *buf;
+    uint64_t *lat;      /* ns, one per request this client sent */
+    size_t nlat;
+    uint64_t bytes;
+    int failed;
+};
+
+static struct request *reqs;
+static size_t nreqs;
+static u32 max_len;
+static int backend = BACKEND_HW;
+static int nclients = 4;
+static double speed = 1.0;
+static int repeat = 1;
+static u32 key[4];
+static uint64_t run_start, workload_span;
+
+/* This method prints the passed-in error message on stderr if not NULL.
+ * It then prints the usage line and exit with code EX_USAGE.
+ * Parameters: err_msg, a constant char pointer to the string to be printed.
+ *             pass NULL if no error message to print
+ * Post-condition: The program exit with proper error code.
+ */
+void args_error(const char* err_msg)
+{
+    if(err_msg != NULL) //print err_msg is not NULL
+        fputs(err_msg, stderr);
+    fprintf(stderr, USAGE_LINE);
+    exit(EX_USAGE);
+}
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t t)
+{
+    struct timespec ts = { (time_t) (t / 1000000000ULL), (long) (t % 1000000000ULL) };
+
+    while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))
+        ;
+}
+
+static int cmp_request(const void *a, const void *b)
+{
+    uint64_t x = ((const struct request *) a)->at, y = ((const struct request *) b)->at;
+
+    return x < y ? -1 : x > y;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Print the transfers of a register trace as workload lines */
+static int convert_regtrace(const char *path)
+{
+    const struct dma_regtrace_hdr *h;
+    const struct dma_regtrace_rec *r;
+    struct stat st;
+    uint64_t n;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0 || 0 != fstat(fd, &st))
+    {
+        perror(path);
+        return EX_NOINPUT;
+    }
+    if (st.st_size < (off_t) sizeof(*h)
+        || MAP_FAILED == (h = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+        || DMA_REGTRACE_MAGIC != h->magic || DMA_REGTRACE_VERSION != h->version)
+    {
+        fprintf(stderr, "[ERROR] %s is not a version %d register trace\n", path, DMA_REGTRACE_VERSION);
+        return EX_DATAERR;
+    }
+    close(fd);
+
+    n = h->count < h->capacity ? h->count : h->capacity;
+    if (n > (st.st_size - sizeof(*h)) / sizeof(*r))
+        n = (st.st_size - sizeof(*h)) / sizeof(*r);
+    printf("# aes128 workload: <time_ns> <bytes>, from register trace %s\n", path);
+    for (r = (const struct dma_regtrace_rec *) (h + 1); n-- > 0; r++)
+        if (REGTRACE_DMA_WRITE == r->type && MM2S_LEN_REG == r->offset)
+            printf("%llu %u\n", (unsigned long long) r->ns, r->value);
+    munmap((void *) h, (size_t) st.st_size);
+    return 0;
+}
+
+/* Lines of "<time_ns> <bytes>"; '#' starts a comment */
+static int load_workload(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    char line[256];
+    unsigned long long t;
+    unsigned long len;
+    size_t cap = 0;
+
+    if (NULL == fp)
+    {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp))
+    {
+        char *hash = strchr(line, '#');
+
+        if (hash)
+            *hash = '\0';
+        if (sscanf(line, "%llu %lu", &t, &len) != 2 || 0 == len)
+            continue;
+        if (nreqs == cap)
+        {
+            struct request *p = realloc(reqs, (cap = cap ? cap * 2 : 1024) * sizeof(*reqs));
+
+            if (NULL == p)
+            {
+                perror("realloc");
+                fclose(fp);
+                return -1;
+            }
+            reqs = p;
+        }
+        reqs[nreqs].at = t;
+        reqs[nreqs].len = (u32) ((len + 15) & ~15UL);
+        if (reqs[nreqs].len > max_len)
+            max_len = reqs[nreqs].len;
+        nreqs++;
+    }
+    fclose(fp);
+    if (0 == nreqs)
+    {
+        fprintf(stderr, "[ERROR] %s holds no requests\n", path);
+        return -1;
+    }
+
+    /* Make the times relative to the first request */
+    qsort(reqs, nreqs, sizeof(*reqs), cmp_request);
+    for (size_t i = nreqs; i-- > 0; )
+        reqs[i].at -= reqs[0].at;
+    workload_span = reqs[nreqs - 1].at;
+    return 0;
+}
+
+static void *client_run(void *arg)
+{
+    struct client *c = arg;
+    struct AES_ctx ctx;
+    u32 iv[4] = { 0, 0, 0, 0 };
+    uint64_t due, period = (uint64_t) ((double) workload_span / (speed > 0 ? speed : 1)) + 1;
+
+    if (BACKEND_SW == backend)
+        AES_init_ctx_iv(&ctx, (const uint8_t *) key, (const uint8_t *) iv);
+
+    for (int pass = 0; pass < repeat; pass++)
+    {
+        for (size_t i = (size_t) c->id; i < nreqs; i += (size_t) nclients)
+        {
+            const struct request *r = &reqs[i];
+
+            due = run_start + (speed > 0 ? pass * period + (uint64_t) ((double) r->at / speed) : 0);
+            if (speed > 0)
+                sleep_until(due);
+            else
+                due = now_ns();
+
+            if (BACKEND_HW == backend)
+            {
+                if (FAILURE == dma_request(c->buf, c->buf, r->len, iv))
+                {
+                    c->failed = 1;
+                    return NULL;
+                }
+            }
+            else if (BACKEND_SW == backend)
+            {
+                AES_ctx_set_iv(&ctx, (const uint8_t *) iv);
+                AES_CBC_encrypt_buffer(&ctx, c->buf, r->len);
+            }
+            c->lat[c->nlat++] = now_ns() - due;
+            c->bytes += r->len;
+        }
+    }
+    return NULL;
+}
+
+static double percentile(const uint64_t *sorted, size_t n, double p)
+{
+    size_t i = (size_t) (p / 100.0 * (double) (n - 1) + 0.5);
+
+    return sorted[i < n ? i : n - 1] / 1000.0;
+}
+
+static void read_key(const char *keyfile)
+{
+    char temp[9];
+    int fdkey;
+
+    if ((fdkey = open(keyfile, O_RDONLY)) < 0)
+    {
+        perror(keyfile);
+        exit(EX_NOINPUT);
+    }
+    temp[8] = '\0';
+    for (int i = 0; i < 4; i++)
+    {
+        if (8 != read(fdkey, temp, 8))
+        {
+            perror("Failed to read key file");
+            exit(EX_NOINPUT);
+        }
+        key[i] = (u32) strtol(temp, NULL, 16);
+    }
+    close(fdkey);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt, failed = 0;
+    char *keyfile = NULL;
+    struct client *clients;
+    uint64_t *all, elapsed;
+    size_t nall = 0;
+    double bytes = 0, mean = 0;
+    const char *backend_names[] = { "hw", "sw", "null" };
+
+    key[0] = TEST_KEY_HH;
+    key[1] = TEST_KEY_HL;
+    key[2] = TEST_KEY_LH;
+    key[3] = TEST_KEY_LL;
+
+    while((opt = getopt(argc, argv, OPTIONS)) != -1)
+    {
+        switch(opt)
+        {
+            case 'h':
+                fprintf(stderr, HELP);
+                args_error(NULL);
+                break;
+            case 'C':
+                return convert_regtrace(optarg);
+            case 'b':
+                if (0 == strcmp(optarg, "hw"))
+                    backend = BACKEND_HW;
+                else if (0 == strcmp(optarg, "sw"))
+                    backend = BACKEND_SW;
+                else if (0 == strcmp(optarg, "null"))
+                    backend = BACKEND_NULL;
+                else
+                    args_error("[ERROR] The backend must be 'hw', 'sw' or 'null'.\n");
+                break;
+            case 'c':
+                if ((nclients = atoi(optarg)) < 1 || nclients > MAX_CLIENTS)
+                    args_error("[ERROR] The number of clients must be between 1 and 256.\n");
+                break;
+            case 's':
+                if ((speed = atof(optarg)) < 0)
+                    args_error("[ERROR] The speed should not be negative.\n");
+                break;
+            case 'r':
+                if ((repeat = atoi(optarg)) < 1)
+                    args_error("[ERROR] The repeat count must be at least 1.\n");
+                break;
+            case 'k':
+                keyfile = optarg;
+                break;
+            default: /* opt == '?' */
+                args_error(NULL);
+        }
+    }
+    if (argc - optind != 1)
+        args_error("[ERROR] Expected one workload file.\n");
+
+    /* -------- arguments checking is done by here --------- */
+
+    if (keyfile)
+        read_key(keyfile);
+    if (0 != load_workload(argv[optind]))
+        exit(EX_DATAERR);
+    fprintf(stderr, "[INFO] %lu requests over %.3f ms, up to %u bytes, %d clients, backend %s.\n",
+            (unsigned long) nreqs, workload_span / 1e6, max_len, nclients, backend_names[backend]);
+
+    if (BACKEND_HW == backend)
+    {
+        if (FAILURE == dma_init())
+            exit(1);
+        if (FAILURE == aes_set_key(key) || FAILURE == dma_queue_init(QUEUE_DEPTH, key))
+        {
+            dma_clean_up();
+            exit(1);
+        }
+    }
+    else if (BACKEND_SW == backend)
+        sw_engine_get(SW_MODE_CBC_ENC);     /* benchmark before the clock starts */
+
+    if (NULL == (clients = calloc((size_t) nclients, sizeof(*clients))))
+    {
+        perror("calloc");
+        exit(1);
+    }
+    for (int i = 0; i < nclients; i++)
+    {
+        clients[i].id = i;
+        clients[i].buf = calloc(1, max_len);
+        clients[i].lat = malloc(sizeof(uint64_t) * ((nreqs / (size_t) nclients + 1) * (size_t) repeat));
+        if (NULL == clients[i].buf || NULL == clients[i].lat)
+        {
+            perror("malloc");
+            exit(1);
+        }
+    }
+
+    /* Give the clients a moment to start before the first request is due */
+    run_start = now_ns() + 1000000;
+    for (int i = 0; i < nclients; i++)
+        if (0 != pthread_create(&clients[i].thread, NULL, client_run, &clients[i]))
+        {
+            perror("pthread_create");
+            exit(1);
+        }
+    for (int i = 0; i < nclients; i++)
+    {
+        pthread_join(clients[i].thread, NULL);
+        failed |= clients[i].failed;
+        nall += clients[i].nlat;
+    }
+    elapsed = now_ns() - run_start;
+
+    if (BACKEND_HW == backend)
+    {
+        dma_queue_destroy();
+        dma_clean_up();
+    }
+    if (failed)
+        fprintf(stderr, "[ERROR] Some requests failed; the results cover the ones that completed.\n");
+    if (0 == nall)
+        exit(1);
+
+    if (NULL == (all = malloc(sizeof(uint64_t) * nall)))
+    {
+        perror("malloc");
+        exit(1);
+    }
+    nall = 0;
+    for (int i = 0; i < nclients; i++)
+    {
+        for (size_t j = 0; j < clients[i].nlat; j++)
+        {
+            all[nall++] = clients[i].lat[j];
+            mean += (double) clients[i].lat[j];
+        }
+        bytes += (double) clients[i].bytes;
+        free(clients[i].buf);
+        free(clients[i].lat);
+    }
+    qsort(all, nall, sizeof(uint64_t), cmp_u64);
+
+    printf("%lu requests, %.0f KB in %.3f ms: %.1f MB/s, %.0f requests/s\n",
+           (unsigned long) nall, bytes / 1024, elapsed / 1e6, bytes / (elapsed / 1e9) / 1e6, nall / (elapsed / 1e9));
+    printf("latency (us): mean %.1f  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+           mean / nall / 1000.0, percentile(all, nall, 50), percentile(all, nall, 90),
+           percentile(all, nall, 99), percentile(all, nall, 99.9), all[nall - 1] / 1000.0);
+
+    free(all);
+    free(clients);
+    free(reqs);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,463 @@
+/*
+ * File name: aes128replay.c
+ * Program name: aes128replay
+ * Version: 1.0
+ * Author: Hsiang-Ju Lai
+ * Description:
+ *  Reads a register trace recorded with AES128_REGTRACE (see
+ *  dma_regtrace.h) and replays it through a timing model of the board.
+ *  The model is fitted to the trace itself: the accelerator time and the
+ *  host time between transfers as a fixed cost plus a cost per byte, and
+ *  the cost of one status poll. The recorded transfers are then run
+ *  through the model again, optionally with another polling interval
+ *  (-p), re-chunked into transfers of another size (-f) or with several
+ *  transfers staged per batch (-b), and the predicted time is compared
+ *  with what was recorded.
+ *      Usage: aes128replay [-hdx] [-p interval] [-f nbytes] [-b batch] tracefile
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sysexits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dma_regtrace.h"
+
+#define USAGE_LINE "Usage: aes128replay [-hdx] [-p interval] [-f nbytes] [-b batch] tracefile\n"
+
+#define HELP "AES128REPLAY: Replay a recorded register trace through a timing model. Options...\n\n\
+\t-h: Display the help (this) message. \n\n\
+\t-d: Dump the records as text and exit. \n\n\
+\t-x: Print every recorded transfer as a CSV line and exit. \n\n\
+\t-p interval: Model a DMA polling interval of 'interval' us. The default is the recorded one. \n\n\
+\t-f nbytes: Model transfers of 'nbytes' bytes. The default is the recorded sizes. \n\n\
+\t-b batch: Model 'batch' transfers staged together, paying the fixed host cost once. \n\n"
+
+#define OPTIONS "hdxp:f:b:" /* Options for getopt(3) */
+
+/* Register offsets, as in dma_driver.c */
+#define MM2S_LEN_REG        0x28
+#define S2MM_STATUS_REG     0x34
+#define DMA_DONE_BITS       (1<<1 | 1<<12)
+
+/* Used when the trace has no polls to measure them from */
+#define DEFAULT_POLL_NS     1000.0
+#define DEFAULT_SLEEP_NS    60000.0     /* usleep() overshoot */
+
+/* One transfer as recorded */
+struct xfer
+{
+    double start;       /* length register written */
+    double done;        /* accelerator finished (estimated from the polls) */
+    double sync_begin, sync_end;
+    u32 len, polls;
+    int interval;       /* polling interval in effect */
+    int failed;
+};
+
+/* y = a + b * x */
+struct fit
+{
+    double a, b;
+};
+
+struct model
+{
+    struct fit hw;      /* accelerator time against length */
+    struct fit gap;     /* host time before a transfer against its length */
+    double overlap;     /* host work between starting a transfer and syncing */
+    double poll_ns;     /* one status poll */
+    double sleep_ns;    /* usleep() beyond the asked interval */
+    int poll_measured, sleep_measured;
+    int single_len;     /* only one transfer size was recorded */
+};
+
+static const char *type_names[] = { "?", "dma_write", "dma_poll", "aes_write", "sync_begin", "sync_end" };
+
+/* This method prints the passed-in error message on stderr if not NULL.
+ * It then prints the usage line and exit with code EX_USAGE.
+ * Parameters: err_msg, a constant char pointer to the string to be printed.
+ *             pass NULL if no error message to print
+ * Post-condition: The program exit with proper error code.
+ */
+void args_error(const char* err_msg)
+{
+    if(err_msg != NULL) //print err_msg is not NULL
+        fputs(err_msg, stderr);
+    fprintf(stderr, USAGE_LINE);
+    exit(EX_USAGE);
+}
+
+/* Least squares. When every x is the same, the split between the fixed
+ * and the per-byte cost is unknown: all of it is taken to be per byte,
+ * so the model never credits a larger chunk with savings it can't see. */
+static struct fit fit_line(const double *x, const double *y, int n, int *single)
+{
+    double sx = 0, sy = 0, sxx = 0, sxy = 0, den;
+    struct fit f = { 0, 0 };
+
+    if (n <= 0)
+        return f;
+    for (int i = 0; i < n; i++)
+    {
+        sx += x[i];
+        sy += y[i];
+        sxx += x[i] * x[i];
+        sxy += x[i] * y[i];
+    }
+    den = n * sxx - sx * sx;
+    if (den > 1e-9 * (sxx > 1 ? sxx : 1) * n)
+    {
+        f.b = (n * sxy - sx * sy) / den;
+        f.a = (sy - f.b * sx) / n;
+    }
+    else if (sx > 0)
+    {
+        f.b = sy / sx;
+        *single = 1;
+    }
+    else
+        f.a = sy / n;
+    /* Negative costs only come from noise */
+    if (f.b < 0)
+    {
+        f.b = 0;
+        f.a = sy / n;
+    }
+    if (f.a < 0)
+        f.a = 0;
+    return f;
+}
+
+/* Pull the transfers of device dev out of the records */
+static int extract(const struct dma_regtrace_rec *recs, uint64_t n, int dev, struct xfer *out)
+{
+    struct xfer *x = NULL;
+    double last_busy = -1;
+    int nx = 0;
+
+    for (uint64_t i = 0; i < n; i++)
+    {
+        const struct dma_regtrace_rec *r = &recs[i];
+        double t = (double) r->ns;
+
+        if (r->dev != dev)
+            continue;
+        switch (r->type)
+        {
+            case REGTRACE_DMA_WRITE:
+                if (MM2S_LEN_REG == r->offset)
+                {
+                    x = &out[nx++];
+                    memset(x, 0, sizeof(*x));
+                    x->start = t;
+                    x->len = r->value;
+                    x->done = -1;
+                    x->sync_begin = -1;
+                    last_busy = -1;
+                }
+                break;
+            case REGTRACE_DMA_POLL:
+                if (NULL == x || x->done >= 0 || S2MM_STATUS_REG != r->offset)
+                    break;
+                /* It finished somewhere between the last busy poll and this one */
+                if ((r->value & DMA_DONE_BITS) == DMA_DONE_BITS)
+                    x->done = last_busy >= 0 ? (last_busy + t) / 2 : t;
+                else
+                    last_busy = t;
+                break;
+            case REGTRACE_SYNC_BEGIN:
+                if (NULL != x && x->sync_begin < 0)
+                {
+                    x->sync_begin = t;
+                    x->interval = (int) r->value;
+                }
+                break;
+            case REGTRACE_SYNC_END:
+                if (NULL == x || x->sync_begin < 0)
+                    break;
+                x->sync_end = t;
+                x->polls = r->value;
+                x->failed = r->offset != 0;
+                if (x->done < 0)
+                    x->done = t;
+                x = NULL;
+                break;
+        }
+    }
+    /* Drop a transfer the trace ends in the middle of */
+    if (NULL != x)
+        nx--;
+    return nx;
+}
+
+static void build_model(const struct xfer *xs, int nx, struct model *m)
+{
+    double *x = malloc(sizeof(double) * (size_t) (nx + 1));
+    double *y = malloc(sizeof(double) * (size_t) (nx + 1));
+    double poll_sum = 0, sleep_sum = 0, overlap_sum = 0;
+    int n = 0, npoll = 0, nsleep = 0, noverlap = 0;
+
+    memset(m, 0, sizeof(*m));
+    if (NULL == x || NULL == y)
+    {
+        perror("malloc");
+        exit(1);
+    }
+
+    for (int i = 0; i < nx; i++)
+    {
+        if (xs[i].failed)
+            continue;
+        x[n] = xs[i].len;
+        y[n++] = xs[i].done - xs[i].start;
+        overlap_sum += xs[i].sync_begin - xs[i].start;
+        noverlap++;
+
+        /* The time per poll, when there were enough to average */
+        if (xs[i].polls > 2)
+        {
+            double per = (xs[i].sync_end - xs[i].sync_begin) / xs[i].polls;
+
+            if (0 == xs[i].interval)
+            {
+                poll_sum += per;
+                npoll++;
+            }
+            else
+            {
+                sleep_sum += per - xs[i].interval * 1000.0;
+                nsleep++;
+            }
+        }
+    }
+    m->hw = fit_line(x, y, n, &m->single_len);
+    m->overlap = noverlap > 0 ? overlap_sum / noverlap : 0;
+
+    n = 0;
+    for (int i = 1; i < nx; i++)
+    {
+        x[n] = xs[i].len;
+        y[n++] = xs[i].start - xs[i - 1].sync_end;
+    }
+    m->gap = fit_line(x, y, n, &m->single_len);
+
+    m->poll_measured = npoll > 0;
+    m->poll_ns = npoll > 0 ? poll_sum / npoll : DEFAULT_POLL_NS;
+    m->sleep_measured = nsleep > 0;
+    m->sleep_ns = nsleep > 0 ? sleep_sum / nsleep - m->poll_ns : DEFAULT_SLEEP_NS;
+    if (m->sleep_ns < 0)
+        m->sleep_ns = 0;
+    free(x);
+    free(y);
+}
+
+/* Predicted time of one transfer of len bytes, from the end of the previous
+ * sync to the end of its own, and the polls it takes */
+static double model_xfer(const struct model *m, double len, int interval, int pay_fixed, double *polls)
+{
+    double hw = m->hw.a + m->hw.b * len;
+    double period = m->poll_ns + (interval > 0 ? interval * 1000.0 + m->sleep_ns : 0);
+    double gap = (pay_fixed ? m->gap.a : 0) + m->gap.b * len;
+    double wait = 0, n = 1;
+
+    /* The first poll comes after the overlapped work, then one per period */
+    if (hw > m->overlap)
+    {
+        n = 1 + (double) (long long) ((hw - m->overlap) / period + 0.999999);
+        wait = (n - 1) * period;
+    }
+    *polls = n;
+    return gap + m->overlap + wait + m->poll_ns;
+}
+
+static void dump(const struct dma_regtrace_rec *recs, uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++)
+    {
+        const struct dma_regtrace_rec *r = &recs[i];
+
+        printf("%12.3f us  dev %d  %-10s  %04x  %08x\n", r->ns / 1000.0, r->dev,
+               r->type < sizeof(type_names) / sizeof(type_names[0]) ? type_names[r->type] : "?",
+               r->offset, r->value);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int opt, fd, interval = -1, batch = 1, dump_recs = 0, dump_xfers = 0;
+    long chunk = 0;
+    const struct dma_regtrace_hdr *h;
+    const struct dma_regtrace_rec *recs;
+    struct xfer *xs;
+    struct stat st;
+    uint64_t n;
+    double total_recorded = 0, total_model = 0, total_replay = 0;
+
+    while((opt = getopt(argc, argv, OPTIONS)) != -1)
+    {
+        switch(opt)
+        {
+            case 'h':
+                fprintf(stderr, HELP);
+                args_error(NULL);
+                break;
+            case 'd':
+                dump_recs = 1;
+                break;
+            case 'x':
+                dump_xfers = 1;
+                break;
+            case 'p':
+                if ((interval = atoi(optarg)) < 0)
+                    args_error("[ERROR] The polling interval should not be negative.\n");
+                break;
+            case 'f':
+                if ((chunk = atol(optarg)) <= 0 || chunk % 16 != 0)
+                    args_error("[ERROR] The chunk size must be a positive multiple of 16.\n");
+                break;
+            case 'b':
+                if ((batch = atoi(optarg)) < 1)
+                    args_error("[ERROR] The batch size must be at least 1.\n");
+                break;
+            default: /* opt == '?' */
+                args_error(NULL);
+        }
+    }
+    if (argc - optind != 1)
+        args_error("[ERROR] Expected one trace file.\n");
+
+    if ((fd = open(argv[optind], O_RDONLY)) < 0 || 0 != fstat(fd, &st))
+    {
+        perror(argv[optind]);
+        exit(EX_NOINPUT);
+    }
+    if (st.st_size < (off_t) sizeof(*h)
+        || MAP_FAILED == (h = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)))
+    {
+        fprintf(stderr, "[ERROR] %s is not a register trace\n", argv[optind]);
+        exit(EX_DATAERR);
+    }
+    close(fd);
+    if (DMA_REGTRACE_MAGIC != h->magic || DMA_REGTRACE_VERSION != h->version)
+    {
+        fprintf(stderr, "[ERROR] %s is not a version %d register trace\n", argv[optind], DMA_REGTRACE_VERSION);
+        exit(EX_DATAERR);
+    }
+
+    /* A trace cut short by a crash still has its header's capacity */
+    n = h->count < h->capacity ? h->count : h->capacity;
+    if (n > (st.st_size - sizeof(*h)) / sizeof(struct dma_regtrace_rec))
+        n = (st.st_size - sizeof(*h)) / sizeof(struct dma_regtrace_rec);
+    recs = (const struct dma_regtrace_rec *) (h + 1);
+    if (h->count > n)
+        fprintf(stderr, "[INFO] %llu records were not saved; the replay covers the first %llu.\n",
+                (unsigned long long) (h->count - n), (unsigned long long) n);
+
+    if (dump_recs)
+    {
+        dump(recs, n);
+        return 0;
+    }
+
+    if (NULL == (xs = malloc(sizeof(*xs) * (size_t) (n / 2 + 1))))
+    {
+        perror("malloc");
+        exit(1);
+    }
+    if (dump_xfers)
+        printf("dev,start_us,len,hw_us,sync_us,polls,interval_us,failed\n");
+
+    for (int dev = 0; dev < (int) h->ndevices && dev < DMA_MAX_DEVICES; dev++)
+    {
+        struct model m;
+        double recorded, modelled = 0, replayed = 0, polls, polls_rec = 0, polls_replay = 0;
+        double bytes = 0, left, len = 0;
+        int nx = extract(recs, n, dev, xs), k = 0;
+
+        if (nx <= 0)
+            continue;
+        if (dump_xfers)
+        {
+            for (int i = 0; i < nx; i++)
+                printf("%d,%.3f,%u,%.3f,%.3f,%u,%d,%d\n", dev, xs[i].start / 1000.0, xs[i].len,
+                       (xs[i].done - xs[i].start) / 1000.0, (xs[i].sync_end - xs[i].sync_begin) / 1000.0,
+                       xs[i].polls, xs[i].interval, xs[i].failed);
+            continue;
+        }
+
+        build_model(xs, nx, &m);
+        recorded = xs[nx - 1].sync_end - xs[0].start;
+        for (int i = 0; i < nx; i++)
+        {
+            bytes += xs[i].len;
+            polls_rec += xs[i].polls;
+            modelled += model_xfer(&m, xs[i].len, xs[i].interval, 1, &polls);
+        }
+        /* The recording starts at the first transfer, not the gap before it */
+        modelled -= m.gap.a + m.gap.b * xs[0].len;
+
+        /* The same bytes under the new parameters. Re-chunking treats the
+         * recorded transfers as one stream. */
+        if (chunk > 0)
+        {
+            for (left = bytes; left > 0; left -= len, k++)
+            {
+                len = left < chunk ? left : chunk;
+                replayed += model_xfer(&m, len, interval >= 0 ? interval : xs[0].interval, k % batch == 0, &polls);
+                polls_replay += polls;
+            }
+        }
+        else
+        {
+            for (; k < nx; k++)
+            {
+                replayed += model_xfer(&m, xs[k].len, interval >= 0 ? interval : xs[k].interval, k % batch == 0, &polls);
+                polls_replay += polls;
+            }
+        }
+
+        replayed -= m.gap.a + m.gap.b * (chunk > 0 ? (bytes < chunk ? bytes : chunk) : xs[0].len);
+
+        printf("Device %d\n", dev);
+        printf("  recorded:  %d transfers, %.0f KB in %.3f ms (%.1f MB/s), %.1f polls per transfer\n",
+               nx, bytes / 1024, recorded / 1e6, bytes / (recorded / 1e9) / 1e6, polls_rec / nx);
+        printf("  model:     accelerator %.2f us + %.3f ns/B, host gap %.2f us + %.3f ns/B, overlap %.2f us\n",
+               m.hw.a / 1000, m.hw.b, m.gap.a / 1000, m.gap.b, m.overlap / 1000);
+        printf("             poll %.3f us (%s), sleep overshoot %.1f us (%s)\n",
+               m.poll_ns / 1000, m.poll_measured ? "measured" : "assumed",
+               m.sleep_ns / 1000, m.sleep_measured ? "measured" : "assumed");
+        if (m.single_len)
+            printf("             one transfer size was recorded: its costs are taken to scale with length\n");
+        printf("  as recorded: %.3f ms (%+.1f%% against the recording)\n",
+               modelled / 1e6, 100.0 * (modelled - recorded) / recorded);
+        printf("  replayed:  %d transfers in %.3f ms (%.1f MB/s), %.1f polls per transfer\n",
+               k, replayed / 1e6, bytes / (replayed / 1e9) / 1e6, polls_replay / k);
+
+        /* Devices run side by side: the slowest one sets the total */
+        if (recorded > total_recorded)
+            total_recorded = recorded;
+        if (modelled > total_model)
+            total_model = modelled;
+        if (replayed > total_replay)
+            total_replay = replayed;
+    }
+
+    if (!dump_xfers)
+    {
+        if (total_recorded <= 0)
+        {
+            fprintf(stderr, "[ERROR] The trace holds no complete transfer\n");
+            return 1;
+        }
+        printf("Total: recorded %.3f ms, modelled %.3f ms, replayed %.3f ms (%+.1f%%)\n",
+               total_recorded / 1e6, total_model / 1e6, total_replay / 1e6,
+               100.0 * (total_replay - total_model) / total_model);
+    }
+    free(xs);
+    munmap((void *) h, (size_t) st.st_size);
+    return 0;
+}
@@ -0,0 +1,277 @@
+/*
+ * File name: aes128stat.c
+ * Program name: aes128stat
+ * Version: 1.0
+ * Author: Hsiang-Ju Lai
+ * Description:
+ *  Shows the DMA counters that running aes128 processes publish in
+ *  /aes128_metrics.<pid> (see dma_metrics.h). By default it prints the
+ *  rates of every process and device once per interval. -d prints the
+ *  current totals once, one "name{labels} value" line per counter.
+ *      Usage: aes128stat [-hd] [-i interval] [-n count] [pid...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sysexits.h>
+
+#include "dma_metrics.h"
+
+#define USAGE_LINE "Usage: aes128stat [-hd] [-i interval] [-n count] [pid...]\n"
+
+#define HELP "AES128STAT: Show the accelerator counters of running aes128 processes. Options...\n\n\
+\t-h: Display the help (this) message. \n\n\
+\t-d: Dump the totals once and exit. \n\n\
+\t-i interval: Seconds between samples. The default is 1. \n\n\
+\t-n count: Exit after 'count' samples. The default is to run until killed. \n\n\
+\tpid...: Only show these processes. The default is every one found. \n\n"
+
+#define OPTIONS "hdi:n:" /* Options for getopt(3) */
+
+#define MAX_PROCS       64
+#define HEADER_EVERY    20      /* lines between column headers */
+
+/* A process being watched and its previous sample */
+struct proc
+{
+    pid_t pid;
+    const struct dma_metrics *m;
+    struct dma_dev_metrics last[DMA_MAX_DEVICES];
+    uint64_t last_ns;
+};
+
+static struct proc procs[MAX_PROCS];
+static int nprocs;
+
+/* This method prints the passed-in error message on stderr if not NULL.
+ * It then prints the usage line and exit with code EX_USAGE.
+ * Parameters: err_msg, a constant char pointer to the string to be printed.
+ *             pass NULL if no error message to print
+ * Post-condition: The program exit with proper error code.
+ */
+void args_error(const char* err_msg)
+{
+    if(err_msg != NULL) //print err_msg is not NULL
+        fputs(err_msg, stderr);
+    fprintf(stderr, USAGE_LINE);
+    exit(EX_USAGE);
+}
+
+/* Copy the counters out, so one sample is used for every column */
+static void snapshot(const struct dma_dev_metrics *src, struct dma_dev_metrics *dst)
+{
+    const uint64_t *s = (const uint64_t *) src;
+    uint64_t *d = (uint64_t *) dst;
+
+    for (size_t i = 0; i < offsetof(struct dma_dev_metrics, last_mm2s_status) / sizeof(uint64_t); i++)
+        d[i] = __atomic_load_n(&s[i], __ATOMIC_RELAXED);
+    dst->last_mm2s_status = __atomic_load_n(&src->last_mm2s_status, __ATOMIC_RELAXED);
+    dst->last_s2mm_status = __atomic_load_n(&src->last_s2mm_status, __ATOMIC_RELAXED);
+}
+
+/* Attach to the processes asked for, or to every one found. Processes
+ * that exited are dropped. */
+static void refresh(const pid_t *wanted, int nwanted)
+{
+    pid_t found[MAX_PROCS];
+    int nfound, i, j, known;
+
+    for (i = 0; i < nprocs; )
+    {
+        if (0 == procs[i].m->magic || procs[i].m->pid != procs[i].pid || 0 != kill(procs[i].pid, 0))
+        {
+            dma_metrics_detach(procs[i].m);
+            procs[i] = procs[--nprocs];
+        }
+        else
+            i++;
+    }
+
+    if (nwanted > 0)
+    {
+        memcpy(found, wanted, sizeof(pid_t) * (size_t) nwanted);
+        nfound = nwanted;
+    }
+    else
+        nfound = dma_metrics_list(found, MAX_PROCS);
+
+    for (i = 0; i < nfound && nprocs < MAX_PROCS; i++)
+    {
+        for (j = 0, known = 0; j < nprocs; j++)
+            known |= procs[j].pid == found[i];
+        if (known || NULL == (procs[nprocs].m = dma_metrics_attach(found[i])))
+            continue;
+        procs[nprocs].pid = found[i];
+        for (j = 0; j < DMA_MAX_DEVICES; j++)
+            snapshot(&procs[nprocs].m->dev[j], &procs[nprocs].last[j]);
+        procs[nprocs].last_ns = dma_metrics_now();
+        nprocs++;
+    }
+}
+
+static void dump()
+{
+    struct dma_dev_metrics d;
+    const struct dma_metrics *m;
+    uint64_t now = dma_metrics_now();
+
+    for (int i = 0; i < nprocs; i++)
+    {
+        m = procs[i].m;
+        printf("aes128_uptime_seconds{pid=\"%d\",comm=\"%s\"} %.3f\n",
+               (int) m->pid, m->comm, (double) (now - m->start_ns) / 1e9);
+        for (uint32_t dev = 0; dev < m->ndevices && dev < DMA_MAX_DEVICES; dev++)
+        {
+            snapshot(&m->dev[dev], &d);
+#define DUMP(name, value) \
+            printf("aes128_" name "{pid=\"%d\",dev=\"%u\"} %llu\n", (int) m->pid, dev, (unsigned long long) (value))
+            DUMP("transfers_total", d.transfers);
+            DUMP("bytes_total", d.bytes);
+            DUMP("dma_wait_ns_total", d.wait_ns);
+            DUMP("polls_total", d.polls);
+            DUMP("timeouts_total", d.timeouts);
+            DUMP("errors_total", d.errors);
+            DUMP("key_loads_total", d.key_loads);
+            DUMP("iv_loads_total", d.iv_loads);
+            DUMP("resets_total", d.resets);
+            DUMP("arb_waits_total", d.arb_waits);
+            DUMP("arb_wait_ns_total", d.arb_wait_ns);
+            DUMP("last_mm2s_status", d.last_mm2s_status);
+            DUMP("last_s2mm_status", d.last_s2mm_status);
+#undef DUMP
+        }
+    }
+}
+
+/* One line per process and device with the rates since the last sample */
+static int show(int lines)
+{
+    struct dma_dev_metrics d, *l;
+    uint64_t now, dt;
+    uint64_t xfers;
+
+    for (int i = 0; i < nprocs; i++)
+    {
+        now = dma_metrics_now();
+        dt = now - procs[i].last_ns;
+        if (0 == dt)
+            dt = 1;
+        for (uint32_t dev = 0; dev < procs[i].m->ndevices && dev < DMA_MAX_DEVICES; dev++)
+        {
+            if (0 == lines++ % HEADER_EVERY)
+                printf("%7s %-15s %3s %9s %8s %6s %9s %9s %6s %5s %6s %6s\n", "PID", "COMM", "DEV", "MB/s",
+                       "XFER/s", "WAIT%", "WAIT_us", "POLLS/X", "KEYS/s", "ARB%", "TMO", "ERR");
+            snapshot(&procs[i].m->dev[dev], &d);
+            l = &procs[i].last[dev];
+            xfers = d.transfers - l->transfers;
+            printf("%7d %-15s %3u %9.2f %8.0f %6.1f %9.1f %9.1f %6.0f %5.1f %6llu %6llu\n",
+                   (int) procs[i].pid, procs[i].m->comm, dev,
+                   (double) (d.bytes - l->bytes) * 1e3 / (double) dt,
+                   (double) xfers * 1e9 / (double) dt,
+                   (double) (d.wait_ns - l->wait_ns) * 100.0 / (double) dt,
+                   xfers ? (double) (d.wait_ns - l->wait_ns) / 1e3 / (double) xfers : 0.0,
+                   xfers ? (double) (d.polls - l->polls) / (double) xfers : 0.0,
+                   (double) (d.key_loads - l->key_loads) * 1e9 / (double) dt,
+                   (double) (d.arb_wait_ns - l->arb_wait_ns) * 100.0 / (double) dt,
+                   (unsigned long long) d.timeouts, (unsigned long long) d.errors);
+            if (d.errors != l->errors || d.timeouts != l->timeouts)
+                printf("        last status: MM2S %08x S2MM %08x\n", d.last_mm2s_status, d.last_s2mm_status);
+            *l = d;
+        }
+        procs[i].last_ns = now;
+    }
+    fflush(stdout);
+    return lines;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    int interval = 1;
+    int count = -1;
+    int lines = 0;
+    pid_t wanted[MAX_PROCS];
+    int nwanted = 0;
+    struct {
+        unsigned int h : 1;
+        unsigned int d : 1;
+        unsigned int i : 1;
+        unsigned int n : 1;
+    } flags; /* flags for command line options */
+    memset(&flags, 0, sizeof(flags)); /* zero the flags */
+
+    /* parse arguments and set flags/arguments */
+    while((opt = getopt(argc, argv, OPTIONS)) != -1)
+    {
+        switch(opt)
+        {
+            case 'h':
+                flags.h = 1;
+                break;
+            case 'd':
+                flags.d = 1;
+                break;
+            case 'i':
+                if(flags.i == 0)
+                {
+                    interval = atoi(optarg);
+                    if (interval <= 0)
+                        args_error("[ERROR] The interval should be positive.\n");
+                    flags.i = 1;
+                }
+                else
+                    args_error("[ERROR] Option -i should only be provided once.\n");
+                break;
+            case 'n':
+                if(flags.n == 0)
+                {
+                    count = atoi(optarg);
+                    flags.n = 1;
+                }
+                else
+                    args_error("[ERROR] Option -n should only be provided once.\n");
+                break;
+
+            default: /* opt == '?' */
+                args_error(NULL);
+        }
+    }
+
+    if(flags.h)
+    {
+        fprintf(stderr,HELP);
+        args_error(NULL);
+    }
+
+    for (; optind < argc && nwanted < MAX_PROCS; optind++)
+    {
+        char *end;
+
+        wanted[nwanted] = (pid_t) strtol(argv[optind], &end, 10);
+        if ('\0' != *end || wanted[nwanted] <= 0)
+            args_error("[ERROR] Expected a pid.\n");
+        nwanted++;
+    }
+
+    /* -------- arguments checking is done by here --------- */
+
+    refresh(wanted, nwanted);
+    if (flags.d)
+    {
+        dump();
+        return 0;
+    }
+    if (0 == nprocs)
+        fprintf(stderr, "[INFO] No aes128 process found yet. Waiting...\n");
+
+    while (0 != count--)
+    {
+        sleep((unsigned int) interval);
+        lines = show(lines);
+        refresh(wanted, nwanted);
+    }
+    return 0;
+}
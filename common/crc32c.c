@@ -0,0 +1,113 @@
+/*
+ * File name: crc32c.c
+ * Version: 1.0
+ * Author: Hsiang-Ju Lai
+ * Description:
+ *  CRC32C (polynomial 0x1EDC6F41, reflected 0x82F63B78) with a hardware
+ *  path where the CPU has one.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#include "crc32c.h"
+
+#define CRC32C_POLY     0x82F63B78
+
+int checksum_mode;
+uint32_t checksum_plain;
+uint32_t checksum_cipher;
+
+#if defined(__SSE4_2__) || defined(__ARM_FEATURE_CRC32)
+
+static uint32_t crc32c_raw(uint32_t crc, const unsigned char *p, size_t len)
+{
+    uint64_t word;
+
+    for (; len >= 8; len -= 8, p += 8)
+    {
+        memcpy(&word, p, 8);
+#if defined(__SSE4_2__)
+        crc = (uint32_t) _mm_crc32_u64(crc, word);
+#else
+        crc = __crc32cd(crc, word);
+#endif
+    }
+    for (; len > 0; len--, p++)
+    {
+#if defined(__SSE4_2__)
+        crc = _mm_crc32_u8(crc, *p);
+#else
+        crc = __crc32cb(crc, *p);
+#endif
+    }
+    return crc;
+}
+
+#else
+
+static uint32_t crc_table[8][256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_init_table()
+{
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t crc = n;
+        for (int k = 0; k < 8; k++)
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        crc_table[0][n] = crc;
+    }
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t crc = crc_table[0][n];
+        for (int k = 1; k < 8; k++)
+        {
+            crc = crc_table[0][crc & 0xff] ^ (crc >> 8);
+            crc_table[k][n] = crc;
+        }
+    }
+}
+
+/* Slicing-by-8: one table lookup per input byte, eight bytes per step */
+static uint32_t crc32c_raw(uint32_t crc, const unsigned char *p, size_t len)
+{
+    uint32_t lo, hi;
+
+    pthread_once(&crc_table_once, crc32c_init_table);
+
+    for (; len >= 8; len -= 8, p += 8)
+    {
+        lo = crc ^ ((uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24);
+        hi = (uint32_t) p[4] | (uint32_t) p[5] << 8 | (uint32_t) p[6] << 16 | (uint32_t) p[7] << 24;
+        crc = crc_table[7][lo & 0xff] ^ crc_table[6][(lo >> 8) & 0xff] ^
+              crc_table[5][(lo >> 16) & 0xff] ^ crc_table[4][lo >> 24] ^
+              crc_table[3][hi & 0xff] ^ crc_table[2][(hi >> 8) & 0xff] ^
+              crc_table[1][(hi >> 16) & 0xff] ^ crc_table[0][hi >> 24];
+    }
+    for (; len > 0; len--, p++)
+        crc = crc_table[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#endif
+
+uint32_t crc32c_update(uint32_t crc, const void *buf, size_t len)
+{
+    return ~crc32c_raw(~crc, buf, len);
+}
+
+void checksum_report()
+{
+    if (checksum_mode & CKSUM_PLAIN)
+        fprintf(stderr, "[INFO] CRC32C of the plaintext: %08x\n", checksum_plain);
+    if (checksum_mode & CKSUM_CIPHER)
+        fprintf(stderr, "[INFO] CRC32C of the ciphertext: %08x\n", checksum_cipher);
+}
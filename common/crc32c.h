@@ -0,0 +1,34 @@
+/**
+ *  crc32c.h - CRC32C (Castagnoli) checksum used to fingerprint the data
+ *  while it is enc/decrypted, so no second pass over the file is needed.
+ *
+ *  Author: Hsiang-Ju Lai <happyx94@gmail.com>
+ */
+#ifndef _CRC32C_H
+#define _CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CKSUM_PLAIN     1   /* checksum the plaintext side */
+#define CKSUM_CIPHER    2   /* checksum the ciphertext side */
+
+/* Which sides encrypt_file/file_cipher checksum (0 = none) */
+extern int checksum_mode;
+/* Running checksums, valid after the file has been processed */
+extern uint32_t checksum_plain;
+extern uint32_t checksum_cipher;
+
+/**
+ *  Extend crc with len bytes at buf. Start with crc = 0.
+ *  Uses the SSE4.2 or ARMv8 CRC32C instructions when the build enables
+ *  them, and slicing-by-8 tables otherwise.
+ */
+extern uint32_t crc32c_update(uint32_t crc, const void *buf, size_t len);
+
+/**
+ *  Print the enabled checksums on stderr.
+ */
+extern void checksum_report();
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * File name: dma_cmac.c
+ * Version: 1.0
+ * Author: Hsiang-Ju Lai
+ * Description:
+ *  AES-CMAC on the accelerator, moved out of aes128.c so that cmactest
+ *  can run it against a software stand-in for the driver.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dma_cmac.h"
+#include "sw_aes.h"
+
+/* CMAC doubling in GF(2^128): shift left by one bit, reduce with 0x87 */
+static void cmac_dbl(u8 *out, const u8 *in)
+{
+    u8 carry = in[0] >> 7;
+
+    for (int i = 0; i < 15; i++)
+        out[i] = (u8) ((in[i] << 1) | (in[i + 1] >> 7));
+    out[15] = (u8) ((in[15] << 1) ^ (carry ? 0x87 : 0));
+}
+
+/* Reverse the byte order of each 16-byte block in place (the -r convention) */
+static void reverse_blocks(u8 *buf, size_t len)
+{
+    u8 t;
+
+    for (size_t b = 0; b < len; b += AES_BLOCKLEN)
+        for (int i = 0; i < AES_BLOCKLEN / 2; i++)
+        {
+            t = buf[b + i];
+            buf[b + i] = buf[b + AES_BLOCKLEN - 1 - i];
+            buf[b + AES_BLOCKLEN - 1 - i] = t;
+        }
+}
+
+/* Run exactly one chunk at psrc through the accelerator and wait for it */
+static int dma_run(u32 len)
+{
+    if (FAILURE == dma_start(len))
+        return FAILURE;
+    return dma_sync();
+}
+
+/* This method computes the AES-CMAC of the file indicating by fdin with the
+ * accelerator and writes the tag, in hex, to the file indicating by fdout.
+ * Only the CBC chaining value is needed, so the ciphertext left in pdest is
+ * never copied or written. The last block is held back on the CPU, tweaked
+ * with the CMAC subkey and sent as the final 16-byte transfer.
+ * axis_aes128 sees every 16-byte block byte-reversed, so blocks are
+ * reversed on the way in and the chaining value on the way out. The
+ * subkeys, the padding and the tag are then in RFC 4493 byte order.
+ * Parameters: fdin, the file descriptor of the infile
+ *             fdout, the file descriptor of the outfile
+ *             key, pointer to the key
+ * Pre-condition: fdin and fdout are opened and are read/writable.
+ * Return: SUCCESS or FAILURE
+ */
+int mac_file(int fdin, int fdout, u32 *key, int forced_buffer_len)
+{
+    u8 zero[AES_BLOCKLEN] = {0};
+    u8 l[AES_BLOCKLEN], k1[AES_BLOCKLEN], k2[AES_BLOCKLEN], tag[AES_BLOCKLEN];
+    u8 *last;
+    char hex[2 * AES_BLOCKLEN + 2];
+    size_t read_len = forced_buffer_len > 0 ? (size_t) forced_buffer_len : (size_t) MAX_SRC_LEN;
+    size_t held = 0, cnt, body;
+    ssize_t n;
+
+    if (read_len > MAX_SRC_LEN)
+        read_len = MAX_SRC_LEN;
+    if (read_len <= AES_BLOCKLEN)
+        read_len = 2 * AES_BLOCKLEN;
+
+    if (FAILURE == aes_set_key(key))
+        return FAILURE;
+
+    /* Subkeys: L = E(K, 0), K1 = dbl(L), K2 = dbl(K1) */
+    if (FAILURE == aes_set_iv(zero))
+        return FAILURE;
+    memset(psrc, 0, AES_BLOCKLEN);
+    if (FAILURE == dma_run(AES_BLOCKLEN))
+        return FAILURE;
+    memcpy(l, pdest, AES_BLOCKLEN);
+    reverse_blocks(l, AES_BLOCKLEN);
+    cmac_dbl(k1, l);
+    cmac_dbl(k2, k1);
+    if (FAILURE == aes_set_iv(zero))
+        return FAILURE;
+
+    /* Keep 1 to 16 bytes back at psrc until EOF says whether they are last */
+    while ((n = read(fdin, psrc + held, read_len - held)) > 0)
+    {
+        cnt = held + (size_t) n;
+        body = (cnt - 1) & ~((size_t) AES_BLOCKLEN - 1);
+        reverse_blocks((u8 *) psrc, body);
+        if (body > 0 && FAILURE == dma_run((u32) body))
+            return FAILURE;
+        held = cnt - body;
+        memmove(psrc, psrc + body, held);
+    }
+
+    /* Tweak the final block: complete blocks take K1, padded ones take K2 */
+    last = (u8 *) psrc;
+    if (held == AES_BLOCKLEN)
+    {
+        for (int i = 0; i < AES_BLOCKLEN; i++)
+            last[i] ^= k1[i];
+    }
+    else
+    {
+        last[held] = 0x80;
+        memset(last + held + 1, 0, AES_BLOCKLEN - held - 1);
+        for (int i = 0; i < AES_BLOCKLEN; i++)
+            last[i] ^= k2[i];
+    }
+    reverse_blocks(last, AES_BLOCKLEN);
+    if (FAILURE == dma_run(AES_BLOCKLEN))
+        return FAILURE;
+
+    memcpy(tag, pdest, AES_BLOCKLEN);
+    reverse_blocks(tag, AES_BLOCKLEN);
+    for (int i = 0; i < AES_BLOCKLEN; i++)
+        snprintf(hex + 2 * i, 3, "%02x", tag[i]);
+    hex[2 * AES_BLOCKLEN] = '\n';
+    hex[2 * AES_BLOCKLEN + 1] = '\0';
+    if (write(fdout, hex, 2 * AES_BLOCKLEN + 1) != 2 * AES_BLOCKLEN + 1)
+    {
+        perror("outfile");
+        return FAILURE;
+    }
+
+    dma_clean_up();
+    return SUCCESS;
+}
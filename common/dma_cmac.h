@@ -0,0 +1,23 @@
+/**
+ *  dma_cmac.h - AES-CMAC (RFC 4493) of a file on the accelerator.
+ *
+ *  The blocks are chained through the hardware CBC; only the subkeys and
+ *  the tweak of the last block are computed on the CPU.
+ *
+ *  Author: Hsiang-Ju Lai <happyx94@gmail.com>
+ */
+#ifndef _DMA_CMAC_H
+#define _DMA_CMAC_H
+
+#include "dma_driver.h"
+
+/**
+ *  Compute the AES-CMAC of everything read from fdin and write the tag to
+ *  fdout as 32 hex digits and a newline. Chunks are at most
+ *  forced_buffer_len bytes when it is positive, MAX_SRC_LEN otherwise.
+ *
+ *  Return: SUCCESS or FAILURE
+ */
+extern int mac_file(int fdin, int fdout, u32 *key, int forced_buffer_len);
+
+#endif
@@ -12,16 +12,26 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <pthread.h>
+#include <dirent.h>
 
 #include "dma_driver.h"
+#include "dma_metrics.h"
+#include "dma_probe.h"
+#include "dma_regtrace.h"
+#include "rsvmem_ioctl.h"
 
 /* AES-related macros */
-#define AES_KEY_ADDR            0x43C10000
+#define AES_KEY_ADDR            0x43C10000  /* default device */
 #define AES_KEY_REGS_MAP_LEN    4096
 
 /* DMA-related macros */
-#define DMA_BASE_ADDR       0x40400000
+#define DMA_BASE_ADDR       0x40400000      /* default device */
 #define DMA_MMAP_LEN        4096
+#define DMA_DT_DIR          "/proc/device-tree/amba_pl"
 
 #define MM2S_CNTL_REG       0x00
 #define MM2S_STATUS_REG     0x04
@@ -37,26 +47,88 @@
 #define DMA_RESET           4
 
 /* Macro functions */
-#define set_dma_reg(offset,value) ((u32 *)pdma)[(offset)>>2] = value
+#define set_dma_reg(offset,value) \
+    do { ((u32 *)pdma)[(offset)>>2] = value; regtrace_log(REGTRACE_DMA_WRITE, cur_id, offset, value); } while (0)
 #define dma_reg(offset) (((u32 *)pdma)[(offset)>>2])
 
 #define dma_s2mm_status() (dma_status(S2MM_STATUS_REG))
 #define dma_mm2s_status() (dma_status(MM2S_STATUS_REG))
 
-#define dma_s2mm_poll() ((dma_reg(S2MM_STATUS_REG) & (1<<1 | 1<<12)) == (1<<1 | 1<<12) ? SUCCESS : FAILURE)
-#define dma_mm2s_poll() ((dma_reg(MM2S_STATUS_REG) & (1<<1 | 1<<12)) == (1<<1 | 1<<12) ? SUCCESS : FAILURE)
+#define dma_s2mm_poll() ((dma_poll_reg(S2MM_STATUS_REG) & (1<<1 | 1<<12)) == (1<<1 | 1<<12) ? SUCCESS : FAILURE)
+#define dma_mm2s_poll() ((dma_poll_reg(MM2S_STATUS_REG) & (1<<1 | 1<<12)) == (1<<1 | 1<<12) ? SUCCESS : FAILURE)
 
-#define DMA_SOURCE_ADDR       buf_phy_addr
-#define DMA_DESTINATION_ADDR  (buf_phy_addr + RSV_BUF_LEN / 2)
+#define DMA_SOURCE_ADDR       dma_phys_addr(psrc)
+#define DMA_DESTINATION_ADDR  dma_phys_addr(pdest)
+
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
+/* Cross-process arbitration */
+#define DMA_ARB_SHM_NAME    "/aes128_arb"
+#define DMA_ARB_MAGIC       0x41524232
+#define DMA_ARB_INIT_WAIT   100000  /* us to wait for another process to set up the segment */
 
 #define REVERSE_32(n) ((((n)>>24)&0xff) | (((n)<<8)&0xff0000) | (((n)>>8)&0xff00) | (((n)<<24)&0xff000000))
 
 void *pbuf;
+u32 rsv_buf_len = RSV_BUF_DEFAULT_LEN;
+u32 dma_buf_request;
+int dma_private_buffer;
 int mem_fd;
 int polling_interval;
-static void *pdma;
+int dma_ndevices;
 static u32 buf_phy_addr;
 
+/* One DMA/AES pair and this process's state for it */
+struct aes_dev
+{
+    u32 dma_base, aes_base;     /* physical register blocks */
+    void *dma_regs;
+    u32 *aes_regs;              /* AES control page, mapped once by dma_init() */
+    u32 hw_key[4];              /* shadow of the write-only key registers */
+    int hw_key_valid;
+    char *win;                  /* transfer window inside pbuf */
+    u32 win_len;
+
+    /* This process's view of the AES state, restored after another owner */
+    int arb_depth;              /* nesting of dma_arb_acquire() */
+    u32 saved_key[4], saved_chain[4];
+    int key_saved, chain_saved;
+    const char *last_dest;      /* the chain is the last block written here */
+    u32 last_len;
+};
+static struct aes_dev devs[DMA_MAX_DEVICES];
+static __thread struct aes_dev *cur = &devs[0];
+#define pdma (cur->dma_regs)
+#define cur_id ((int) (cur - devs))
+
+/* Ownership records shared by every process using the accelerators */
+struct dma_arb
+{
+    volatile u32 magic;             /* set once the locks are initialized */
+    struct
+    {
+        pthread_mutex_t lock;       /* robust and process-shared */
+        volatile pid_t owner;       /* holder, 0 when free */
+        volatile pid_t last_owner;  /* whose key/chain is in the hardware */
+        volatile u32 handoffs;
+        volatile u32 recoveries;
+    } dev[DMA_MAX_DEVICES];
+};
+static struct dma_arb *parb;
+static int arb_whole_session;   /* shared buffer: held from dma_init to dma_clean_up */
+
+/* A status read made while waiting for a transfer */
+static inline u32 dma_poll_reg(u32 offset)
+{
+    u32 status = dma_reg(offset);
+
+    regtrace_log(REGTRACE_DMA_POLL, cur_id, offset, status);
+    return status;
+}
+
+static int aes_write_key(const u32 *key);
+static int aes_write_iv(const u32 *iv);
+
 char* dma_status(u8 offset) 
 {
     int count;
@@ -104,13 +176,15 @@ int dma_quick_poll()
     return FAILURE;
 }
 
-static int dma_s2mm_sync()
+static int dma_s2mm_sync(u32 *total_polls)
 {
     int count = 0;
+    u32 polls = 1;
 
     fprintf(stderr, "[INFO] Waiting for s2mm to finish tranfering...\n");
     while(FAILURE == dma_s2mm_poll())
     {
+        polls++;
         if (polling_interval > 0)
         {
             usleep((__useconds_t) polling_interval);
@@ -118,16 +192,20 @@ static int dma_s2mm_sync()
                 break;
         }
     }
+    metric_add(cur_id, polls, polls);
+    *total_polls += polls;
     return (count < 2001 ? SUCCESS : FAILURE); 
 }
 
-static int dma_mm2s_sync()
+static int dma_mm2s_sync(u32 *total_polls)
 {
     int count = 0;
+    u32 polls = 1;
 
     fprintf(stderr, "[INFO] Waiting for mm2s to finish tranfering...\n");
     while(FAILURE == dma_mm2s_poll())
     {
+        polls++;
         if (polling_interval > 0)
         {
             usleep((__useconds_t) polling_interval);
@@ -135,20 +213,75 @@ static int dma_mm2s_sync()
                 break;
         }
     }
+    metric_add(cur_id, polls, polls);
+    *total_polls += polls;
     return (count < 2001 ? SUCCESS : FAILURE); 
 }
 
 int dma_sync()
 {
-    if (FAILURE == dma_mm2s_sync())
-        return FAILURE;
-    return dma_s2mm_sync();
+    uint64_t start = dma_metrics_now(), waited;
+    u32 mm2s, s2mm, polls = 0;
+    int ret;
+
+    regtrace_log(REGTRACE_SYNC_BEGIN, cur_id, 0, polling_interval);
+    ret = dma_mm2s_sync(&polls);
+
+    if (SUCCESS == ret)
+        ret = dma_s2mm_sync(&polls);
+
+    waited = dma_metrics_now() - start;
+    metric_add(cur_id, wait_ns, waited);
+    dma_probe4(dma_sync, cur_id, ret, polls, waited);
+    regtrace_log(REGTRACE_SYNC_END, cur_id, FAILURE == ret, polls);
+    mm2s = dma_reg(MM2S_STATUS_REG);
+    s2mm = dma_reg(S2MM_STATUS_REG);
+    if (FAILURE == ret || ((mm2s | s2mm) & DMA_ERR_BITS))
+    {
+        if (FAILURE == ret)
+            metric_add(cur_id, timeouts, 1);
+        else
+            metric_add(cur_id, errors, 1);
+        __atomic_store_n(&pmetrics->dev[cur_id].last_mm2s_status, mm2s, __ATOMIC_RELAXED);
+        __atomic_store_n(&pmetrics->dev[cur_id].last_s2mm_status, s2mm, __ATOMIC_RELAXED);
+    }
+    dma_arb_release();
+    return ret;
 }
 
 void dma_clean_up()
 {
-    if(NULL != pdma)  munmap(pdma, DMA_MMAP_LEN);
+    struct aes_dev *self = cur;
+
+    for (int i = 0; i < dma_ndevices; i++)
+    {
+        cur = &devs[i];
+        if (NULL != parb && cur->arb_depth > 0)
+        {
+            cur->arb_depth = 1;
+            dma_arb_release();
+        }
+        if (NULL != cur->dma_regs)
+            munmap(cur->dma_regs, DMA_MMAP_LEN);
+        if (NULL != cur->aes_regs)
+            munmap(cur->aes_regs, AES_KEY_REGS_MAP_LEN);
+        cur->dma_regs = NULL;
+        cur->aes_regs = NULL;
+        cur->hw_key_valid = 0;
+        cur->win = NULL;
+        cur->win_len = 0;
+    }
+    cur = self;
+    dma_metrics_close();
+    dma_regtrace_close();
+    if (NULL != parb)
+    {
+        munmap(parb, sizeof(struct dma_arb));
+        parb = NULL;
+    }
+    arb_whole_session = 0;
     if(NULL != pbuf)  munmap(pbuf, RSV_BUF_LEN);
+    pbuf = NULL;
     buf_phy_addr = 0;
     close(mem_fd);
     mem_fd = -1;
@@ -164,6 +297,7 @@ int dma_reset()
     }
 
     fprintf(stderr, "[INFO] Resetting the DMA...\n");
+    metric_add(cur_id, resets, 1);
     set_dma_reg(S2MM_CNTL_REG, DMA_RESET);
     set_dma_reg(MM2S_CNTL_REG, DMA_RESET);
 
@@ -171,14 +305,26 @@ int dma_reset()
     return SUCCESS;
 }
 
-int dma_start(u32 len)
+int dma_start_addr(u32 src_addr, u32 dest_addr, u32 len)
 {
-    if (len > RSV_BUF_LEN / 2)
+    if (len > MAX_SRC_LEN)
     {
-        fprintf(stderr, "[ERROR] Failed to start transfer. The maximum size is %dKB\n", RSV_BUF_LEN / 2048);
+        fprintf(stderr, "[ERROR] Failed to start transfer. The maximum size is %dKB\n", MAX_SRC_LEN / 1024);
         return FAILURE;
     }
 
+    /* Held until dma_sync() */
+    if (FAILURE == dma_arb_acquire())
+        return FAILURE;
+    if (len >= 16)
+    {
+        cur->last_dest = (char *) pbuf + (dest_addr - buf_phy_addr);
+        cur->last_len = len;
+    }
+    metric_add(cur_id, transfers, 1);
+    metric_add(cur_id, bytes, len);
+    dma_probe4(dma_start, cur_id, src_addr, dest_addr, len);
+
     fprintf(stderr, "[INFO] Halting the DMA...\n");
     set_dma_reg(S2MM_CNTL_REG, DMA_HALT);
     set_dma_reg(MM2S_CNTL_REG, DMA_HALT);
@@ -186,8 +332,8 @@ int dma_start(u32 len)
     fprintf(stderr,"[DEBUG] MM2S Cntl Reg Status: %s\n", dma_mm2s_status());
 
     fprintf(stderr,"[INFO] Setting DMA transfer address...\n");
-    set_dma_reg(S2MM_DEST_ADDR_REG, DMA_DESTINATION_ADDR); // Write destination address
-    set_dma_reg(MM2S_SRC_ADDR_REG, DMA_SOURCE_ADDR);
+    set_dma_reg(S2MM_DEST_ADDR_REG, dest_addr); // Write destination address
+    set_dma_reg(MM2S_SRC_ADDR_REG, src_addr);
 
     fprintf(stderr,"[INFO] Starting the DMA channels...\n");	
     set_dma_reg(S2MM_CNTL_REG, 0xf001);
@@ -203,9 +349,359 @@ int dma_start(u32 len)
     return SUCCESS;
 }
 
+u32 dma_phys_addr(const void *ptr)
+{
+    const char *p = ptr;
+
+    if (NULL == pbuf || p < (char *) pbuf || p >= (char *) pbuf + RSV_BUF_LEN)
+        return 0;
+    return buf_phy_addr + (u32) (p - (char *) pbuf);
+}
+
+int dma_start(u32 len)
+{
+    return dma_start_addr(DMA_SOURCE_ADDR, DMA_DESTINATION_ADDR, len);
+}
+
+int dma_transfer(const void *src, void *dst, size_t len)
+{
+    const char *in = src;
+    char *out = dst;
+    /* Each half of the buffer is split into two slots to ping-pong between */
+    u32 slot = (MAX_SRC_LEN / 2) & ~15U;
+    size_t copied_in, copied_out = 0;
+    u32 cur_len, next_len;
+    int half = 0;
+
+    if (0 == len)
+        return SUCCESS;
+    if (NULL == pdma || slot < 16 || len % 16 != 0)
+    {
+        fprintf(stderr, "[ERROR] Invalid transfer of %lu bytes\n", (unsigned long) len);
+        return FAILURE;
+    }
+
+    cur_len = (u32) MIN(slot, len);
+    memcpy(psrc, in, cur_len);
+    copied_in = cur_len;
+    if (FAILURE == dma_start_addr(DMA_SOURCE_ADDR, DMA_DESTINATION_ADDR, cur_len))
+        return FAILURE;
+
+    for (;;)
+    {
+        /* Stage the next piece while the current one is in flight */
+        next_len = (u32) MIN(slot, len - copied_in);
+        if (next_len > 0)
+            memcpy(psrc + (half ^ 1) * slot, in + copied_in, next_len);
+
+        if (FAILURE == dma_sync())
+            return FAILURE;
+
+        if (next_len > 0 && FAILURE == dma_start_addr(DMA_SOURCE_ADDR + (half ^ 1) * slot,
+                                                      DMA_DESTINATION_ADDR + (half ^ 1) * slot, next_len))
+            return FAILURE;
+
+        /* Drain the finished piece while the next one is in flight */
+        memcpy(out + copied_out, pdest + half * slot, cur_len);
+        copied_out += cur_len;
+
+        if (0 == next_len)
+            break;
+        copied_in += next_len;
+        cur_len = next_len;
+        half ^= 1;
+    }
+
+    return SUCCESS;
+}
+
+/* -------------------- Arbitration -------------------- */
+
+static int dma_arb_open()
+{
+    pthread_mutexattr_t attr;
+    struct stat st;
+    int fd, creator = 1, waited = 0;
+
+    fd = shm_open(DMA_ARB_SHM_NAME, O_RDWR | O_CREAT | O_EXCL, 0666);
+    if (fd < 0 && EEXIST == errno)
+    {
+        creator = 0;
+        fd = shm_open(DMA_ARB_SHM_NAME, O_RDWR, 0);
+    }
+    if (fd < 0)
+    {
+        perror("Failed to open the arbitration segment");
+        return FAILURE;
+    }
+    if (creator && ftruncate(fd, sizeof(struct dma_arb)) < 0)
+    {
+        perror("ftruncate");
+        close(fd);
+        shm_unlink(DMA_ARB_SHM_NAME);
+        return FAILURE;
+    }
+    /* The creator may not have sized it yet */
+    while (!creator && 0 == fstat(fd, &st) && st.st_size < (off_t) sizeof(struct dma_arb))
+    {
+        if ((waited += 100) >= DMA_ARB_INIT_WAIT)
+        {
+            fprintf(stderr, "[ERROR] %s is too small. Remove /dev/shm%s if no aes128 is running.\n",
+                    DMA_ARB_SHM_NAME, DMA_ARB_SHM_NAME);
+            close(fd);
+            return FAILURE;
+        }
+        usleep(100);
+    }
+
+    parb = mmap(NULL, sizeof(struct dma_arb), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == parb)
+    {
+        perror("Failed to mmap the arbitration segment");
+        parb = NULL;
+        return FAILURE;
+    }
+
+    if (creator)
+    {
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        for (int i = 0; i < DMA_MAX_DEVICES; i++)
+            pthread_mutex_init(&parb->dev[i].lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+        __atomic_store_n(&parb->magic, DMA_ARB_MAGIC, __ATOMIC_RELEASE);
+        return SUCCESS;
+    }
+
+    for (waited = 0; __atomic_load_n(&parb->magic, __ATOMIC_ACQUIRE) != DMA_ARB_MAGIC; waited += 100)
+    {
+        if (waited >= DMA_ARB_INIT_WAIT)
+        {
+            fprintf(stderr, "[ERROR] %s was never initialized. Remove /dev/shm%s if no aes128 is running.\n",
+                    DMA_ARB_SHM_NAME, DMA_ARB_SHM_NAME);
+            munmap(parb, sizeof(struct dma_arb));
+            parb = NULL;
+            return FAILURE;
+        }
+        usleep(100);
+    }
+    return SUCCESS;
+}
+
+int dma_arb_acquire()
+{
+    int rc, id = (int) (cur - devs);
+
+    if (NULL == parb || cur->arb_depth++ > 0)
+        return SUCCESS;
+
+    rc = pthread_mutex_trylock(&parb->dev[id].lock);
+    if (EBUSY == rc)
+    {
+        uint64_t start = dma_metrics_now();
+
+        fprintf(stderr, "[INFO] Waiting for process %d to release accelerator %d...\n", (int) parb->dev[id].owner, id);
+        rc = pthread_mutex_lock(&parb->dev[id].lock);
+        metric_add(id, arb_waits, 1);
+        metric_add(id, arb_wait_ns, dma_metrics_now() - start);
+    }
+    if (EOWNERDEAD == rc)
+    {
+        /* The holder died: whatever it left in the hardware is unknown */
+        fprintf(stderr, "[INFO] Process %d died holding accelerator %d. Recovering the lock.\n", (int) parb->dev[id].owner, id);
+        pthread_mutex_consistent(&parb->dev[id].lock);
+        parb->dev[id].recoveries++;
+        parb->dev[id].last_owner = 0;
+        if (NULL != pdma)
+            dma_reset();
+    }
+    else if (0 != rc)
+    {
+        fprintf(stderr, "[ERROR] Failed to lock accelerator %d: %s\n", id, strerror(rc));
+        cur->arb_depth--;
+        return FAILURE;
+    }
+    parb->dev[id].owner = getpid();
+
+    /* Someone else ran in between: put our key and chaining value back */
+    if (parb->dev[id].last_owner != getpid())
+    {
+        if (0 != parb->dev[id].last_owner)
+            parb->dev[id].handoffs++;
+        cur->hw_key_valid = 0;
+        if ((cur->key_saved && FAILURE == aes_write_key(cur->saved_key))
+            || (cur->chain_saved && FAILURE == aes_write_iv(cur->saved_chain)))
+        {
+            dma_arb_release();
+            return FAILURE;
+        }
+        parb->dev[id].last_owner = getpid();
+    }
+    return SUCCESS;
+}
+
+void dma_arb_release()
+{
+    int id = (int) (cur - devs);
+
+    if (NULL == parb || cur->arb_depth <= 0 || --cur->arb_depth > 0)
+        return;
+
+    /* The hardware chains from the last ciphertext block it wrote */
+    if (NULL != cur->last_dest)
+    {
+        memcpy(cur->saved_chain, cur->last_dest + cur->last_len - 16, 16);
+        cur->chain_saved = 1;
+        cur->last_dest = NULL;
+    }
+    parb->dev[id].owner = 0;
+    pthread_mutex_unlock(&parb->dev[id].lock);
+}
+
+/* -------------------- Devices -------------------- */
+
+static int add_device(u32 dma_base, u32 aes_base)
+{
+    if (dma_ndevices >= DMA_MAX_DEVICES)
+    {
+        fprintf(stderr, "[ERROR] At most %d devices are supported\n", DMA_MAX_DEVICES);
+        return FAILURE;
+    }
+    devs[dma_ndevices].dma_base = dma_base;
+    devs[dma_ndevices].aes_base = aes_base;
+    fprintf(stderr, "[INFO] Device %d: DMA at %08x, AES at %08x\n", dma_ndevices, dma_base, aes_base);
+    dma_ndevices++;
+    return SUCCESS;
+}
+
+/* Lines of "device <dma_base> <aes_base>"; '#' starts a comment */
+static int read_device_conf(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    char line[256], word[32];
+    unsigned long dma_base, aes_base;
+    int n = 0;
+
+    if (NULL == fp)
+        return 0;
+    while (fgets(line, sizeof(line), fp))
+    {
+        char *hash = strchr(line, '#');
+
+        if (hash)
+            *hash = '\0';
+        if (sscanf(line, "%31s %li %li", word, (long *) &dma_base, (long *) &aes_base) != 3 || strcmp(word, "device"))
+            continue;
+        if (FAILURE == add_device((u32) dma_base, (u32) aes_base))
+            break;
+        n++;
+    }
+    fclose(fp);
+    return n;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    u32 x = *(const u32 *) a, y = *(const u32 *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* PL nodes are named after their base address, e.g. dma@40400000 and
+ * axis_aes128@43c10000. The n-th DMA is paired with the n-th AES core. */
+static int read_device_tree()
+{
+    DIR *dir = opendir(DMA_DT_DIR);
+    struct dirent *ent;
+    u32 dma[DMA_MAX_DEVICES], aes[DMA_MAX_DEVICES];
+    int ndma = 0, naes = 0;
+
+    if (NULL == dir)
+        return 0;
+    while (NULL != (ent = readdir(dir)))
+    {
+        char *at = strchr(ent->d_name, '@');
+
+        if (NULL == at)
+            continue;
+        if (0 == strncmp(ent->d_name, "dma@", 4) && ndma < DMA_MAX_DEVICES)
+            dma[ndma++] = (u32) strtoul(at + 1, NULL, 16);
+        else if (strstr(ent->d_name, "aes") && naes < DMA_MAX_DEVICES)
+            aes[naes++] = (u32) strtoul(at + 1, NULL, 16);
+    }
+    closedir(dir);
+
+    if (0 == ndma || ndma != naes)
+        return 0;
+    qsort(dma, (size_t) ndma, sizeof(u32), cmp_u32);
+    qsort(aes, (size_t) naes, sizeof(u32), cmp_u32);
+    for (int i = 0; i < ndma; i++)
+        add_device(dma[i], aes[i]);
+    return ndma;
+}
+
+static void find_devices()
+{
+    const char *conf = getenv("AES128_CONF");
+
+    dma_ndevices = 0;
+    if (read_device_conf(conf ? conf : DMA_CONF_PATH) > 0 || read_device_tree() > 0)
+        return;
+    add_device(DMA_BASE_ADDR, AES_KEY_ADDR);
+}
+
+int dma_select(int dev)
+{
+    if (dev < 0 || dev >= (dma_ndevices > 0 ? dma_ndevices : 1))
+        return FAILURE;
+    cur = &devs[dev];
+    return SUCCESS;
+}
+
+int dma_current()
+{
+    return (int) (cur - devs);
+}
+
+int dma_set_window(int dev, void *base, u32 len)
+{
+    char *p = base;
+
+    if (dev >= 0 && dev < dma_ndevices && NULL == base)
+    {
+        devs[dev].win = NULL;
+        devs[dev].win_len = 0;
+        return SUCCESS;
+    }
+    if (dev < 0 || dev >= dma_ndevices || NULL == pbuf || len < 32 || len % 32 != 0
+        || p < (char *) pbuf || p + len > (char *) pbuf + RSV_BUF_LEN)
+    {
+        fprintf(stderr, "[ERROR] Invalid window for device %d\n", dev);
+        return FAILURE;
+    }
+    devs[dev].win = p;
+    devs[dev].win_len = len;
+    return SUCCESS;
+}
+
+void *dma_window()
+{
+    return cur->win ? cur->win : pbuf;
+}
+
+u32 dma_window_len()
+{
+    return cur->win ? cur->win_len : RSV_BUF_LEN;
+}
+
 int dma_init()
 {
     int rsv_fd;
+    unsigned long rsv_info[2];
+    ssize_t rsv_len;
+    struct rsvmem_alloc req;
 
     polling_interval = 0;
     fprintf(stderr,"[INFO] Set the polling interval to 0 us (busy waiting).\n");
@@ -221,7 +717,9 @@ int dma_init()
     }
  
     fprintf(stderr,"[INFO] Getting the physical buffer address from /dev/rsvmem...\n");
-    rsv_fd = open("/dev/rsvmem", O_RDONLY);
+    rsv_fd = open("/dev/rsvmem", O_RDWR);
+    if (rsv_fd == -1)
+        rsv_fd = open("/dev/rsvmem", O_RDONLY);
     if (rsv_fd == -1)
     {
         perror("Failed to open /dev/rsvmem");
@@ -229,99 +727,263 @@ int dma_init()
         return FAILURE;
     }
 
-    if (read(rsv_fd, (void *)&buf_phy_addr, sizeof(u32)) <= 0)
+    /* Prefer a private buffer for this process, mapped through rsvmem itself */
+    req.size = dma_buf_request > 0 ? dma_buf_request : RSV_BUF_DEFAULT_LEN;
+    req.phys = 0;
+    if (0 == ioctl(rsv_fd, RSVMEM_IOC_ALLOC, &req))
     {
-        perror("Failed to read from /dev/rsvmem.\n");
-        return FAILURE;
+        buf_phy_addr = (u32) req.phys;
+        rsv_buf_len = (u32) req.size;
+        pbuf = mmap(NULL, RSV_BUF_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, rsv_fd, 0);
+        if (MAP_FAILED == pbuf)
+        {
+            perror("Failed to mmap the private rsvmem buffer");
+            pbuf = NULL;
+            close(mem_fd);
+            close(rsv_fd);
+            return FAILURE;
+        }
+        dma_private_buffer = 1;
+        fprintf(stderr,"[DEBUG] Private DMA buffer at %08x (%u KB)\n", buf_phy_addr, rsv_buf_len / 1024);
     }
-    fprintf(stderr,"[DEBUG] The physical buffer address is at %08x\n", buf_phy_addr);
-
-    pbuf = mmap(NULL, RSV_BUF_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, (off_t)buf_phy_addr); 
-    if (NULL == pbuf)
+    else
     {
-        perror("Failed to mmap the rsvmem buffer");        
-        if (mem_fd >= 0) close(mem_fd);
-        if (rsv_fd >= 0) close(rsv_fd);
-        
-        return FAILURE;
+        /* Older rsvmem: one shared pool, mapped through /dev/mem */
+        dma_private_buffer = 0;
+
+        /* rsvmem returns the physical address, followed by the size if it is new enough */
+        rsv_len = read(rsv_fd, (void *)rsv_info, sizeof(rsv_info));
+        if (rsv_len < (ssize_t) sizeof(unsigned long))
+        {
+            perror("Failed to read from /dev/rsvmem.\n");
+            return FAILURE;
+        }
+        buf_phy_addr = (u32) rsv_info[0];
+        rsv_buf_len = rsv_len >= (ssize_t) sizeof(rsv_info) ? (u32) rsv_info[1] : RSV_BUF_DEFAULT_LEN;
+        fprintf(stderr,"[DEBUG] The physical buffer address is at %08x (%u KB)\n", buf_phy_addr, rsv_buf_len / 1024);
+
+        pbuf = mmap(NULL, RSV_BUF_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, (off_t)buf_phy_addr); 
+        if (MAP_FAILED == pbuf)
+        {
+            perror("Failed to mmap the rsvmem buffer");        
+            pbuf = NULL;
+            if (mem_fd >= 0) close(mem_fd);
+            if (rsv_fd >= 0) close(rsv_fd);
+            
+            return FAILURE;
+        }
     }
 
-    /* mmap DMA AXI Lite Register Block */
-    pdma = mmap(NULL, DMA_MMAP_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, DMA_BASE_ADDR); 
-    if (NULL == pdma)
+    /* mmap the AXI Lite register blocks of every DMA and AES core */
+    find_devices();
+    for (int i = 0; i < dma_ndevices; i++)
     {
-        dma_clean_up();
-        perror("Failed to mmap DMA registers");        
-        if (mem_fd >= 0) close(mem_fd);
-        if (rsv_fd >= 0) close(rsv_fd);
-        
-        return FAILURE;
+        devs[i].dma_regs = mmap(NULL, DMA_MMAP_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, devs[i].dma_base);
+        devs[i].aes_regs = mmap(NULL, AES_KEY_REGS_MAP_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, devs[i].aes_base);
+        devs[i].hw_key_valid = 0;
+        if (MAP_FAILED == devs[i].dma_regs || MAP_FAILED == devs[i].aes_regs)
+        {
+            if (MAP_FAILED == devs[i].dma_regs)
+                devs[i].dma_regs = NULL;
+            if (MAP_FAILED == devs[i].aes_regs)
+                devs[i].aes_regs = NULL;
+            perror("Failed to mmap the DMA/AES registers");
+            close(rsv_fd);
+            dma_clean_up();
+            return FAILURE;
+        }
     }
     close(rsv_fd);
-    return dma_reset();
+
+    if (FAILURE == dma_metrics_open(dma_ndevices))
+        fprintf(stderr, "[INFO] Running without published metrics.\n");
+    if (FAILURE == dma_regtrace_open(dma_ndevices))
+        fprintf(stderr, "[INFO] Running without the register trace.\n");
+    if (FAILURE == dma_arb_open())
+        fprintf(stderr, "[INFO] Running without cross-process arbitration.\n");
+    else if (!dma_private_buffer)
+    {
+        /* Everyone shares the same pool, so one process at a time */
+        fprintf(stderr, "[INFO] The DMA buffer is shared. Holding the accelerator until exit.\n");
+        arb_whole_session = 1;
+    }
+
+    /* Devices are locked in order, so whole-session holders can't deadlock */
+    for (int i = 0; i < dma_ndevices; i++)
+    {
+        struct aes_dev *self = cur;
+
+        cur = &devs[i];
+        if (FAILURE == dma_arb_acquire() || FAILURE == dma_reset())
+        {
+            cur = self;
+            return FAILURE;
+        }
+        if (!arb_whole_session)
+            dma_arb_release();
+        cur = self;
+    }
+    return SUCCESS;
 }
 
-int aes_set_key(void *pkey)
+/* The key registers are only ever written: this process remembers what it
+ * put there, so an unchanged key costs nothing */
+static int aes_write_key(const u32 *key)
 {
-    u32 *pregs;
-    u32 *key = pkey;
+    u32 *pregs = cur->aes_regs;
 
-    if (mem_fd < 0)
-        return FAILURE;
-
-    pregs = mmap(NULL, AES_KEY_REGS_MAP_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, AES_KEY_ADDR);
     if (NULL == pregs)
-    {
-        perror("Failed to mmap the AES key registers");
         return FAILURE;
-    }
+    if (cur->hw_key_valid && 0 == memcmp(cur->hw_key, key, sizeof(cur->hw_key)))
+        return SUCCESS;
 
     for (int i = 0; i < 4; i++)
     {
         pregs[3-i] = REVERSE_32(key[i]);
+        regtrace_log(REGTRACE_AES_WRITE, cur_id, (3-i) * 4, 0);
     }
-    fprintf(stderr,"[INFO] AES key has be set.\n");
-    munmap(pregs, AES_KEY_REGS_MAP_LEN);
+    memcpy(cur->hw_key, key, sizeof(cur->hw_key));
+    cur->hw_key_valid = 1;
+    metric_add(cur_id, key_loads, 1);
 
     return SUCCESS;
 }
 
-int aes_set_iv(void *piv)
+/* The IV goes in through the key registers, so the key is written back
+ * from the shadow afterwards */
+static int aes_write_iv(const u32 *iv)
 {
-    u32 *pregs;
-    u32 *iv = piv;
+    u32 *pregs = cur->aes_regs;
     u32 temp[4];
 
-    if (mem_fd < 0)
+    if (NULL == pregs)
         return FAILURE;
 
-    pregs = mmap(NULL, AES_KEY_REGS_MAP_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, AES_KEY_ADDR);
-    if (NULL == pregs)
+    /* Nothing set by us yet: keep whatever the hardware holds */
+    if (!cur->hw_key_valid)
     {
-        perror("Failed to mmap the AES control registers");
-        return FAILURE;
+        for (int i = 0; i < 4; i++)
+            temp[i] = REVERSE_32(pregs[3-i]);
     }
-
+    else
+        memcpy(temp, cur->hw_key, sizeof(temp));
 
     for (int i = 0; i < 4; i++)
     {
-        temp[3-i] = pregs[3-i];
         pregs[3-i] = REVERSE_32(iv[i]);
+        regtrace_log(REGTRACE_AES_WRITE, cur_id, (3-i) * 4, 0);
     }
     /* Set the set_IV flag */
     pregs[4] = 0xFFFFFFFF;
-    fprintf(stderr,"[INFO] Setting the IV... \n");
     pregs[4] = 0;
+    regtrace_log(REGTRACE_AES_WRITE, cur_id, 16, 0xFFFFFFFF);
+    regtrace_log(REGTRACE_AES_WRITE, cur_id, 16, 0);
+    metric_add(cur_id, iv_loads, 1);
 
-    for (int i = 0; i < 4; i++)
-        pregs[i] = temp[i];
+    cur->hw_key_valid = 0;
+    return aes_write_key(temp);
+}
+
+int aes_set_key(void *pkey)
+{
+    int ret;
+
+    memcpy(cur->saved_key, pkey, sizeof(cur->saved_key));
+    cur->key_saved = 1;
+    if (FAILURE == dma_arb_acquire())
+        return FAILURE;
+    ret = aes_write_key(cur->saved_key);
+    dma_arb_release();
+    dma_probe2(aes_set_key, cur_id, ret);
+    return ret;
+}
+
+int aes_set_iv(void *piv)
+{
+    int ret;
 
-    fprintf(stderr,"[INFO] AES IV has be set.\n");
-    munmap(pregs, AES_KEY_REGS_MAP_LEN);
+    /* A new IV replaces whatever chain the last transfer left */
+    memcpy(cur->saved_chain, piv, sizeof(cur->saved_chain));
+    cur->chain_saved = 1;
+    cur->last_dest = NULL;
+    if (FAILURE == dma_arb_acquire())
+        return FAILURE;
+    ret = aes_write_iv(cur->saved_chain);
+    dma_arb_release();
+    dma_probe2(aes_set_iv, cur_id, ret);
+    return ret;
+}
 
+/* Switch to the job's key and IV. The DMA must be idle. */
+static int job_switch(const struct aes_job *job)
+{
+    if (job->key && FAILURE == aes_set_key((void *) job->key))
+        return FAILURE;
+    if (job->iv && FAILURE == aes_set_iv((void *) job->iv))
+        return FAILURE;
     return SUCCESS;
 }
 
+int aes_run_batch(const struct aes_job *jobs, int njobs)
+{
+    u32 pos, prev_pos = 0;
+    int i = 0, first, ret = SUCCESS;
+
+    for (int k = 0; k < njobs; k++)
+        if (jobs[k].len % 16 != 0)
+        {
+            fprintf(stderr, "[ERROR] Job %d: %u bytes is not a multiple of 16\n", k, jobs[k].len);
+            return FAILURE;
+        }
+    if (NULL == pdma || FAILURE == dma_arb_acquire())
+        return FAILURE;
+
+    while (i < njobs && SUCCESS == ret)
+    {
+        /* Too big to stage whole: it gets the buffer to itself */
+        if (jobs[i].len > MAX_SRC_LEN)
+        {
+            if (FAILURE == job_switch(&jobs[i]) || FAILURE == dma_transfer(jobs[i].src, jobs[i].dst, jobs[i].len))
+                ret = FAILURE;
+            i++;
+            continue;
+        }
+
+        /* Stage every job that fits, then run them back to back, copying
+         * each result out while the next job is in flight */
+        for (first = i, pos = 0; i < njobs && jobs[i].len <= MAX_SRC_LEN - pos; i++)
+        {
+            memcpy(psrc + pos, jobs[i].src, jobs[i].len);
+            pos += jobs[i].len;
+        }
+        pos = 0;
+        for (int k = first; k < i; k++)
+        {
+            if (FAILURE == job_switch(&jobs[k])
+                || (jobs[k].len > 0
+                    && FAILURE == dma_start_addr(dma_phys_addr(psrc + pos), dma_phys_addr(pdest + pos), jobs[k].len)))
+            {
+                ret = FAILURE;
+                break;
+            }
+            if (k > first)
+                memcpy(jobs[k - 1].dst, pdest + prev_pos, jobs[k - 1].len);
+            if (jobs[k].len > 0 && FAILURE == dma_sync())
+            {
+                ret = FAILURE;
+                break;
+            }
+            prev_pos = pos;
+            pos += jobs[k].len;
+        }
+        if (SUCCESS == ret)
+            memcpy(jobs[i - 1].dst, pdest + prev_pos, jobs[i - 1].len);
+    }
+
+    dma_arb_release();
+    return ret;
+}
+
 void memdump(void* buf_ptr, int byte_count) 
 {
     char *p = buf_ptr;
@@ -6,6 +6,7 @@
 #ifndef _DMA_DRIVER_H 
 #define _DMA_DRIVER_H
 
+#include <stddef.h>
 
 #ifndef u32
   #define u32 unsigned int
@@ -18,12 +19,34 @@
 #define SUCCESS 0
 #define FAILURE (-1)
 
-#define RSV_BUF_LEN         (1024 * 1024)
-#define MAX_SRC_LEN         (RSV_BUF_LEN / 2)
-#define MAX_DEST_LEN        (RSV_BUF_LEN / 2)
-#define psrc		            ((char *)pbuf)
-#define pdest               (((char *)pbuf)+RSV_BUF_LEN/2)
+/* Size assumed when rsvmem doesn't report its own (older modules) */
+#define RSV_BUF_DEFAULT_LEN (1024 * 1024)
+/* Largest single transfer. Match the AXI DMA "Width of Buffer Length Register" */
+#define DMA_MAX_XFER_LEN    ((1 << 23) - 16)
+
+/* DMA/AES pairs are listed in this file, one "device <dma_base> <aes_base>"
+ * per line. Without it they are looked up in the device tree, and without
+ * that the single pair at 0x40400000/0x43C10000 is used. */
+#define DMA_CONF_PATH       "/etc/aes128.conf"
+#define DMA_MAX_DEVICES     8
+
+/* The reserved size is queried from rsvmem by dma_init() */
+#define RSV_BUF_LEN         rsv_buf_len
+/* Each device transfers within its own window of the buffer: the source
+ * half, then the destination half. By default the window is the whole buffer. */
+#define DMA_WINDOW_LEN      dma_window_len()
+#define MAX_SRC_LEN         (DMA_WINDOW_LEN / 2 < DMA_MAX_XFER_LEN ? DMA_WINDOW_LEN / 2 : DMA_MAX_XFER_LEN)
+#define MAX_DEST_LEN        MAX_SRC_LEN
+#define psrc		            ((char *)dma_window())
+#define pdest               (psrc + DMA_WINDOW_LEN / 2)
 extern void *pbuf;
+extern u32 rsv_buf_len;
+/* Number of DMA/AES pairs found by dma_init() */
+extern int dma_ndevices;
+/* Size of the private buffer dma_init() asks rsvmem for (0 = default) */
+extern u32 dma_buf_request;
+/* Set by dma_init() when the buffer is private to this process */
+extern int dma_private_buffer;
 extern int mem_fd;
 extern int polling_interval;
 
@@ -40,11 +63,46 @@ extern int polling_interval;
  *    /dev/mem is open and mem_fd is set properly.
  *    psrc points to the default source buffer for DMA.
  *    pdest points to the destination buffer for DMA.
+ *    If rsvmem supports it, the buffer is private to this process
+ *    (dma_buf_request bytes) and dma_private_buffer is set. Otherwise
+ *    the shared pool is mapped through /dev/mem.
+ *    Every device found (see DMA_CONF_PATH) is mapped and reset, and
+ *    dma_ndevices is set.
  * 
  *  Return: SUCCESS or FAILURE
  */
 extern int dma_init();
 
+/**
+ *  Direct the calling thread's DMA and AES calls to device dev.
+ *  Every thread starts on device 0. A device must only be driven by
+ *  one thread at a time.
+ *
+ *  Return: SUCCESS, or FAILURE if there is no such device.
+ */
+extern int dma_select(int dev);
+
+/**
+ *  Return: the calling thread's device.
+ */
+extern int dma_current();
+
+/**
+ *  Restrict device dev to len bytes of the reserved buffer starting at
+ *  base, so that several devices can run at once. len must be a multiple
+ *  of 32. psrc, pdest and MAX_SRC_LEN follow the selected device's window.
+ *  A NULL base gives the device the whole buffer again.
+ *
+ *  Return: SUCCESS or FAILURE
+ */
+extern int dma_set_window(int dev, void *base, u32 len);
+
+/**
+ *  Return: the start and length of the calling thread's window.
+ */
+extern void *dma_window();
+extern u32 dma_window_len();
+
 /**
  *  Reclaim the resouce used by the DMA driver.
  * 
@@ -73,6 +131,33 @@ extern int dma_reset();
  */
 extern int dma_start(u32 len);
 
+/**
+ *  Same as dma_start(), but with explicit physical source and destination
+ *  addresses inside the reserved buffer (see dma_phys_addr()).
+ * 
+ *  Return: SUCCESS or FAILURE
+ */
+extern int dma_start_addr(u32 src_addr, u32 dest_addr, u32 len);
+
+/**
+ *  Translate a pointer into the reserved buffer to its physical address.
+ * 
+ *  Return: the physical address, or 0 if ptr is outside the buffer.
+ */
+extern u32 dma_phys_addr(const void *ptr);
+
+/**
+ *  Enc/decrypt len bytes from src to dst, which may be any user memory
+ *  and any length (a multiple of 16). The data is split into transfers
+ *  the hardware accepts and run back to back: while one transfer is in
+ *  flight the next piece is copied in and the previous one copied out.
+ *  The CBC chain carries across the pieces as if it were one transfer.
+ *  src and dst may be the same buffer. psrc/pdest are clobbered.
+ *
+ *  Return: SUCCESS or FAILURE
+ */
+extern int dma_transfer(const void *src, void *dst, size_t len);
+
 /**
  *  Sync the process with the DMA transfer. 
  * 
@@ -90,10 +175,33 @@ extern int dma_sync();
 extern int dma_quick_poll();
 
 
+/**
+ *  Take the selected accelerator for this process. Processes are serialized
+ *  by a robust lock per device in the /aes128_arb shared memory segment. dma_start*() take
+ *  it and dma_sync() drops it, so callers only need this to hold the
+ *  accelerator across several transfers. Calls nest. If another process
+ *  used the hardware in between, this process's key and CBC chaining value
+ *  are written back first. A lock left by a dead process is recovered
+ *  and the DMA is reset.
+ *  With a shared (non-private) buffer, dma_init() takes it for the whole
+ *  session, since another process could overwrite psrc/pdest at any time.
+ *
+ *  Return: SUCCESS or FAILURE
+ */
+extern int dma_arb_acquire();
+
+/**
+ *  Undo one dma_arb_acquire(). The last one saves the chaining value
+ *  and lets other processes in.
+ */
+extern void dma_arb_release();
+
+
 /* -------------------- AES Functions ------------------- */
 
 /**
- *  Set the key for the AES hardware.
+ *  Set the key for the AES hardware. The key registers are mapped once by
+ *  dma_init() and shadowed, so setting the key already loaded is free.
  * 
  *  Parameters:
  *    *pkey -> pointer to the key (expect 16 bytes)
@@ -112,6 +220,27 @@ extern int aes_set_key(void *pkey);
  */
 extern int aes_set_iv(void *piv);
 
+/* One job of aes_run_batch() */
+struct aes_job
+{
+    const void *src;
+    void *dst;          /* may equal src */
+    u32 len;            /* a multiple of 16 */
+    const void *key;    /* 16 bytes, or NULL to keep the current key */
+    const void *iv;     /* 16 bytes, or NULL to continue the current chain */
+};
+
+/**
+ *  Run njobs jobs on the selected device, in order, each with its own key
+ *  and IV. As many jobs as fit are staged into psrc together. Each job's
+ *  key and IV are loaded just before its transfer, and its result is
+ *  copied out while the next job runs. The accelerator is held for the
+ *  whole batch.
+ * 
+ *  Return: SUCCESS or FAILURE
+ */
+extern int aes_run_batch(const struct aes_job *jobs, int njobs);
+
 
 /* ---------------------- Utilities ---------------------- */
 #define MEM_DUMP_MAX_BYTES  256
@@ -0,0 +1,163 @@
+/*
+ * File name: dma_metrics.c
+ * Version: 1.0
+ * Author: Hsiang-Ju Lai
+ * Description:
+ *  Publishes the driver's counters in /aes128_metrics.<pid> and lets
+ *  monitors find and map them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dma_metrics.h"
+
+#define SHM_DIR     "/dev/shm"
+
+static struct dma_metrics local_metrics;
+struct dma_metrics *pmetrics = &local_metrics;
+static char shm_name[64];
+
+uint64_t dma_metrics_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+int dma_metrics_open(int ndevices)
+{
+    struct dma_metrics *m;
+    FILE *fp;
+    int fd;
+
+    if (pmetrics != &local_metrics)
+        return SUCCESS;
+
+    memset(&local_metrics, 0, sizeof(local_metrics));
+    local_metrics.pid = (int32_t) getpid();
+    local_metrics.ndevices = (uint32_t) ndevices;
+    local_metrics.start_ns = dma_metrics_now();
+    if (NULL != (fp = fopen("/proc/self/comm", "r")))
+    {
+        if (NULL != fgets(local_metrics.comm, sizeof(local_metrics.comm), fp))
+            local_metrics.comm[strcspn(local_metrics.comm, "\n")] = '\0';
+        fclose(fp);
+    }
+    local_metrics.version = DMA_METRICS_VERSION;
+    local_metrics.magic = DMA_METRICS_MAGIC;
+
+    snprintf(shm_name, sizeof(shm_name), "%s%d", DMA_METRICS_SHM_PREFIX, (int) getpid());
+    fd = shm_open(shm_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        perror("Failed to create the metrics segment");
+        return FAILURE;
+    }
+    if (ftruncate(fd, sizeof(struct dma_metrics)) < 0)
+    {
+        perror("ftruncate");
+        close(fd);
+        shm_unlink(shm_name);
+        return FAILURE;
+    }
+    m = mmap(NULL, sizeof(struct dma_metrics), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == m)
+    {
+        perror("Failed to mmap the metrics segment");
+        shm_unlink(shm_name);
+        return FAILURE;
+    }
+
+    /* The magic goes last, so a monitor never sees a half-filled header */
+    memcpy(m, &local_metrics, sizeof(*m));
+    m->magic = 0;
+    __atomic_store_n(&m->magic, DMA_METRICS_MAGIC, __ATOMIC_RELEASE);
+    pmetrics = m;
+    return SUCCESS;
+}
+
+void dma_metrics_close()
+{
+    if (pmetrics == &local_metrics)
+        return;
+    memcpy(&local_metrics, pmetrics, sizeof(local_metrics));
+    munmap(pmetrics, sizeof(struct dma_metrics));
+    pmetrics = &local_metrics;
+    shm_unlink(shm_name);
+}
+
+int dma_metrics_list(pid_t *pids, int max)
+{
+    const char *prefix = DMA_METRICS_SHM_PREFIX + 1;
+    char name[64];
+    struct dirent *de;
+    DIR *dir;
+    pid_t pid;
+    char *end;
+    int n = 0;
+
+    if (NULL == (dir = opendir(SHM_DIR)))
+        return 0;
+    while (n < max && NULL != (de = readdir(dir)))
+    {
+        if (0 != strncmp(de->d_name, prefix, strlen(prefix)))
+            continue;
+        pid = (pid_t) strtol(de->d_name + strlen(prefix), &end, 10);
+        if (pid <= 0 || '\0' != *end)
+            continue;
+        if (0 != kill(pid, 0) && ESRCH == errno)
+        {
+            snprintf(name, sizeof(name), "/%.60s", de->d_name);
+            shm_unlink(name);
+            continue;
+        }
+        pids[n++] = pid;
+    }
+    closedir(dir);
+    return n;
+}
+
+const struct dma_metrics *dma_metrics_attach(pid_t pid)
+{
+    const struct dma_metrics *m;
+    char name[64];
+    struct stat st;
+    int fd;
+
+    snprintf(name, sizeof(name), "%s%d", DMA_METRICS_SHM_PREFIX, (int) pid);
+    if ((fd = shm_open(name, O_RDONLY, 0)) < 0)
+        return NULL;
+    if (0 != fstat(fd, &st) || st.st_size < (off_t) sizeof(struct dma_metrics))
+    {
+        close(fd);
+        return NULL;
+    }
+    m = mmap(NULL, sizeof(struct dma_metrics), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == m)
+        return NULL;
+    if (DMA_METRICS_MAGIC != __atomic_load_n(&m->magic, __ATOMIC_ACQUIRE) || DMA_METRICS_VERSION != m->version)
+    {
+        munmap((void *) m, sizeof(struct dma_metrics));
+        return NULL;
+    }
+    return m;
+}
+
+void dma_metrics_detach(const struct dma_metrics *m)
+{
+    if (NULL != m)
+        munmap((void *) m, sizeof(struct dma_metrics));
+}
@@ -0,0 +1,101 @@
+/**
+ *  dma_metrics.h - per-process DMA counters in shared memory.
+ *
+ *  dma_init() publishes a segment named /aes128_metrics.<pid> holding
+ *  running totals for every device this process drives. The driver only
+ *  adds to them, so they cost a few atomic adds per transfer. Tools such
+ *  as aes128stat map the segment read-only and compute rates from
+ *  successive samples. The segment is removed by dma_clean_up(); one left
+ *  by a process that died is removed by the next dma_metrics_list().
+ *
+ *  Author: Hsiang-Ju Lai <happyx94@gmail.com>
+ */
+#ifndef _DMA_METRICS_H
+#define _DMA_METRICS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "dma_driver.h"
+
+#define DMA_METRICS_SHM_PREFIX  "/aes128_metrics."
+#define DMA_METRICS_MAGIC       0x4d455431
+#define DMA_METRICS_VERSION     1
+
+/* Status register bits that report a transfer error */
+#define DMA_ERR_BITS            0x00000770
+
+/* Totals for one DMA/AES pair since dma_init() */
+struct dma_dev_metrics
+{
+    uint64_t transfers;         /* dma_start*() calls */
+    uint64_t bytes;             /* bytes sent through the accelerator */
+    uint64_t wait_ns;           /* time spent in dma_sync() */
+    uint64_t polls;             /* status register reads while waiting */
+    uint64_t timeouts;          /* dma_sync() gave up */
+    uint64_t errors;            /* transfers that ended with DMA_ERR_BITS set */
+    uint64_t key_loads;         /* key register writes (not skipped by the shadow) */
+    uint64_t iv_loads;
+    uint64_t resets;
+    uint64_t arb_waits;         /* times another process held the device */
+    uint64_t arb_wait_ns;
+    uint32_t last_mm2s_status;  /* status registers at the last timeout or error */
+    uint32_t last_s2mm_status;
+};
+
+struct dma_metrics
+{
+    uint32_t magic;             /* DMA_METRICS_MAGIC once filled in */
+    uint32_t version;
+    int32_t pid;
+    uint32_t ndevices;
+    uint64_t start_ns;          /* CLOCK_MONOTONIC at dma_init() */
+    char comm[16];
+    struct dma_dev_metrics dev[DMA_MAX_DEVICES];
+};
+
+/* Never NULL: counters go to a private copy until dma_metrics_open() */
+extern struct dma_metrics *pmetrics;
+
+#define metric_add(id, field, v) \
+    __atomic_fetch_add(&pmetrics->dev[(id)].field, (uint64_t) (v), __ATOMIC_RELAXED)
+
+/**
+ *  Return: CLOCK_MONOTONIC in ns.
+ */
+extern uint64_t dma_metrics_now();
+
+/**
+ *  Publish this process's counters. Called by dma_init().
+ *
+ *  Return: SUCCESS, or FAILURE if the segment can't be created (the
+ *  counters are then kept privately).
+ */
+extern int dma_metrics_open(int ndevices);
+
+/**
+ *  Remove this process's segment. Called by dma_clean_up().
+ */
+extern void dma_metrics_close();
+
+/**
+ *  Find the processes that publish counters. Segments of processes
+ *  that no longer exist are removed.
+ *
+ *  Return: the number of pids stored in pids (at most max).
+ */
+extern int dma_metrics_list(pid_t *pids, int max);
+
+/**
+ *  Map the counters of process pid, read-only.
+ *
+ *  Return: the counters, or NULL if pid publishes none.
+ */
+extern const struct dma_metrics *dma_metrics_attach(pid_t pid);
+
+/**
+ *  Unmap counters returned by dma_metrics_attach().
+ */
+extern void dma_metrics_detach(const struct dma_metrics *m);
+
+#endif
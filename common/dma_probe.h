@@ -0,0 +1,45 @@
+/**
+ *  dma_probe.h - USDT (SystemTap SDT) probes on the driver hot paths.
+ *
+ *  Each probe compiles to a single nop plus a note in the ELF file, so it
+ *  costs nothing until bpftrace or perf attaches to it, e.g.
+ *
+ *    bpftrace -e 'usdt:./aes128:aes128:dma_sync { @us = hist(arg3 / 1000); }'
+ *
+ *  Probes are built in when <sys/sdt.h> is found (systemtap-sdt-dev) and
+ *  DMA_NO_PROBES is not defined. Otherwise they expand to nothing.
+ *
+ *  Provider "aes128":
+ *    dma_start(dev, src_addr, dest_addr, len)
+ *    dma_sync(dev, status, polls, wait_ns)
+ *    aes_set_key(dev, ret), aes_set_iv(dev, ret)
+ *    hw_read_start(), hw_read_done(len)        encrypt_file()
+ *    hw_write_start(len), hw_write_done(ret)
+ *    sw_read_start(dec), sw_read_done(len)     file_cipher()
+ *    sw_write_start(len), sw_write_done(ret)
+ *
+ *  Author: Hsiang-Ju Lai <happyx94@gmail.com>
+ */
+#ifndef _DMA_PROBE_H
+#define _DMA_PROBE_H
+
+#if !defined(DMA_NO_PROBES) && defined(__has_include)
+  #if __has_include(<sys/sdt.h>)
+    #include <sys/sdt.h>
+    #define DMA_PROBES 1
+  #endif
+#endif
+
+#ifdef DMA_PROBES
+  #define dma_probe0(name)              DTRACE_PROBE(aes128, name)
+  #define dma_probe1(name, a)           DTRACE_PROBE1(aes128, name, a)
+  #define dma_probe2(name, a, b)        DTRACE_PROBE2(aes128, name, a, b)
+  #define dma_probe4(name, a, b, c, d)  DTRACE_PROBE4(aes128, name, a, b, c, d)
+#else
+  #define dma_probe0(name)              do {} while (0)
+  #define dma_probe1(name, a)           do {} while (0)
+  #define dma_probe2(name, a, b)        do {} while (0)
+  #define dma_probe4(name, a, b, c, d)  do {} while (0)
+#endif
+
+#endif
@@ -0,0 +1,631 @@
+/*
+ * File name: dma_queue.c
+ * Version: 1.0
+ * Author: Hsiang-Ju Lai
+ * Description:
+ *  Bounded MPMC ring (one sequence number per cell, after D. Vyukov) with
+ *  one dispatcher thread per device that schedules the requests onto the
+ *  DMAs. The class queues are shared by the dispatchers under q.lock; one
+ *  of the idle dispatchers sleeps on the ring while the others wait for
+ *  it to bring in work. A request is off the queues while it runs, so two
+ *  devices never work on the same CBC chain. The statistics are updated
+ *  atomically.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "dma_queue.h"
+
+/* Serve a lower class first when its deadline is this close (us) */
+#define DMA_QUEUE_SLACK_US  500
+
+struct cell
+{
+    atomic_size_t seq;
+    struct dma_req *req;
+};
+
+static struct
+{
+    _Alignas(64) atomic_size_t enqueue_pos;
+    _Alignas(64) atomic_size_t dequeue_pos;
+    _Alignas(64) struct cell *cells;
+    size_t mask;
+    sem_t pending;          /* one count per queued request */
+    atomic_int stop;
+    int ndispatchers;
+    u8 default_key[16];
+
+    /* dispatchers, under lock */
+    pthread_mutex_t lock;
+    pthread_cond_t arrived;                 /* the draining dispatcher queued work */
+    int draining;                           /* someone is asleep on pending */
+    int stopping;                           /* the stop token was seen */
+    struct dma_req *head[DMA_NCLASSES];     /* sorted by deadline, FIFO for ties */
+    double us_per_byte;                     /* running estimate of the service rate per device */
+} q;
+
+/* One per device */
+struct dispatcher
+{
+    pthread_t thread;
+    int dev;
+};
+static struct dispatcher dispatchers[DMA_MAX_DEVICES];
+
+static struct
+{
+    atomic_uint depth, max_depth;
+    atomic_ullong completed, bytes, wait_us, max_wait_us, latency_us, max_latency_us;
+    atomic_ullong deadline_misses, preemptions;
+} stats[DMA_NCLASSES];
+
+static int ring_push(struct dma_req *req)
+{
+    size_t pos = atomic_load_explicit(&q.enqueue_pos, memory_order_relaxed);
+    struct cell *c;
+
+    for (;;)
+    {
+        c = &q.cells[pos & q.mask];
+        size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+        if (0 == diff)
+        {
+            if (atomic_compare_exchange_weak_explicit(&q.enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+            return FAILURE;     /* full */
+        else
+            pos = atomic_load_explicit(&q.enqueue_pos, memory_order_relaxed);
+    }
+    c->req = req;
+    atomic_store_explicit(&c->seq, pos + 1, memory_order_release);
+    return SUCCESS;
+}
+
+static struct dma_req *ring_pop()
+{
+    size_t pos = atomic_load_explicit(&q.dequeue_pos, memory_order_relaxed);
+    struct cell *c;
+    struct dma_req *req;
+
+    for (;;)
+    {
+        c = &q.cells[pos & q.mask];
+        size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+
+        if (0 == diff)
+        {
+            if (atomic_compare_exchange_weak_explicit(&q.dequeue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+            return NULL;        /* empty */
+        else
+            pos = atomic_load_explicit(&q.dequeue_pos, memory_order_relaxed);
+    }
+    req = c->req;
+    atomic_store_explicit(&c->seq, pos + q.mask + 1, memory_order_release);
+    return req;
+}
+
+/* Every cell claimed so far has been taken */
+static int ring_drained()
+{
+    size_t end = atomic_load_explicit(&q.enqueue_pos, memory_order_acquire);
+
+    return atomic_load_explicit(&q.dequeue_pos, memory_order_acquire) == end;
+}
+
+uint64_t dma_queue_now()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000 + (uint64_t) (t.tv_nsec / 1000);
+}
+
+static void atomic_max(atomic_ullong *v, unsigned long long x)
+{
+    unsigned long long cur = atomic_load_explicit(v, memory_order_relaxed);
+
+    while (cur < x && !atomic_compare_exchange_weak_explicit(v, &cur, x, memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+static void complete(struct dma_req *req, int status)
+{
+    uint64_t now = dma_queue_now();
+    int c = req->cls;
+
+    atomic_fetch_sub(&stats[c].depth, 1);
+    atomic_fetch_add(&stats[c].completed, 1);
+    atomic_fetch_add(&stats[c].bytes, req->len);
+    atomic_fetch_add(&stats[c].latency_us, now - req->submitted);
+    atomic_max(&stats[c].max_latency_us, now - req->submitted);
+    if (req->deadline && now > req->deadline)
+        atomic_fetch_add(&stats[c].deadline_misses, 1);
+
+    req->status = status;
+    sem_post(&req->done);
+}
+
+static void mark_started(struct dma_req *req)
+{
+    if (req->started)
+        return;
+    req->started = dma_queue_now();
+    atomic_fetch_add(&stats[req->cls].wait_us, req->started - req->submitted);
+    atomic_max(&stats[req->cls].max_wait_us, req->started - req->submitted);
+}
+
+static const void *req_key(const struct dma_req *req)
+{
+    return req->key ? req->key : q.default_key;
+}
+
+static void update_rate(u32 bytes, uint64_t us)
+{
+    double r = (double) us / bytes;
+
+    pthread_mutex_lock(&q.lock);
+    q.us_per_byte = q.us_per_byte > 0 ? 0.8 * q.us_per_byte + 0.2 * r : r;
+    pthread_mutex_unlock(&q.lock);
+}
+
+static void enqueue(struct dma_req *req)
+{
+    struct dma_req **pp = &q.head[req->cls];
+
+    /* Requests without a deadline go after every one that has one */
+    while (*pp && (0 == req->deadline || ((*pp)->deadline && (*pp)->deadline <= req->deadline)))
+        pp = &(*pp)->next;
+    req->next = *pp;
+    *pp = req;
+}
+
+/* A partly done request goes back ahead of the requests that tie with it */
+static void requeue(struct dma_req *req)
+{
+    struct dma_req **pp = &q.head[req->cls];
+
+    while (*pp && (*pp)->deadline && (0 == req->deadline || (*pp)->deadline < req->deadline))
+        pp = &(*pp)->next;
+    req->next = *pp;
+    *pp = req;
+}
+
+static int is_queued(const struct dma_req *req, int cls)
+{
+    for (const struct dma_req *r = q.head[cls]; r; r = r->next)
+        if (r == req)
+            return 1;
+    return 0;
+}
+
+static void dequeue(struct dma_req *req)
+{
+    struct dma_req **pp = &q.head[req->cls];
+
+    while (*pp != req)
+        pp = &(*pp)->next;
+    *pp = req->next;
+}
+
+/* Queue the request behind one count of q.pending. A producer posts
+ * after publishing its own cell, but the cell at the head may belong to
+ * another producer that is still filling it, so an empty ring is retried.
+ * Only dma_queue_destroy's count has no request behind it: q.stop is set
+ * and every claimed cell has been taken.
+ * Return: 1 if it was the stop token. */
+static int take_pending()
+{
+    struct dma_req *req;
+
+    while (NULL == (req = ring_pop()))
+    {
+        if (atomic_load(&q.stop) && ring_drained())
+            return 1;
+        sched_yield();
+    }
+    enqueue(req);
+    return 0;
+}
+
+/* Move everything in the ring into the class queues.
+ * Return: 1 if the stop token was seen. */
+static int drain_ring(int block)
+{
+    int stop = 0;
+
+    for (;;)
+    {
+        if (block)
+        {
+            while (0 != sem_wait(&q.pending) && EINTR == errno)
+                ;
+            block = 0;
+        }
+        else if (0 != sem_trywait(&q.pending))
+            break;
+
+        stop |= take_pending();
+    }
+    return stop;
+}
+
+/* Highest class first, unless some deadline would be missed otherwise */
+static struct dma_req *pick()
+{
+    struct dma_req *urgent = NULL, *req;
+    uint64_t now = dma_queue_now(), finish;
+    int c;
+
+    for (c = 0; c < DMA_NCLASSES; c++)
+    {
+        /* The head has the earliest deadline of its class */
+        req = q.head[c];
+        if (NULL == req || 0 == req->deadline)
+            continue;
+        finish = now + (uint64_t) (q.us_per_byte * (req->len - req->progress)) + DMA_QUEUE_SLACK_US;
+        if (finish >= req->deadline && (NULL == urgent || req->deadline < urgent->deadline))
+            urgent = req;
+    }
+    if (urgent)
+        return urgent;
+
+    for (c = 0; c < DMA_NCLASSES; c++)
+        if (q.head[c])
+            return q.head[c];
+    return NULL;
+}
+
+/* Run one slice of req, which is off the queues. The chain is kept in
+ * req->iv between slices.
+ * Return: 1 if req went back to the queues unfinished. */
+static int run_slice(struct dma_req *req)
+{
+    u32 len = req->len - req->progress;
+    const char *src = (const char *) req->src + req->progress;
+    char *dst = (char *) req->dst + req->progress;
+    uint64_t t0 = dma_queue_now();
+
+    if (len > DMA_QUEUE_SLICE)
+        len = DMA_QUEUE_SLICE;
+    mark_started(req);
+
+    /* The driver skips rewriting a key that is already loaded */
+    if (FAILURE == aes_set_key((void *) req_key(req)) || FAILURE == aes_set_iv(req->iv)
+        || FAILURE == dma_transfer(src, dst, len))
+    {
+        complete(req, FAILURE);
+        return 0;
+    }
+    update_rate(len, dma_queue_now() - t0);
+
+    req->progress += len;
+    memcpy(req->iv, dst + len - 16, 16);
+    if (req->progress == req->len)
+    {
+        complete(req, SUCCESS);
+        return 0;
+    }
+    pthread_mutex_lock(&q.lock);
+    requeue(req);
+    pthread_mutex_unlock(&q.lock);
+    return 1;
+}
+
+/* Run the batch back to back, each request with its own key and IV */
+static void run_batch(struct dma_req **batch, int n)
+{
+    struct aes_job jobs[DMA_QUEUE_MAX_BATCH];
+    uint64_t t0 = dma_queue_now();
+    u32 bytes = 0;
+    int i, status;
+
+    for (i = 0; i < n; i++)
+    {
+        mark_started(batch[i]);
+        jobs[i].src = batch[i]->src;
+        jobs[i].dst = batch[i]->dst;
+        jobs[i].len = batch[i]->len;
+        jobs[i].key = req_key(batch[i]);
+        jobs[i].iv = batch[i]->iv;
+        bytes += batch[i]->len;
+    }
+    status = aes_run_batch(jobs, n);
+    if (SUCCESS == status)
+        update_rate(bytes, dma_queue_now() - t0);
+    for (i = 0; i < n; i++)
+        complete(batch[i], status);
+}
+
+/* Take the next piece of work off the queues: one request to slice, or
+ * a batch of small ones. Return: the number of requests, 0 to stop. */
+static int next_work(struct dma_req **batch, u32 limit)
+{
+    struct dma_req *req;
+    u32 used;
+    int n = 0;
+
+    pthread_mutex_lock(&q.lock);
+    for (;;)
+    {
+        if (drain_ring(0))
+            q.stopping = 1;
+        if (NULL != (req = pick()) || q.stopping)
+            break;
+        if (q.draining)
+        {
+            pthread_cond_wait(&q.arrived, &q.lock);
+            continue;
+        }
+
+        /* Sleep on the ring for everyone */
+        q.draining = 1;
+        pthread_mutex_unlock(&q.lock);
+        while (0 != sem_wait(&q.pending) && EINTR == errno)
+            ;
+        pthread_mutex_lock(&q.lock);
+        q.draining = 0;
+        if (take_pending())
+            q.stopping = 1;
+        pthread_cond_broadcast(&q.arrived);
+    }
+    if (NULL == req)
+    {
+        /* Stopping. Wake the dispatchers waiting for the ring and the one
+         * asleep on it; another dispatcher on its way out may take that
+         * count instead, and then passes it on the same way. */
+        pthread_cond_broadcast(&q.arrived);
+        if (q.draining)
+            sem_post(&q.pending);
+        pthread_mutex_unlock(&q.lock);
+        return 0;
+    }
+
+    batch[n++] = req;
+    if (0 == req->progress && req->len <= limit)
+    {
+        /* Pack the small requests queued right behind it in its class,
+         * whatever their keys */
+        used = req->len;
+        for (struct dma_req *r = req->next; r && n < DMA_QUEUE_MAX_BATCH; r = r->next)
+        {
+            if (r->progress > 0 || used + r->len > limit)
+                break;
+            batch[n++] = r;
+            used += r->len;
+        }
+    }
+    for (int i = 0; i < n; i++)
+        dequeue(batch[i]);
+    pthread_mutex_unlock(&q.lock);
+    return n;
+}
+
+static void *dispatch(void *arg)
+{
+    struct dispatcher *d = arg;
+    struct dma_req *batch[DMA_QUEUE_MAX_BATCH];
+    struct dma_req *req, *prev = NULL;
+    u32 limit;
+    int n, prev_cls = 0;
+
+    dma_select(d->dev);
+    limit = MAX_SRC_LEN < DMA_QUEUE_SLICE ? MAX_SRC_LEN : DMA_QUEUE_SLICE;
+    while ((n = next_work(batch, limit)) > 0)
+    {
+        req = batch[0];
+
+        /* A partly done request that loses the DMA to another one is
+         * preempted, unless another device has picked it up meanwhile.
+         * prev may be done by now, so it is only looked for, never read. */
+        if (prev && prev != req)
+        {
+            pthread_mutex_lock(&q.lock);
+            if (is_queued(prev, prev_cls))
+                atomic_fetch_add(&stats[prev_cls].preemptions, 1);
+            pthread_mutex_unlock(&q.lock);
+        }
+        prev = NULL;
+
+        if (req->progress > 0 || req->len > limit)
+        {
+            prev_cls = req->cls;
+            if (run_slice(req))
+                prev = req;
+            continue;
+        }
+        run_batch(batch, n);
+    }
+    return NULL;
+}
+
+int dma_queue_init(u32 depth, const void *key)
+{
+    size_t i;
+    u32 win;
+    int n;
+
+    if (depth < 2 || (depth & (depth - 1)) != 0 || NULL == pbuf || NULL == key)
+    {
+        fprintf(stderr, "[ERROR] Invalid DMA queue depth %u\n", depth);
+        return FAILURE;
+    }
+    if (NULL == (q.cells = calloc(depth, sizeof(*q.cells))))
+    {
+        perror("calloc");
+        return FAILURE;
+    }
+    q.mask = depth - 1;
+    for (i = 0; i < depth; i++)
+        atomic_init(&q.cells[i].seq, i);
+    atomic_init(&q.enqueue_pos, 0);
+    atomic_init(&q.dequeue_pos, 0);
+    atomic_init(&q.stop, 0);
+    sem_init(&q.pending, 0, 0);
+    pthread_mutex_init(&q.lock, NULL);
+    pthread_cond_init(&q.arrived, NULL);
+    q.draining = 0;
+    q.stopping = 0;
+    memset(q.head, 0, sizeof(q.head));
+    memcpy(q.default_key, key, 16);
+    q.us_per_byte = 0;
+    memset(stats, 0, sizeof(stats));
+
+    /* Split the buffer between the devices so that they can all run at once */
+    n = dma_ndevices > 1 ? dma_ndevices : 1;
+    win = (RSV_BUF_LEN / (u32) n) & ~4095U;
+    for (int dev = 0; n > 1 && dev < n; dev++)
+        if (FAILURE == dma_set_window(dev, (char *) pbuf + dev * win, win))
+            n = 1;
+
+    q.ndispatchers = 0;
+    for (int dev = 0; dev < n; dev++)
+    {
+        dispatchers[dev].dev = dev;
+        if (0 != pthread_create(&dispatchers[dev].thread, NULL, dispatch, &dispatchers[dev]))
+        {
+            perror("pthread_create");
+            break;
+        }
+        q.ndispatchers++;
+    }
+    if (0 == q.ndispatchers)
+    {
+        dma_queue_destroy();
+        return FAILURE;
+    }
+    if (q.ndispatchers > 1)
+        fprintf(stderr, "[INFO] DMA queue: %d dispatchers, %u KB window each.\n", q.ndispatchers, win / 1024);
+    return SUCCESS;
+}
+
+void dma_queue_destroy()
+{
+    if (NULL == q.cells)
+        return;
+    atomic_store(&q.stop, 1);
+    sem_post(&q.pending);   /* an extra count with no request behind it */
+    for (int i = 0; i < q.ndispatchers; i++)
+        pthread_join(dispatchers[i].thread, NULL);
+    for (int dev = 0; dev < dma_ndevices; dev++)
+        dma_set_window(dev, NULL, 0);
+    q.ndispatchers = 0;
+    pthread_cond_destroy(&q.arrived);
+    pthread_mutex_destroy(&q.lock);
+    sem_destroy(&q.pending);
+    free(q.cells);
+    q.cells = NULL;
+}
+
+int dma_submit(struct dma_req *req)
+{
+    unsigned int depth;
+
+    if (0 == req->len || req->len % 16 != 0 || req->cls < 0 || req->cls >= DMA_NCLASSES
+        || atomic_load(&q.stop))
+        return FAILURE;
+    sem_init(&req->done, 0, 0);
+    req->status = FAILURE;
+    req->progress = 0;
+    req->started = 0;
+    req->next = NULL;
+    req->submitted = dma_queue_now();
+
+    /* Count it before a dispatcher can pop and complete it, or the depth
+     * would briefly wrap below zero */
+    depth = atomic_fetch_add(&stats[req->cls].depth, 1) + 1;
+    if (FAILURE == ring_push(req))
+    {
+        atomic_fetch_sub(&stats[req->cls].depth, 1);
+        sem_destroy(&req->done);
+        return FAILURE;
+    }
+    for (unsigned int m = atomic_load(&stats[req->cls].max_depth); m < depth; )
+        if (atomic_compare_exchange_weak(&stats[req->cls].max_depth, &m, depth))
+            break;
+
+    sem_post(&q.pending);
+    return SUCCESS;
+}
+
+int dma_wait(struct dma_req *req)
+{
+    while (0 != sem_wait(&req->done) && EINTR == errno)
+        ;
+    sem_destroy(&req->done);
+    return req->status;
+}
+
+int dma_request(const void *src, void *dst, u32 len, const void *iv)
+{
+    struct dma_req req;
+
+    memset(&req, 0, sizeof(req));
+    req.src = src;
+    req.dst = dst;
+    req.len = len;
+    req.cls = DMA_CLASS_NORMAL;
+    memcpy(req.iv, iv, sizeof(req.iv));
+    while (FAILURE == dma_submit(&req))
+    {
+        if (0 == len || len % 16 != 0 || atomic_load(&q.stop))
+            return FAILURE;
+        sched_yield();  /* ring full */
+    }
+    return dma_wait(&req);
+}
+
+void dma_queue_stats(int cls, struct dma_class_stats *out)
+{
+    memset(out, 0, sizeof(*out));
+    if (cls < 0 || cls >= DMA_NCLASSES)
+        return;
+    out->depth = atomic_load(&stats[cls].depth);
+    out->max_depth = atomic_load(&stats[cls].max_depth);
+    out->completed = atomic_load(&stats[cls].completed);
+    out->bytes = atomic_load(&stats[cls].bytes);
+    out->wait_us = atomic_load(&stats[cls].wait_us);
+    out->max_wait_us = atomic_load(&stats[cls].max_wait_us);
+    out->latency_us = atomic_load(&stats[cls].latency_us);
+    out->max_latency_us = atomic_load(&stats[cls].max_latency_us);
+    out->deadline_misses = atomic_load(&stats[cls].deadline_misses);
+    out->preemptions = atomic_load(&stats[cls].preemptions);
+}
+
+void dma_queue_report()
+{
+    static const char *names[DMA_NCLASSES] = { "interactive", "normal", "bulk" };
+    struct dma_class_stats st;
+
+    for (int c = 0; c < DMA_NCLASSES; c++)
+    {
+        dma_queue_stats(c, &st);
+        if (0 == st.completed && 0 == st.depth)
+            continue;
+        fprintf(stderr, "[INFO] %-11s: %llu done (%llu KB), depth %u (max %u), wait avg %llu us max %llu us, "
+                "latency avg %llu us max %llu us, %llu deadline misses, %llu preemptions\n",
+                names[c], (unsigned long long) st.completed, (unsigned long long) (st.bytes / 1024),
+                st.depth, st.max_depth,
+                (unsigned long long) (st.completed ? st.wait_us / st.completed : 0), (unsigned long long) st.max_wait_us,
+                (unsigned long long) (st.completed ? st.latency_us / st.completed : 0), (unsigned long long) st.max_latency_us,
+                (unsigned long long) st.deadline_misses, (unsigned long long) st.preemptions);
+    }
+}
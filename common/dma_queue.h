@@ -0,0 +1,117 @@
+/**
+ *  dma_queue.h - lock-free submission queue and scheduler in front of the DMA.
+ *
+ *  Threads in one process submit requests to a bounded multi-producer
+ *  ring without taking a lock. One dispatcher thread per device owns that
+ *  DMA. They move requests from the ring into shared per-class queues and
+ *  serve the highest class first, unless a deadline is about to be missed.
+ *  Large requests run one slice at a time, so an interactive request waits
+ *  for at most one slice of a bulk job. Adjacent small requests of the same
+ *  class are packed into the buffer together and run back to back.
+ *
+ *  Author: Hsiang-Ju Lai <happyx94@gmail.com>
+ */
+#ifndef _DMA_QUEUE_H
+#define _DMA_QUEUE_H
+
+#include <stdint.h>
+#include <semaphore.h>
+
+#include "dma_driver.h"
+
+#define DMA_QUEUE_MAX_BATCH 32
+#define DMA_QUEUE_SLICE     (256 * 1024)    /* preemption granularity */
+
+/* Priority classes, highest first */
+#define DMA_CLASS_INTERACTIVE   0
+#define DMA_CLASS_NORMAL        1
+#define DMA_CLASS_BULK          2
+#define DMA_NCLASSES            3
+
+struct dma_req
+{
+    const void *src;    /* any user memory; copied into the DMA buffer */
+    void *dst;          /* may equal src */
+    u32 len;            /* a multiple of 16 */
+    u8 iv[16];          /* each request is its own CBC message */
+    const void *key;    /* 16 bytes, or NULL for the queue's default key.
+                           Must stay valid until the request is done. */
+    int cls;            /* DMA_CLASS_* */
+    uint64_t deadline;  /* CLOCK_MONOTONIC us (see dma_queue_now()), 0 for none */
+    int status;         /* SUCCESS or FAILURE once done */
+
+    /* private to dma_queue */
+    sem_t done;
+    u32 progress;       /* bytes already processed; iv holds the chain */
+    uint64_t submitted, started;
+    struct dma_req *next;
+};
+
+struct dma_class_stats
+{
+    u32 depth;              /* submitted but not completed */
+    u32 max_depth;
+    uint64_t completed;
+    uint64_t bytes;
+    uint64_t wait_us;       /* sum of submit -> first slice */
+    uint64_t max_wait_us;
+    uint64_t latency_us;    /* sum of submit -> completion */
+    uint64_t max_latency_us;
+    uint64_t deadline_misses;
+    uint64_t preemptions;   /* times a partly done request was set aside */
+};
+
+/**
+ *  Start one dispatcher per device with a ring of depth entries (a power
+ *  of two). key is used for requests that don't carry their own.
+ *  Must be called after dma_init(). With several devices the buffer is
+ *  split into one window each (see dma_set_window()). The buffer belongs
+ *  to the dispatchers until dma_queue_destroy().
+ *
+ *  Return: SUCCESS or FAILURE
+ */
+extern int dma_queue_init(u32 depth, const void *key);
+
+/**
+ *  Finish the queued requests and stop the dispatcher.
+ */
+extern void dma_queue_destroy();
+
+/**
+ *  Queue req without blocking. Thread-safe and lock-free.
+ *
+ *  Return: SUCCESS, or FAILURE if the ring is full.
+ */
+extern int dma_submit(struct dma_req *req);
+
+/**
+ *  Block until req is done.
+ *
+ *  Return: req->status
+ */
+extern int dma_wait(struct dma_req *req);
+
+/**
+ *  Submit a DMA_CLASS_NORMAL request with the default key (retrying while
+ *  the ring is full) and wait. Thread-safe.
+ *
+ *  Return: SUCCESS or FAILURE
+ */
+extern int dma_request(const void *src, void *dst, u32 len, const void *iv);
+
+/**
+ *  The clock deadlines are measured against, in us.
+ */
+extern uint64_t dma_queue_now();
+
+/**
+ *  Copy the counters of one class. Safe to call while requests run.
+ */
+extern void dma_queue_stats(int cls, struct dma_class_stats *out);
+
+/**
+ *  Print the per-class counters to stderr.
+ */
+extern void dma_queue_report();
+
+#endif
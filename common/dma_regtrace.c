@@ -0,0 +1,112 @@
+/*
+ * File name: dma_regtrace.c
+ * Version: 1.0
+ * Author: Hsiang-Ju Lai
+ * Description:
+ *  Records the driver's register accesses into a file mapped with
+ *  MAP_SHARED, so what was recorded survives a crash. The header comes
+ *  first, followed by the records.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "dma_regtrace.h"
+
+struct dma_regtrace_hdr *regtrace;
+static size_t regtrace_len;
+static int regtrace_fd = -1;
+
+static uint64_t regtrace_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+int dma_regtrace_open(int ndevices)
+{
+    const char *path = getenv(DMA_REGTRACE_ENV);
+    const char *max = getenv(DMA_REGTRACE_MAX_ENV);
+    uint64_t capacity = DMA_REGTRACE_DEFAULT;
+    struct dma_regtrace_hdr *h;
+
+    if (NULL == path || NULL != regtrace)
+        return SUCCESS;
+    if (NULL != max && strtoull(max, NULL, 0) > 0)
+        capacity = strtoull(max, NULL, 0);
+
+    regtrace_len = sizeof(*h) + capacity * sizeof(struct dma_regtrace_rec);
+    regtrace_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (regtrace_fd < 0)
+    {
+        perror(path);
+        return FAILURE;
+    }
+    if (ftruncate(regtrace_fd, (off_t) regtrace_len) < 0)
+    {
+        perror("ftruncate");
+        close(regtrace_fd);
+        regtrace_fd = -1;
+        return FAILURE;
+    }
+    h = mmap(NULL, regtrace_len, PROT_READ | PROT_WRITE, MAP_SHARED, regtrace_fd, 0);
+    if (MAP_FAILED == h)
+    {
+        perror("Failed to mmap the register trace");
+        close(regtrace_fd);
+        regtrace_fd = -1;
+        return FAILURE;
+    }
+    h->version = DMA_REGTRACE_VERSION;
+    h->start_ns = regtrace_now();
+    h->capacity = capacity;
+    h->count = 0;
+    h->ndevices = (uint32_t) ndevices;
+    __atomic_store_n(&h->magic, DMA_REGTRACE_MAGIC, __ATOMIC_RELEASE);
+    regtrace = h;
+    fprintf(stderr, "[INFO] Recording register accesses to %s (up to %llu).\n", path, (unsigned long long) capacity);
+    return SUCCESS;
+}
+
+void dma_regtrace_add(int type, int dev, u32 offset, u32 value)
+{
+    struct dma_regtrace_hdr *h = regtrace;
+    struct dma_regtrace_rec *r;
+    uint64_t i = __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+
+    if (i >= h->capacity)
+        return;
+    r = (struct dma_regtrace_rec *) (h + 1) + i;
+    r->ns = regtrace_now() - h->start_ns;
+    r->type = (uint8_t) type;
+    r->dev = (uint8_t) dev;
+    r->offset = (uint16_t) offset;
+    r->value = value;
+}
+
+void dma_regtrace_close()
+{
+    uint64_t n;
+
+    if (NULL == regtrace)
+        return;
+    n = regtrace->count < regtrace->capacity ? regtrace->count : regtrace->capacity;
+    if (regtrace->count > regtrace->capacity)
+        fprintf(stderr, "[INFO] The register trace was full: %llu records were dropped.\n",
+                (unsigned long long) (regtrace->count - regtrace->capacity));
+    regtrace->capacity = n;
+    msync(regtrace, regtrace_len, MS_SYNC);
+    munmap(regtrace, regtrace_len);
+    regtrace = NULL;
+    if (ftruncate(regtrace_fd, (off_t) (sizeof(struct dma_regtrace_hdr) + n * sizeof(struct dma_regtrace_rec))) < 0)
+        perror("ftruncate");
+    close(regtrace_fd);
+    regtrace_fd = -1;
+}
@@ -0,0 +1,79 @@
+/**
+ *  dma_regtrace.h - record of every DMA/AES register access.
+ *
+ *  When $AES128_REGTRACE names a file, dma_init() maps it and the driver
+ *  appends a timestamped record for each register write, each status
+ *  poll, and the start and end of each dma_sync(). aes128replay reads the
+ *  file back, fits a timing model of the board to it and predicts how
+ *  the same workload would run with another polling interval, chunk size
+ *  or batch size. Records are claimed with an atomic add, so the file
+ *  stays consistent with several devices running at once. When the file
+ *  is full, later records are only counted.
+ *
+ *  Author: Hsiang-Ju Lai <happyx94@gmail.com>
+ */
+#ifndef _DMA_REGTRACE_H
+#define _DMA_REGTRACE_H
+
+#include <stdint.h>
+
+#include "dma_driver.h"
+
+#define DMA_REGTRACE_ENV        "AES128_REGTRACE"
+#define DMA_REGTRACE_MAX_ENV    "AES128_REGTRACE_MAX"   /* records, default below */
+#define DMA_REGTRACE_DEFAULT    (1024 * 1024)
+#define DMA_REGTRACE_MAGIC      0x52545231
+#define DMA_REGTRACE_VERSION    1
+
+/* Record types */
+#define REGTRACE_DMA_WRITE      1   /* offset, value */
+#define REGTRACE_DMA_POLL       2   /* offset, value read */
+#define REGTRACE_AES_WRITE      3   /* offset; key and IV values are not recorded */
+#define REGTRACE_SYNC_BEGIN     4   /* value: polling_interval (us) */
+#define REGTRACE_SYNC_END       5   /* offset: 1 if it failed, value: polls */
+
+struct dma_regtrace_rec
+{
+    uint64_t ns;        /* since the trace started */
+    uint8_t type;
+    uint8_t dev;
+    uint16_t offset;
+    uint32_t value;
+};
+
+struct dma_regtrace_hdr
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t start_ns;  /* CLOCK_MONOTONIC when the trace started */
+    uint64_t capacity;  /* records the file has room for */
+    uint64_t count;     /* records claimed, may exceed capacity */
+    uint32_t ndevices;
+    uint32_t reserved;
+};
+
+/* NULL unless a trace is being recorded */
+extern struct dma_regtrace_hdr *regtrace;
+
+#define regtrace_log(type, dev, offset, value) \
+    do { if (NULL != regtrace) dma_regtrace_add((type), (dev), (offset), (value)); } while (0)
+
+/**
+ *  Start recording to $AES128_REGTRACE, if set. Called by dma_init().
+ *
+ *  Return: SUCCESS, or FAILURE if the file can't be set up.
+ */
+extern int dma_regtrace_open(int ndevices);
+
+/**
+ *  Trim the file to the records written and stop. Called by dma_clean_up().
+ */
+extern void dma_regtrace_close();
+
+/**
+ *  Append one record. Use regtrace_log(), which skips the call when no
+ *  trace is being recorded.
+ */
+extern void dma_regtrace_add(int type, int dev, u32 offset, u32 value);
+
+#endif
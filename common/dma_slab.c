@@ -0,0 +1,110 @@
+/*
+ * File name: dma_slab.c
+ * Version: 1.0
+ * Author: Hsiang-Ju Lai
+ * Description:
+ *  Slot allocator with reference-counted handles over the reserved,
+ *  physically contiguous DMA buffer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "dma_slab.h"
+
+static pthread_mutex_t slab_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct dma_buf handles[DMA_SLAB_MAX_SLOTS];   /* indexed by first slot */
+static unsigned char used[DMA_SLAB_MAX_SLOTS];
+static u32 slab_slot_len;
+static int slab_nslots;
+
+int dma_slab_init(u32 slot_len)
+{
+    if (NULL == pbuf || slot_len < 4096 || (slot_len & (slot_len - 1)) != 0)
+    {
+        fprintf(stderr, "[ERROR] Invalid DMA slot size %u\n", slot_len);
+        return FAILURE;
+    }
+
+    pthread_mutex_lock(&slab_lock);
+    slab_slot_len = slot_len;
+    slab_nslots = (int) (RSV_BUF_LEN / slot_len);
+    if (slab_nslots > DMA_SLAB_MAX_SLOTS)
+        slab_nslots = DMA_SLAB_MAX_SLOTS;
+    memset(used, 0, sizeof(used));
+    memset(handles, 0, sizeof(handles));
+    pthread_mutex_unlock(&slab_lock);
+
+    fprintf(stderr, "[INFO] DMA buffer split into %d slots of %u KB.\n", slab_nslots, slot_len / 1024);
+    return slab_nslots > 0 ? SUCCESS : FAILURE;
+}
+
+void dma_slab_destroy()
+{
+    pthread_mutex_lock(&slab_lock);
+    slab_nslots = 0;
+    slab_slot_len = 0;
+    pthread_mutex_unlock(&slab_lock);
+}
+
+struct dma_buf *dma_buf_alloc(u32 len)
+{
+    struct dma_buf *buf = NULL;
+    int need, run = 0;
+
+    if (0 == len || 0 == slab_slot_len)
+        return NULL;
+    need = (int) ((len + slab_slot_len - 1) / slab_slot_len);
+
+    pthread_mutex_lock(&slab_lock);
+    /* First fit over the slot map */
+    for (int i = 0; i < slab_nslots; i++)
+    {
+        run = used[i] ? 0 : run + 1;
+        if (run == need)
+        {
+            int first = i - need + 1;
+
+            memset(used + first, 1, (size_t) need);
+            buf = &handles[first];
+            buf->vaddr = (char *) pbuf + (size_t) first * slab_slot_len;
+            buf->paddr = dma_phys_addr(buf->vaddr);
+            buf->len = (u32) need * slab_slot_len;
+            buf->slot = first;
+            buf->nslots = need;
+            __atomic_store_n(&buf->refcnt, 1, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&slab_lock);
+
+    return buf;
+}
+
+struct dma_buf *dma_buf_get(struct dma_buf *buf)
+{
+    __atomic_add_fetch(&buf->refcnt, 1, __ATOMIC_RELAXED);
+    return buf;
+}
+
+void dma_buf_put(struct dma_buf *buf)
+{
+    if (NULL == buf || __atomic_sub_fetch(&buf->refcnt, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    pthread_mutex_lock(&slab_lock);
+    memset(used + buf->slot, 0, (size_t) buf->nslots);
+    pthread_mutex_unlock(&slab_lock);
+}
+
+int dma_start_buf(struct dma_buf *src, struct dma_buf *dst, u32 len)
+{
+    if (len > src->len || len > dst->len)
+    {
+        fprintf(stderr, "[ERROR] Transfer of %u bytes doesn't fit the DMA buffers\n", len);
+        return FAILURE;
+    }
+    return dma_start_addr(src->paddr, dst->paddr, len);
+}
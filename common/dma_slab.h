@@ -0,0 +1,71 @@
+/**
+ *  dma_slab.h - slot allocator over the reserved DMA buffer.
+ *
+ *  Instead of the fixed psrc/pdest halves, the whole reserved buffer is cut
+ *  into equal, aligned slots. A buffer handle covers one or more adjacent
+ *  slots and carries its physical address, so a finished output buffer can
+ *  be handed to another thread while new transfers use other slots.
+ *
+ *  Author: Hsiang-Ju Lai <happyx94@gmail.com>
+ */
+#ifndef _DMA_SLAB_H
+#define _DMA_SLAB_H
+
+#include "dma_driver.h"
+
+#define DMA_SLAB_MAX_SLOTS  1024
+
+struct dma_buf
+{
+    void *vaddr;    /* user-space address inside the reserved buffer */
+    u32 paddr;      /* physical address for the DMA engine */
+    u32 len;        /* capacity in bytes (a whole number of slots) */
+    int slot;       /* index of the first slot */
+    int nslots;
+    int refcnt;     /* updated atomically; the slots are freed at zero */
+};
+
+/**
+ *  Partition the reserved buffer into slots of slot_len bytes.
+ *  slot_len must be a power of two and at least 4 KB.
+ *  Must be called after dma_init(). psrc and pdest overlap the slots,
+ *  so they must not be used while the allocator is active.
+ * 
+ *  Return: SUCCESS or FAILURE
+ */
+extern int dma_slab_init(u32 slot_len);
+
+/**
+ *  Release the allocator. All handles must have been put.
+ */
+extern void dma_slab_destroy();
+
+/**
+ *  Allocate a buffer of at least len bytes from adjacent free slots.
+ *  The handle starts with a reference count of 1. Thread-safe.
+ * 
+ *  Return: the handle, or NULL if no run of free slots is long enough.
+ */
+extern struct dma_buf *dma_buf_alloc(u32 len);
+
+/**
+ *  Take another reference to buf (e.g. before handing it to a writer thread).
+ * 
+ *  Return: buf
+ */
+extern struct dma_buf *dma_buf_get(struct dma_buf *buf);
+
+/**
+ *  Drop a reference. The slots return to the allocator with the last one.
+ */
+extern void dma_buf_put(struct dma_buf *buf);
+
+/**
+ *  Start a transfer of len bytes from src into dst. Like dma_start(),
+ *  it doesn't sync.
+ * 
+ *  Return: SUCCESS or FAILURE
+ */
+extern int dma_start_buf(struct dma_buf *src, struct dma_buf *dst, u32 len);
+
+#endif
@@ -0,0 +1,176 @@
+/*
+ * File name: profile.c
+ * Version: 1.0
+ * Author: Hsiang-Ju Lai
+ * Description:
+ *  Loads and saves the tuning profile. Lines are "key value"; blank lines
+ *  and lines starting with '#' are ignored. Unknown keys are kept, so
+ *  tools that tune different things can share one file. Entries that
+ *  came from the system profile, and were not changed, are not copied
+ *  into the user profile, so later changes to the system one still show.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "profile.h"
+
+#define PROFILE_MAX_ENTRIES 64
+#define PROFILE_KEY_LEN     64
+#define PROFILE_VALUE_LEN   128
+
+static struct
+{
+    char key[PROFILE_KEY_LEN];
+    char value[PROFILE_VALUE_LEN];
+    int system;     /* as read from PROFILE_SYSTEM_PATH */
+} entries[PROFILE_MAX_ENTRIES];
+static int nentries;
+static int loaded;
+static char path[PATH_MAX];     /* where the profile was read from */
+
+static int user_path(char *buf, size_t len)
+{
+    const char *home = getenv("HOME");
+
+    if (NULL == home || '\0' == home[0])
+        return -1;
+    return snprintf(buf, len, "%s/%s", home, PROFILE_USER_NAME) < (int) len ? 0 : -1;
+}
+
+static int set_entry(const char *key, const char *value, int system)
+{
+    int i;
+
+    for (i = 0; i < nentries; i++)
+        if (0 == strcmp(entries[i].key, key))
+            break;
+    if (i == nentries)
+    {
+        if (nentries == PROFILE_MAX_ENTRIES)
+            return -1;
+        nentries++;
+    }
+    snprintf(entries[i].key, sizeof(entries[i].key), "%s", key);
+    snprintf(entries[i].value, sizeof(entries[i].value), "%s", value);
+    entries[i].system = system;
+    return 0;
+}
+
+static int read_profile(const char *file, int system)
+{
+    FILE *fp = fopen(file, "r");
+    char line[PROFILE_KEY_LEN + PROFILE_VALUE_LEN + 8];
+    char key[PROFILE_KEY_LEN], value[PROFILE_VALUE_LEN];
+
+    if (NULL == fp)
+        return -1;
+    while (fgets(line, sizeof(line), fp))
+    {
+        if ('#' == line[strspn(line, " \t")] || sscanf(line, "%63s %127s", key, value) != 2)
+            continue;
+        set_entry(key, value, system);
+    }
+    fclose(fp);
+    snprintf(path, sizeof(path), "%s", file);
+    return 0;
+}
+
+int profile_load()
+{
+    const char *env = getenv("AES128_PROFILE");
+    char user[PATH_MAX];
+
+    if (loaded)
+        return path[0] ? 0 : -1;
+    loaded = 1;
+
+    if (env)
+        return read_profile(env, 0);
+
+    /* The user profile overrides the system one key by key */
+    read_profile(PROFILE_SYSTEM_PATH, 1);
+    if (0 == user_path(user, sizeof(user)))
+        read_profile(user, 0);
+    return path[0] ? 0 : -1;
+}
+
+const char *profile_get(const char *key)
+{
+    for (int i = 0; i < nentries; i++)
+        if (0 == strcmp(entries[i].key, key))
+            return entries[i].value;
+    return NULL;
+}
+
+uint32_t profile_get_u32(const char *key, uint32_t def)
+{
+    const char *v = profile_get(key);
+    char *end;
+    unsigned long n;
+
+    if (NULL == v)
+        return def;
+    n = strtoul(v, &end, 0);
+    return (end == v || *end != '\0') ? def : (uint32_t) n;
+}
+
+int profile_set(const char *key, const char *value)
+{
+    /* Read the file first, so saving keeps what others have tuned */
+    if (!loaded)
+        profile_load();
+    return set_entry(key, value, 0);
+}
+
+int profile_set_u32(const char *key, uint32_t value)
+{
+    char buf[16];
+
+    snprintf(buf, sizeof(buf), "%u", value);
+    return profile_set(key, buf);
+}
+
+static int write_profile(const char *file)
+{
+    char tmp[PATH_MAX];
+    FILE *fp;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.%d", file, (int) getpid()) >= (int) sizeof(tmp)
+        || NULL == (fp = fopen(tmp, "w")))
+        return -1;
+    fprintf(fp, "# aes128 tuning profile\n");
+    for (int i = 0; i < nentries; i++)
+        if (!entries[i].system)
+            fprintf(fp, "%s %s\n", entries[i].key, entries[i].value);
+    if (0 != fclose(fp) || 0 != rename(tmp, file))
+    {
+        unlink(tmp);
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s", file);
+    fprintf(stderr, "[INFO] Profile saved to %s\n", file);
+    return 0;
+}
+
+int profile_save()
+{
+    const char *env = getenv("AES128_PROFILE");
+    char user[PATH_MAX];
+
+    /* The system profile is only read; an admin installs it by copying one.
+     * Its unchanged entries are left out of the user profile. */
+    profile_load();
+    if (env)
+    {
+        if (0 == write_profile(env))
+            return 0;
+    }
+    else if (0 == user_path(user, sizeof(user)) && 0 == write_profile(user))
+        return 0;
+    perror("Failed to save the profile");
+    return -1;
+}
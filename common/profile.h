@@ -0,0 +1,54 @@
+/**
+ *  profile.h - per-deployment tuning profile.
+ *
+ *  A small "key value" text file holding what was measured on this
+ *  board, e.g. the best DMA chunk size, so later runs can use it by
+ *  default. It is read from $AES128_PROFILE if set; otherwise
+ *  /etc/aes128/profile and ~/.aes128_profile are merged, the user file
+ *  winning key by key.
+ *
+ *  Author: Hsiang-Ju Lai <happyx94@gmail.com>
+ */
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+#include <stdint.h>
+
+#define PROFILE_SYSTEM_PATH "/etc/aes128/profile"
+#define PROFILE_USER_NAME   ".aes128_profile"   /* under $HOME */
+
+/**
+ *  Read the profile. Later calls do nothing.
+ *
+ *  Return: 0 if a profile was read, -1 if there is none.
+ */
+extern int profile_load();
+
+/**
+ *  Return: the value of key, or NULL if it is not set.
+ */
+extern const char *profile_get(const char *key);
+
+/**
+ *  Return: the value of key as a number, or def if it is not set.
+ */
+extern uint32_t profile_get_u32(const char *key, uint32_t def);
+
+/**
+ *  Set key to value in memory. profile_save() writes it out.
+ *
+ *  Return: 0, or -1 if the profile is full.
+ */
+extern int profile_set(const char *key, const char *value);
+extern int profile_set_u32(const char *key, uint32_t value);
+
+/**
+ *  Write the profile to $AES128_PROFILE, else ~/.aes128_profile. Entries
+ *  read from PROFILE_SYSTEM_PATH are only written once changed, and the
+ *  system profile itself is never written. The file is replaced atomically.
+ *
+ *  Return: 0 or -1
+ */
+extern int profile_save();
+
+#endif
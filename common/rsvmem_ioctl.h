@@ -0,0 +1,28 @@
+/**
+ *  rsvmem_ioctl.h - ioctl interface of the rsvmem module, shared by the
+ *  kernel module and the user-space DMA driver.
+ *
+ *  Author: Hsiang-Ju Lai <happyx94@gmail.com>
+ */
+#ifndef _RSVMEM_IOCTL_H
+#define _RSVMEM_IOCTL_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define RSVMEM_IOC_MAGIC    'r'
+
+struct rsvmem_alloc
+{
+    __u64 size;     /* in: bytes wanted (rounded up to pages); out: bytes allocated */
+    __u64 phys;     /* out: bus address to program into the DMA */
+};
+
+/**
+ *  Give this open file its own DMA-coherent buffer. Once allocated, mmap()
+ *  and read() on the same descriptor refer to it instead of the shared pool.
+ *  Fails with EBUSY if the descriptor already has one.
+ */
+#define RSVMEM_IOC_ALLOC    _IOWR(RSVMEM_IOC_MAGIC, 1, struct rsvmem_alloc)
+
+#endif
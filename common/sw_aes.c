@@ -39,9 +39,26 @@ NOTE:   String length must be evenly divisible by 16byte (str_len % 16 == 0)
 #include <stdint.h>
 #include <string.h> // CBC mode, for memset
 #include <unistd.h>
+#include <errno.h>
 #include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/random.h>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#if defined(__PCLMUL__)
+#include <wmmintrin.h>
+#endif
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include "sw_aes.h"
+#include "sw_engine.h"
+#include "crc32c.h"
+#include "dma_probe.h"
+#include "trace.h"
 
 /*****************************************************************************/
 /* Defines:                                                                  */
@@ -196,17 +213,20 @@ static void KeyExpansion(uint8_t* RoundKey, const uint8_t* Key)
 void AES_init_ctx(struct AES_ctx* ctx, const uint8_t* key)
 {
     KeyExpansion(ctx->RoundKey, key);
+    ctx->KsLeft = 0;
 }
 
 void AES_init_ctx_iv(struct AES_ctx* ctx, const uint8_t* key, const uint8_t* iv)
 {
     KeyExpansion(ctx->RoundKey, key);
     memcpy(ctx->Iv, iv, AES_BLOCKLEN);
+    ctx->KsLeft = 0;
 }
 
 void AES_ctx_set_iv(struct AES_ctx* ctx, const uint8_t* iv)
 {
     memcpy(ctx->Iv, iv, AES_BLOCKLEN);
+    ctx->KsLeft = 0;
 }
 
 
@@ -425,7 +445,7 @@ static void XorWithIv(uint8_t* buf, uint8_t* Iv)
     }
 }
 
-void AES_CBC_encrypt_buffer(struct AES_ctx *ctx, uint8_t* buf, uint32_t length)
+void AES_CBC_encrypt_buffer_bytewise(struct AES_ctx *ctx, uint8_t* buf, uint32_t length)
 {
     uintptr_t i;
     uint8_t *Iv = ctx->Iv;
@@ -440,7 +460,7 @@ void AES_CBC_encrypt_buffer(struct AES_ctx *ctx, uint8_t* buf, uint32_t length)
     memcpy(ctx->Iv, Iv, AES_BLOCKLEN);
 }
 
-void AES_CBC_decrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, uint32_t length)
+void AES_CBC_decrypt_buffer_bytewise(struct AES_ctx* ctx, uint8_t* buf, uint32_t length)
 {
     uintptr_t i;
     uint8_t storeNextIv[AES_BLOCKLEN];
@@ -454,28 +474,530 @@ void AES_CBC_decrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, uint32_t length)
     }
 }
 
-static inline void reverse_bytes(void *in, size_t size)
+void AES_ECB_encrypt_blocks_bytewise(const uint8_t* RoundKey, uint8_t* buf, size_t nblocks)
+{
+    size_t i;
+    for (i = 0; i < nblocks; ++i)
+        Cipher((state_t*)(buf + i * AES_BLOCKLEN), (uint8_t*)RoundKey);
+}
+
+void AES_CBC_encrypt_buffer(struct AES_ctx *ctx, uint8_t* buf, uint32_t length)
+{
+    sw_engine_get(SW_MODE_CBC_ENC)->cbc_encrypt(ctx, buf, length);
+}
+
+void AES_CBC_decrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, uint32_t length)
+{
+    sw_engine_get(SW_MODE_CBC_DEC)->cbc_decrypt(ctx, buf, length);
+}
+
+/*****************************************************************************/
+/* CTR mode:                                                                 */
+/*****************************************************************************/
+
+// Number of counter blocks whose keystream is generated before it is XORed
+// into the data, so the XOR runs over a whole batch with word-wide operations
+// and the engine gets enough blocks to interleave.
+#define CTR_BATCH_BLOCKS 16
+
+// Minimum amount of data worth handing to an extra thread.
+#define CTR_MIN_BYTES_PER_THREAD (64 * 1024)
+
+// Add n to the 128-bit big-endian counter.
+static void CtrAdd(uint8_t* ctr, uint64_t n)
+{
+    int i;
+    for (i = AES_BLOCKLEN - 1; i >= 0 && n > 0; --i)
+    {
+        n += ctr[i];
+        ctr[i] = (uint8_t) n;
+        n >>= 8;
+    }
+}
+
+static void CtrXcrypt(const uint8_t* RoundKey, uint8_t* ctr, uint8_t* buf, size_t length)
+{
+    uint8_t keystream[CTR_BATCH_BLOCKS * AES_BLOCKLEN];
+    const struct sw_engine* engine = sw_engine_get(SW_MODE_CTR);
+    size_t i, j, n;
+
+    while (length > 0)
+    {
+        n = length < sizeof(keystream) ? length : sizeof(keystream);
+        for (i = 0; i < n; i += AES_BLOCKLEN)
+        {
+            memcpy(keystream + i, ctr, AES_BLOCKLEN);
+            CtrAdd(ctr, 1);
+        }
+        engine->ecb_encrypt(RoundKey, keystream, (n + AES_BLOCKLEN - 1) / AES_BLOCKLEN);
+
+        if (n == sizeof(keystream))
+        {
+            for (j = 0; j < n; j += sizeof(uint64_t))
+            {
+                uint64_t a, b;
+                memcpy(&a, buf + j, sizeof(a));
+                memcpy(&b, keystream + j, sizeof(b));
+                a ^= b;
+                memcpy(buf + j, &a, sizeof(a));
+            }
+        }
+        else
+        {
+            for (j = 0; j < n; ++j)
+                buf[j] ^= keystream[j];
+        }
+        buf += n;
+        length -= n;
+    }
+}
+
+// XOR what is left of the keystream from the previous call's partial block.
+// Return: the number of bytes consumed.
+static size_t CtrUseLeftover(struct AES_ctx* ctx, uint8_t* buf, size_t length)
+{
+    size_t i, n = length < ctx->KsLeft ? length : ctx->KsLeft;
+    const uint8_t* ks = ctx->Ks + AES_BLOCKLEN - ctx->KsLeft;
+
+    for (i = 0; i < n; ++i)
+        buf[i] ^= ks[i];
+    ctx->KsLeft -= (uint8_t) n;
+    return n;
+}
+
+// Start a new counter block for the last length (< AES_BLOCKLEN) bytes and
+// keep the rest of its keystream for the next call.
+static void CtrStartTail(struct AES_ctx* ctx, uint8_t* buf, size_t length)
+{
+    size_t i;
+
+    if (0 == length)
+        return;
+    memcpy(ctx->Ks, ctx->Iv, AES_BLOCKLEN);
+    CtrAdd(ctx->Iv, 1);
+    sw_engine_get(SW_MODE_CTR)->ecb_encrypt(ctx->RoundKey, ctx->Ks, 1);
+    for (i = 0; i < length; ++i)
+        buf[i] ^= ctx->Ks[i];
+    ctx->KsLeft = (uint8_t) (AES_BLOCKLEN - length);
+}
+
+void AES_CTR_xcrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, uint32_t length)
+{
+    size_t used = CtrUseLeftover(ctx, buf, length);
+    size_t whole = (length - used) & ~(size_t) (AES_BLOCKLEN - 1);
+
+    CtrXcrypt(ctx->RoundKey, ctx->Iv, buf + used, whole);
+    CtrStartTail(ctx, buf + used + whole, length - used - whole);
+}
+
+struct ctr_job
+{
+    const uint8_t* RoundKey;
+    uint8_t ctr[AES_BLOCKLEN];
+    uint8_t* buf;
+    size_t length;
+};
+
+static void* CtrWorker(void* arg)
+{
+    struct ctr_job* job = arg;
+    CtrXcrypt(job->RoundKey, job->ctr, job->buf, job->length);
+    return NULL;
+}
+
+void AES_CTR_xcrypt_buffer_mt(struct AES_ctx* ctx, uint8_t* buf, uint32_t length, int nthreads)
+{
+    struct ctr_job jobs[AES_CTR_MAX_THREADS];
+    pthread_t tids[AES_CTR_MAX_THREADS];
+    size_t blocks, per_thread, offset = 0, used, whole;
+    int i, started = 0;
+
+    if (nthreads > AES_CTR_MAX_THREADS)
+        nthreads = AES_CTR_MAX_THREADS;
+    if ((size_t) nthreads > length / CTR_MIN_BYTES_PER_THREAD)
+        nthreads = (int) (length / CTR_MIN_BYTES_PER_THREAD);
+    if (nthreads <= 1)
+    {
+        AES_CTR_xcrypt_buffer(ctx, buf, length);
+        return;
+    }
+
+    /* The threads split the whole blocks; the ends are done here */
+    used = CtrUseLeftover(ctx, buf, length);
+    buf += used;
+    whole = (length - used) & ~(size_t) (AES_BLOCKLEN - 1);
+    blocks = whole / AES_BLOCKLEN;
+    per_thread = blocks / (size_t) nthreads;
+    for (i = 0; i < nthreads; i++)
+    {
+        jobs[i].RoundKey = ctx->RoundKey;
+        memcpy(jobs[i].ctr, ctx->Iv, AES_BLOCKLEN);
+        CtrAdd(jobs[i].ctr, offset / AES_BLOCKLEN);
+        jobs[i].buf = buf + offset;
+        jobs[i].length = (i == nthreads - 1) ? whole - offset : per_thread * AES_BLOCKLEN;
+        offset += jobs[i].length;
+    }
+
+    /* Worker 0 runs on the calling thread */
+    for (i = 1; i < nthreads; i++)
+    {
+        if (0 != pthread_create(&tids[i], NULL, CtrWorker, &jobs[i]))
+            break;
+        started = i;
+    }
+    for (i = started + 1; i < nthreads; i++)
+        CtrWorker(&jobs[i]);
+    CtrWorker(&jobs[0]);
+    for (i = 1; i <= started; i++)
+        pthread_join(tids[i], NULL);
+
+    memcpy(ctx->Iv, jobs[nthreads - 1].ctr, AES_BLOCKLEN);
+    CtrStartTail(ctx, buf + whole, length - used - whole);
+}
+
+/*****************************************************************************/
+/* GCM mode:                                                                 */
+/*****************************************************************************/
+
+#define GET_U32_BE(b, i) \
+    (((uint32_t)(b)[(i)] << 24) | ((uint32_t)(b)[(i) + 1] << 16) | \
+     ((uint32_t)(b)[(i) + 2] << 8) | ((uint32_t)(b)[(i) + 3]))
+
+#define PUT_U32_BE(n, b, i)                 \
+    do {                                    \
+        (b)[(i)]     = (uint8_t)((n) >> 24); \
+        (b)[(i) + 1] = (uint8_t)((n) >> 16); \
+        (b)[(i) + 2] = (uint8_t)((n) >> 8);  \
+        (b)[(i) + 3] = (uint8_t)(n);         \
+    } while (0)
+
+#if defined(__PCLMUL__) && defined(__SSSE3__)
+
+// GF(2^128) multiply with PCLMULQDQ, following the Intel carry-less
+// multiplication white paper (operands and result are byte-reflected).
+static __m128i GfMulPclmul(__m128i a, __m128i b)
+{
+    __m128i t2, t3, t4, t5, t6, t7, t8, t9;
+
+    t3 = _mm_clmulepi64_si128(a, b, 0x00);
+    t4 = _mm_clmulepi64_si128(a, b, 0x10);
+    t5 = _mm_clmulepi64_si128(a, b, 0x01);
+    t6 = _mm_clmulepi64_si128(a, b, 0x11);
+
+    t4 = _mm_xor_si128(t4, t5);
+    t5 = _mm_slli_si128(t4, 8);
+    t4 = _mm_srli_si128(t4, 8);
+    t3 = _mm_xor_si128(t3, t5);
+    t6 = _mm_xor_si128(t6, t4);
+
+    // Shift the 256-bit product left by one bit
+    t7 = _mm_srli_epi32(t3, 31);
+    t8 = _mm_srli_epi32(t6, 31);
+    t3 = _mm_slli_epi32(t3, 1);
+    t6 = _mm_slli_epi32(t6, 1);
+    t9 = _mm_srli_si128(t7, 12);
+    t8 = _mm_slli_si128(t8, 4);
+    t7 = _mm_slli_si128(t7, 4);
+    t3 = _mm_or_si128(t3, t7);
+    t6 = _mm_or_si128(t6, t8);
+    t6 = _mm_or_si128(t6, t9);
+
+    // Reduce modulo x^128 + x^7 + x^2 + x + 1
+    t7 = _mm_slli_epi32(t3, 31);
+    t8 = _mm_slli_epi32(t3, 30);
+    t9 = _mm_slli_epi32(t3, 25);
+    t7 = _mm_xor_si128(t7, t8);
+    t7 = _mm_xor_si128(t7, t9);
+    t8 = _mm_srli_si128(t7, 4);
+    t7 = _mm_slli_si128(t7, 12);
+    t3 = _mm_xor_si128(t3, t7);
+
+    t2 = _mm_srli_epi32(t3, 1);
+    t4 = _mm_srli_epi32(t3, 2);
+    t5 = _mm_srli_epi32(t3, 7);
+    t2 = _mm_xor_si128(t2, t4);
+    t2 = _mm_xor_si128(t2, t5);
+    t2 = _mm_xor_si128(t2, t8);
+    t3 = _mm_xor_si128(t3, t2);
+    return _mm_xor_si128(t6, t3);
+}
+
+static void GhashInit(struct AES_GCM_ctx* ctx)
+{
+    (void) ctx;
+}
+
+// X = (X ^ block) * H
+static void GhashBlock(struct AES_GCM_ctx* ctx, const uint8_t* block)
+{
+    const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i x = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)ctx->X), bswap);
+    __m128i h = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)ctx->H), bswap);
+    __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)block), bswap);
+
+    x = GfMulPclmul(_mm_xor_si128(x, b), h);
+    _mm_storeu_si128((__m128i*)ctx->X, _mm_shuffle_epi8(x, bswap));
+}
+
+#else
+
+// Reduction constants for the 4-bit table method (Shoup's algorithm)
+static const uint64_t GcmLast4[16] = {
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0 };
+
+// Precompute the multiples of H for every 4-bit value.
+static void GhashInit(struct AES_GCM_ctx* ctx)
+{
+    uint64_t vh, vl;
+    int i, j;
+
+    vh = ((uint64_t) GET_U32_BE(ctx->H, 0) << 32) | GET_U32_BE(ctx->H, 4);
+    vl = ((uint64_t) GET_U32_BE(ctx->H, 8) << 32) | GET_U32_BE(ctx->H, 12);
+
+    ctx->HL[8] = vl;
+    ctx->HH[8] = vh;
+    ctx->HL[0] = 0;
+    ctx->HH[0] = 0;
+
+    for (i = 4; i > 0; i >>= 1)
+    {
+        uint32_t T = (uint32_t) (vl & 1) * 0xe1000000U;
+        vl = (vh << 63) | (vl >> 1);
+        vh = (vh >> 1) ^ ((uint64_t) T << 32);
+        ctx->HL[i] = vl;
+        ctx->HH[i] = vh;
+    }
+
+    for (i = 2; i <= 8; i *= 2)
+    {
+        vh = ctx->HH[i];
+        vl = ctx->HL[i];
+        for (j = 1; j < i; j++)
+        {
+            ctx->HH[i + j] = vh ^ ctx->HH[j];
+            ctx->HL[i + j] = vl ^ ctx->HL[j];
+        }
+    }
+}
+
+// X = (X ^ block) * H
+static void GhashBlock(struct AES_GCM_ctx* ctx, const uint8_t* block)
+{
+    uint8_t x[AES_BLOCKLEN];
+    uint64_t zh, zl;
+    uint8_t lo, hi, rem;
+    int i;
+
+    for (i = 0; i < AES_BLOCKLEN; ++i)
+        x[i] = ctx->X[i] ^ block[i];
+
+    lo = x[15] & 0xf;
+    zh = ctx->HH[lo];
+    zl = ctx->HL[lo];
+
+    for (i = 15; i >= 0; i--)
+    {
+        lo = x[i] & 0xf;
+        hi = (x[i] >> 4) & 0xf;
+
+        if (i != 15)
+        {
+            rem = (uint8_t) zl & 0xf;
+            zl = (zh << 60) | (zl >> 4);
+            zh = (zh >> 4) ^ (GcmLast4[rem] << 48);
+            zh ^= ctx->HH[lo];
+            zl ^= ctx->HL[lo];
+        }
+
+        rem = (uint8_t) zl & 0xf;
+        zl = (zh << 60) | (zl >> 4);
+        zh = (zh >> 4) ^ (GcmLast4[rem] << 48);
+        zh ^= ctx->HH[hi];
+        zl ^= ctx->HL[hi];
+    }
+
+    PUT_U32_BE(zh >> 32, ctx->X, 0);
+    PUT_U32_BE(zh, ctx->X, 4);
+    PUT_U32_BE(zl >> 32, ctx->X, 8);
+    PUT_U32_BE(zl, ctx->X, 12);
+}
+
+#endif
+
+// GHASH over data, zero-padding a trailing partial block
+static void GhashUpdate(struct AES_GCM_ctx* ctx, const uint8_t* data, size_t length)
 {
-    unsigned char *start, *end;
+    uint8_t last[AES_BLOCKLEN];
 
-    for ( start = (unsigned char *)in, end = start + size - 1; start < end; ++start, --end )
+    for (; length >= AES_BLOCKLEN; length -= AES_BLOCKLEN, data += AES_BLOCKLEN)
+        GhashBlock(ctx, data);
+    if (length > 0)
     {
-        unsigned char swap = *start;
-        *start = *end;
-        *end = swap;
+        memset(last, 0, AES_BLOCKLEN);
+        memcpy(last, data, length);
+        GhashBlock(ctx, last);
     }
 }
 
-static void reverse_blocks(void *buf, size_t len, size_t block_size)
+// GCM increments only the low 32 bits of the counter block
+static inline void GcmInc32(uint8_t* ctr)
+{
+    uint32_t c = GET_U32_BE(ctr, 12) + 1;
+    PUT_U32_BE(c, ctr, 12);
+}
+
+void AES_GCM_init(struct AES_GCM_ctx* ctx, const uint8_t* key, const uint8_t* iv)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    AES_init_ctx(&ctx->aes, key);
+
+    /* H = E(K, 0^128) */
+    Cipher((state_t*)ctx->H, ctx->aes.RoundKey);
+    GhashInit(ctx);
+
+    /* J0 = IV || 0^31 || 1 for the 96-bit IV */
+    memcpy(ctx->J0, iv, AES_GCM_IVLEN);
+    ctx->J0[AES_BLOCKLEN - 1] = 1;
+    memcpy(ctx->aes.Iv, ctx->J0, AES_BLOCKLEN);
+    GcmInc32(ctx->aes.Iv);
+}
+
+void AES_GCM_aad(struct AES_GCM_ctx* ctx, const uint8_t* aad, uint32_t length)
 {
-    unsigned char *ptr = buf;
+    GhashUpdate(ctx, aad, length);
+    ctx->aad_len += length;
+}
+
+// The keystream generation and GHASH are stitched together so each batch of
+// data is touched once while it is still in cache.
+static void GcmXcrypt(struct AES_GCM_ctx* ctx, uint8_t* buf, uint32_t length, int dec)
+{
+    uint8_t keystream[CTR_BATCH_BLOCKS * AES_BLOCKLEN];
+    size_t i, n;
+
+    ctx->data_len += length;
+    while (length > 0)
+    {
+        n = length < sizeof(keystream) ? length : sizeof(keystream);
+        for (i = 0; i < n; i += AES_BLOCKLEN)
+        {
+            memcpy(keystream + i, ctx->aes.Iv, AES_BLOCKLEN);
+            Cipher((state_t*)(keystream + i), ctx->aes.RoundKey);
+            GcmInc32(ctx->aes.Iv);
+        }
+
+        if (dec)
+            GhashUpdate(ctx, buf, n);
+        for (i = 0; i < n; ++i)
+            buf[i] ^= keystream[i];
+        if (!dec)
+            GhashUpdate(ctx, buf, n);
+
+        buf += n;
+        length -= (uint32_t) n;
+    }
+}
+
+void AES_GCM_encrypt_buffer(struct AES_GCM_ctx* ctx, uint8_t* buf, uint32_t length)
+{
+    GcmXcrypt(ctx, buf, length, 0);
+}
+
+void AES_GCM_decrypt_buffer(struct AES_GCM_ctx* ctx, uint8_t* buf, uint32_t length)
+{
+    GcmXcrypt(ctx, buf, length, 1);
+}
+
+void AES_GCM_finish(struct AES_GCM_ctx* ctx, uint8_t* tag)
+{
+    uint8_t lengths[AES_BLOCKLEN];
+    uint64_t aad_bits = ctx->aad_len * 8, data_bits = ctx->data_len * 8;
+    uint8_t i;
+
+    PUT_U32_BE(aad_bits >> 32, lengths, 0);
+    PUT_U32_BE(aad_bits, lengths, 4);
+    PUT_U32_BE(data_bits >> 32, lengths, 8);
+    PUT_U32_BE(data_bits, lengths, 12);
+    GhashBlock(ctx, lengths);
+
+    /* T = E(K, J0) ^ GHASH */
+    memcpy(tag, ctx->J0, AES_BLOCKLEN);
+    Cipher((state_t*)tag, ctx->aes.RoundKey);
+    for (i = 0; i < AES_BLOCKLEN; ++i)
+        tag[i] ^= ctx->X[i];
+}
+
+// Load a 16-byte block into the state with its byte order reversed.
+// The reversal is fused into the load/store so that -r no longer needs a
+// separate pass over the whole buffer before and after the cipher.
+static inline void LoadBlockReversed(state_t* state, const uint8_t* in)
+{
+#if defined(__SSSE3__)
+    const __m128i rev = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    _mm_storeu_si128((__m128i*)state, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)in), rev));
+#elif defined(__ARM_NEON)
+    uint8x16_t v = vrev64q_u8(vld1q_u8(in));
+    vst1q_u8((uint8_t*)state, vextq_u8(v, v, 8));
+#else
+    uint8_t i;
+    uint8_t* out = (uint8_t*)state;
+    for (i = 0; i < AES_BLOCKLEN; ++i)
+    {
+        out[i] = in[AES_BLOCKLEN - 1 - i];
+    }
+#endif
+}
+
+static inline void StoreBlockReversed(uint8_t* out, const state_t* state)
+{
+    LoadBlockReversed((state_t*)out, (const uint8_t*)state);
+}
+
+// Byte-reversed CBC. Equivalent to reversing every block, running the plain
+// CBC functions above, and reversing every block again, but in one pass.
+void AES_CBC_encrypt_buffer_rev(struct AES_ctx* ctx, uint8_t* buf, uint32_t length)
+{
+    uintptr_t i;
+    state_t state;
+    for (i = 0; i < length; i += AES_BLOCKLEN)
+    {
+        LoadBlockReversed(&state, buf);
+        XorWithIv((uint8_t*)state, ctx->Iv);
+        Cipher(&state, ctx->RoundKey);
+        memcpy(ctx->Iv, state, AES_BLOCKLEN);
+        StoreBlockReversed(buf, &state);
+        buf += AES_BLOCKLEN;
+    }
+}
 
-    for (size_t i = 0; i < len; i += block_size)
+void AES_CBC_decrypt_buffer_rev(struct AES_ctx* ctx, uint8_t* buf, uint32_t length)
+{
+    uintptr_t i;
+    state_t state;
+    uint8_t storeNextIv[AES_BLOCKLEN];
+    for (i = 0; i < length; i += AES_BLOCKLEN)
     {
-        reverse_bytes(ptr + i, block_size);
+        LoadBlockReversed(&state, buf);
+        memcpy(storeNextIv, state, AES_BLOCKLEN);
+        InvCipher(&state, ctx->RoundKey);
+        XorWithIv((uint8_t*)state, ctx->Iv);
+        memcpy(ctx->Iv, storeNextIv, AES_BLOCKLEN);
+        StoreBlockReversed(buf, &state);
+        buf += AES_BLOCKLEN;
     }
 }
 
+typedef void (*cbc_fn_t)(struct AES_ctx* ctx, uint8_t* buf, uint32_t length);
+
+/* Pick the specialized CBC routine once per file instead of per chunk */
+static cbc_fn_t select_cbc_fn(int rev, int dec)
+{
+    if (dec)
+        return rev ? AES_CBC_decrypt_buffer_rev : sw_engine_get(SW_MODE_CBC_DEC)->cbc_decrypt;
+    return rev ? AES_CBC_encrypt_buffer_rev : sw_engine_get(SW_MODE_CBC_ENC)->cbc_encrypt;
+}
+
 
 static int file_cipher(int fdin, int fdout, void *key, void *iv, void *buf, int forced_block_len, int rev, int dec)
 {
@@ -484,12 +1006,24 @@ static int file_cipher(int fdin, int fdout, void *key, void *iv, void *buf, int
     size_t read_len = (size_t) (forced_block_len > 0 ? forced_block_len : 1024 * 1024);
     clock_t start, end;
     double cpu_time_used;
+    cbc_fn_t cbc_fn = select_cbc_fn(rev, dec);
+    uint64_t seq = 0;
 
     AES_init_ctx_iv(&ctx, key, iv);
 
+    if (rev)
+        fprintf(stderr, "[INFO] Reverse the byte-order.\n");
+
     /* Read from infile to buffer, enc/decrypt buffer, and outputs to outfile */
-    while ((cnt = (size_t) read(fdin, buf, read_len)) > 0)
+    for (;;)
     {
+        dma_probe1(sw_read_start, dec);
+        trace_begin(TRACE_READ, seq);
+        if ((cnt = (size_t) read(fdin, buf, read_len)) <= 0)
+        {
+            trace_end(TRACE_READ, seq);
+            break;
+        }
         if (forced_block_len > 0)
         {
             int n_left = (int) (forced_block_len - cnt);
@@ -511,29 +1045,44 @@ static int file_cipher(int fdin, int fdout, void *key, void *iv, void *buf, int
             }
         }
 
-        if (rev)
+
+        dma_probe1(sw_read_done, cnt);
+        trace_end(TRACE_READ, seq);
+
+        /* Checksum the input while it is still hot in the cache */
+        if (checksum_mode & (dec ? CKSUM_CIPHER : CKSUM_PLAIN))
         {
-            fprintf(stderr, "[INFO] Reverse the byte-order.\n");
-            reverse_blocks(buf, cnt, 16);
+            if (dec)
+                checksum_cipher = crc32c_update(checksum_cipher, buf, cnt);
+            else
+                checksum_plain = crc32c_update(checksum_plain, buf, cnt);
         }
 
-
         start = clock();
         /* encryption happens here */
-        if (dec)
-            AES_CBC_decrypt_buffer(&ctx, buf, (uint32_t) cnt);
-        else
-            AES_CBC_encrypt_buffer(&ctx, buf, (uint32_t) cnt);
+        trace_begin(TRACE_CIPHER, seq);
+        cbc_fn(&ctx, buf, (uint32_t) cnt);
+        trace_end(TRACE_CIPHER, seq);
+
+        if (checksum_mode & (dec ? CKSUM_PLAIN : CKSUM_CIPHER))
+        {
+            if (dec)
+                checksum_plain = crc32c_update(checksum_plain, buf, cnt);
+            else
+                checksum_cipher = crc32c_update(checksum_cipher, buf, cnt);
+        }
 
         end = clock();
         cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
         fprintf(stderr, "[TIMING] It takes %lf seconds to %scrypt the file.\n", cpu_time_used, (dec ? "de" : "en"));
 
-        if (rev)
-            reverse_blocks(buf, cnt, 16);
-
         /* Write exactly how many bytes it reads */
-        if (write(fdout, buf, cnt) != cnt)
+        dma_probe1(sw_write_start, cnt);
+        trace_begin(TRACE_WRITE, seq);
+        ssize_t written = write(fdout, buf, cnt);
+        trace_end(TRACE_WRITE, seq++);
+        dma_probe1(sw_write_done, written);
+        if (written != (ssize_t) cnt)
         {
             perror("outfile");
             return -1;
@@ -552,3 +1101,283 @@ int encrypt_file_sw(int fdin, int fdout, void *key, void *iv, void *buf, int rev
 {
     return file_cipher(fdin, fdout, key, iv, buf, forced_block_len, rev, 0);
 }
+
+// Fill buf from the kernel's random pool, for nonces that must never repeat.
+static int random_bytes(uint8_t *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        if ((n = getrandom(buf, len, 0)) < 0)
+        {
+            if (EINTR == errno)
+                continue;
+            perror("getrandom");
+            return -1;
+        }
+        buf += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+// Read len bytes unless EOF comes first. Return: the bytes read, or -1.
+static ssize_t read_header(int fd, uint8_t *buf, size_t len)
+{
+    size_t got = 0;
+    ssize_t n;
+
+    while (got < len)
+    {
+        if ((n = read(fd, buf + got, len - got)) < 0)
+        {
+            if (EINTR == errno)
+                continue;
+            perror("infile");
+            return -1;
+        }
+        if (0 == n)
+            break;
+        got += (size_t) n;
+    }
+    return (ssize_t) got;
+}
+
+// Copy what was staged in fd to fdout, using buf of len bytes.
+static int copy_staged(int fd, int fdout, uint8_t *buf, size_t len)
+{
+    ssize_t n;
+
+    if (lseek(fd, 0, SEEK_SET) < 0)
+    {
+        perror("lseek");
+        return -1;
+    }
+    while ((n = read(fd, buf, len)) > 0)
+        if (write(fdout, buf, (size_t) n) != n)
+        {
+            perror("outfile");
+            return -1;
+        }
+    if (n < 0)
+    {
+        perror("read");
+        return -1;
+    }
+    return 0;
+}
+
+static int file_ctr(int fdin, int fdout, void *key, void *buf, int forced_block_len, int nthreads, int dec)
+{
+    ssize_t n;
+    size_t cnt;
+    struct AES_ctx ctx;
+    size_t read_len = (size_t) (forced_block_len > 0 ? forced_block_len : 1024 * 1024);
+    uint8_t ctr[AES_BLOCKLEN];
+    clock_t start, end;
+    double cpu_time_used;
+
+    /* A fresh initial counter for every file leads the output */
+    if (dec)
+    {
+        if ((n = read_header(fdin, ctr, AES_BLOCKLEN)) < 0)
+            return -1;
+        if (n != AES_BLOCKLEN)
+        {
+            fprintf(stderr, "[ERROR] Input is too short to carry a CTR counter block.\n");
+            return -1;
+        }
+    }
+    else
+    {
+        if (0 != random_bytes(ctr, AES_BLOCKLEN))
+            return -1;
+        if (write(fdout, ctr, AES_BLOCKLEN) != AES_BLOCKLEN)
+        {
+            perror("outfile");
+            return -1;
+        }
+    }
+    AES_init_ctx_iv(&ctx, key, ctr);
+    fprintf(stderr, "[INFO] CTR mode with %d thread(s).\n", nthreads);
+
+    /* CTR needs no padding: every chunk is written back with its exact length */
+    while ((n = read(fdin, buf, read_len)) > 0)
+    {
+        cnt = (size_t) n;
+        while (forced_block_len > 0 && cnt < read_len)
+        {
+            if ((n = read(fdin, ((char *)buf) + cnt, read_len - cnt)) <= 0)
+                break;
+            cnt += (size_t) n;
+        }
+        if (n < 0)
+            break;
+
+        start = clock();
+        AES_CTR_xcrypt_buffer_mt(&ctx, buf, (uint32_t) cnt, nthreads);
+        end = clock();
+        cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
+        fprintf(stderr, "[TIMING] It takes %lf seconds to xcrypt the file.\n", cpu_time_used);
+
+        if (write(fdout, buf, cnt) != (ssize_t) cnt)
+        {
+            perror("outfile");
+            return -1;
+        }
+    }
+    if (n < 0)
+    {
+        perror("infile");
+        return -1;
+    }
+
+    return 0;
+}
+
+int encrypt_file_ctr_sw(int fdin, int fdout, void *key, void *buf, int forced_block_len, int nthreads)
+{
+    return file_ctr(fdin, fdout, key, buf, forced_block_len, nthreads, 0);
+}
+
+int decrypt_file_ctr_sw(int fdin, int fdout, void *key, void *buf, int forced_block_len, int nthreads)
+{
+    return file_ctr(fdin, fdout, key, buf, forced_block_len, nthreads, 1);
+}
+
+static int file_gcm(int fdin, int fdout, void *key, void *buf, int forced_block_len, int dec)
+{
+    ssize_t n;
+    size_t cnt, held = 0, body;
+    struct AES_GCM_ctx ctx;
+    size_t read_len = (size_t) (forced_block_len > 0 ? forced_block_len : 1024 * 1024);
+    uint8_t *p = buf;
+    uint8_t nonce[AES_GCM_IVLEN];
+    uint8_t tag[AES_BLOCKLEN];
+    uint8_t diff = 0;
+    struct stat st;
+    FILE *stage = NULL;
+    int out = fdout, ret = -1;
+
+    /* Up to 31 bytes are held back when decrypting; always read past them */
+    if (read_len < 3 * AES_BLOCKLEN)
+        read_len = 3 * AES_BLOCKLEN;
+
+    /* A fresh nonce for every file leads the output; decryption reads it back */
+    if (dec)
+    {
+        if ((n = read_header(fdin, nonce, AES_GCM_IVLEN)) < 0)
+            return -1;
+        if (n != AES_GCM_IVLEN)
+        {
+            fprintf(stderr, "[ERROR] Input is too short to carry a GCM nonce.\n");
+            return -1;
+        }
+    }
+    else
+    {
+        if (0 != random_bytes(nonce, AES_GCM_IVLEN))
+            return -1;
+        if (write(fdout, nonce, AES_GCM_IVLEN) != AES_GCM_IVLEN)
+        {
+            perror("outfile");
+            return -1;
+        }
+    }
+    AES_GCM_init(&ctx, key, nonce);
+
+    /* Plaintext must not reach a pipe before the tag is checked, so it is
+     * staged in a temporary file. A regular file is written in place; the
+     * caller discards it if this fails. */
+    if (dec && (0 != fstat(fdout, &st) || !S_ISREG(st.st_mode)))
+    {
+        if (NULL == (stage = tmpfile()))
+        {
+            perror("tmpfile");
+            return -1;
+        }
+        out = fileno(stage);
+    }
+
+    /* A partial block (and, when decrypting, the trailing tag) is held back
+     * at the start of buf until the next read or EOF decides its fate. */
+    while ((n = read(fdin, p + held, read_len - held)) > 0)
+    {
+        cnt = held + (size_t) n;
+        body = dec ? (cnt > AES_BLOCKLEN ? cnt - AES_BLOCKLEN : 0) : cnt;
+        body -= body % AES_BLOCKLEN;
+
+        if (dec)
+            AES_GCM_decrypt_buffer(&ctx, p, (uint32_t) body);
+        else
+            AES_GCM_encrypt_buffer(&ctx, p, (uint32_t) body);
+
+        if (write(out, p, body) != (ssize_t) body)
+        {
+            perror("outfile");
+            goto out;
+        }
+        held = cnt - body;
+        memmove(p, p + body, held);
+    }
+    if (n < 0)
+    {
+        perror("infile");
+        goto out;
+    }
+
+    if (dec)
+    {
+        if (held < AES_BLOCKLEN)
+        {
+            fprintf(stderr, "[ERROR] Input is too short to carry a GCM tag.\n");
+            goto out;
+        }
+        held -= AES_BLOCKLEN;
+        AES_GCM_decrypt_buffer(&ctx, p, (uint32_t) held);
+    }
+    else
+        AES_GCM_encrypt_buffer(&ctx, p, (uint32_t) held);
+
+    if (write(out, p, held) != (ssize_t) held)
+    {
+        perror("outfile");
+        goto out;
+    }
+
+    AES_GCM_finish(&ctx, tag);
+    if (!dec)
+    {
+        if (write(fdout, tag, AES_BLOCKLEN) != AES_BLOCKLEN)
+        {
+            perror("outfile");
+            goto out;
+        }
+        ret = 0;
+        goto out;
+    }
+
+    for (int i = 0; i < AES_BLOCKLEN; i++)
+        diff |= tag[i] ^ p[held + i];
+    if (diff)
+    {
+        fprintf(stderr, "[ERROR] GCM tag mismatch. The output must be discarded.\n");
+        goto out;
+    }
+    ret = stage ? copy_staged(out, fdout, p, read_len) : 0;
+out:
+    if (stage)
+        fclose(stage);
+    return ret;
+}
+
+int encrypt_file_gcm_sw(int fdin, int fdout, void *key, void *buf, int forced_block_len)
+{
+    return file_gcm(fdin, fdout, key, buf, forced_block_len, 0);
+}
+
+int decrypt_file_gcm_sw(int fdin, int fdout, void *key, void *buf, int forced_block_len)
+{
+    return file_gcm(fdin, fdout, key, buf, forced_block_len, 1);
+}
@@ -1,16 +1,33 @@
 #ifndef _SW_AES_H_
 #define _SW_AES_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define AES_BLOCKLEN 16 //Block length in bytes AES is 128b block only
 #define AES_KEYLEN 16   // Key length in bytes
 #define AES_keyExpSize 176
 
+#define AES_GCM_IVLEN 12 // GCM uses a 96-bit IV
+
 struct AES_ctx
 {
     uint8_t RoundKey[AES_keyExpSize];
     uint8_t Iv[AES_BLOCKLEN];
+    uint8_t Ks[AES_BLOCKLEN];  // CTR: keystream of the last partial block
+    uint8_t KsLeft;            // CTR: unused bytes at the end of Ks
+};
+
+struct AES_GCM_ctx
+{
+    struct AES_ctx aes;     // aes.Iv is the running counter block
+    uint8_t H[AES_BLOCKLEN];
+    uint8_t J0[AES_BLOCKLEN];
+    uint8_t X[AES_BLOCKLEN]; // GHASH accumulator
+    uint64_t HL[16];        // 4-bit multiples of H (table-driven GHASH)
+    uint64_t HH[16];
+    uint64_t aad_len;
+    uint64_t data_len;
 };
 
 void AES_init_ctx(struct AES_ctx* ctx, const uint8_t* key);
@@ -24,7 +41,48 @@ void AES_ctx_set_iv(struct AES_ctx* ctx, const uint8_t* iv);
 void AES_CBC_encrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, uint32_t length);
 void AES_CBC_decrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, uint32_t length);
 
+// The two above run on the engine picked by sw_engine.h. These are the
+// byte-wise reference it checks the other engines against.
+void AES_CBC_encrypt_buffer_bytewise(struct AES_ctx* ctx, uint8_t* buf, uint32_t length);
+void AES_CBC_decrypt_buffer_bytewise(struct AES_ctx* ctx, uint8_t* buf, uint32_t length);
+void AES_ECB_encrypt_blocks_bytewise(const uint8_t* RoundKey, uint8_t* buf, size_t nblocks);
+
+// Same as above, but every 16-byte block is byte-reversed on the way in and out
+// (the -r convention used to match the axis_aes128 byte order).
+void AES_CBC_encrypt_buffer_rev(struct AES_ctx* ctx, uint8_t* buf, uint32_t length);
+void AES_CBC_decrypt_buffer_rev(struct AES_ctx* ctx, uint8_t* buf, uint32_t length);
+
+// CTR mode: the same call encrypts and decrypts, and length needs no padding.
+// ctx->Iv holds the big-endian counter and is advanced past the data.
+// The unused keystream of a trailing partial block is kept in the ctx, so
+// the data may be fed in pieces of any length.
+void AES_CTR_xcrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, uint32_t length);
+
+// Splits the buffer across up to nthreads threads (the caller included).
+// Small buffers are processed on the calling thread only.
+#define AES_CTR_MAX_THREADS 16
+void AES_CTR_xcrypt_buffer_mt(struct AES_ctx* ctx, uint8_t* buf, uint32_t length, int nthreads);
+
+// GCM mode: call AES_GCM_aad (optional) before any data, then the
+// encrypt/decrypt functions with lengths that are multiples of AES_BLOCKLEN
+// except for the last call, then AES_GCM_finish to get the 16-byte tag.
+// Decryption callers must compare the tag before trusting the plaintext.
+// GHASH uses PCLMULQDQ when built with -mpclmul -mssse3, a 4-bit table otherwise.
+void AES_GCM_init(struct AES_GCM_ctx* ctx, const uint8_t* key, const uint8_t* iv);
+void AES_GCM_aad(struct AES_GCM_ctx* ctx, const uint8_t* aad, uint32_t length);
+void AES_GCM_encrypt_buffer(struct AES_GCM_ctx* ctx, uint8_t* buf, uint32_t length);
+void AES_GCM_decrypt_buffer(struct AES_GCM_ctx* ctx, uint8_t* buf, uint32_t length);
+void AES_GCM_finish(struct AES_GCM_ctx* ctx, uint8_t* tag);
+
 int encrypt_file_sw(int fdin, int fdout, void *key, void *iv, void *buf, int rev, int forced_block_len);
 int decrypt_file_sw(int fdin, int fdout, void *key, void *iv, void *buf, int rev, int forced_block_len);
+// The GCM files are a random 96-bit nonce, the ciphertext, then the tag.
+// Decryption writes nothing to a pipe until the tag matches; a regular
+// output file must be discarded by the caller when it returns -1.
+int encrypt_file_gcm_sw(int fdin, int fdout, void *key, void *buf, int forced_block_len);
+int decrypt_file_gcm_sw(int fdin, int fdout, void *key, void *buf, int forced_block_len);
+// The CTR files are a random 16-byte initial counter, then the ciphertext.
+int encrypt_file_ctr_sw(int fdin, int fdout, void *key, void *buf, int forced_block_len, int nthreads);
+int decrypt_file_ctr_sw(int fdin, int fdout, void *key, void *buf, int forced_block_len, int nthreads);
 
 #endif
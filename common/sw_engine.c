@@ -0,0 +1,507 @@
+/*
+ * File name: sw_engine.c
+ * Version: 1.0
+ * Author: Hsiang-Ju Lai
+ * Description:
+ *  Software AES engines and the startup calibration that picks one per
+ *  mode:
+ *    bytewise - the reference in sw_aes.c, one S-box lookup per byte
+ *    ttable   - 32-bit T-tables, a column per lookup
+ *    aesni    - the x86 AES instructions (built with -maes)
+ *  An engine only wins a mode if its output matches the reference.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#if defined(__AES__) && defined(__SSE2__)
+#include <wmmintrin.h>
+#define SW_ENGINE_AESNI
+#endif
+
+#include "sw_engine.h"
+#include "profile.h"
+
+#define CAL_BYTES       (16 * 1024)     /* buffer each engine is timed on */
+#define CAL_CHECK_BYTES 4096
+#define CAL_MIN_NS      2000000L        /* time each engine for at least this long */
+#define CAL_ROUNDS      3               /* best of */
+
+static const char *mode_names[SW_NMODES] = { "cbc_enc", "cbc_dec", "ctr" };
+
+/* -------------------- bytewise -------------------- */
+
+static int always(void)
+{
+    return 1;
+}
+
+/* -------------------- ttable -------------------- */
+
+static uint8_t sbox[256], rsbox[256];
+static uint32_t Te[4][256], Td[4][256];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+#define ROTL8(x, n)     ((uint8_t) (((x) << (n)) | ((x) >> (8 - (n)))))
+#define ROR32(x, n)     (((x) >> (n)) | ((x) << (32 - (n))))
+#define GETU32(p)       (((uint32_t) (p)[0] << 24) | ((uint32_t) (p)[1] << 16) | ((uint32_t) (p)[2] << 8) | (uint32_t) (p)[3])
+#define PUTU32(p, v)    do { (p)[0] = (uint8_t) ((v) >> 24); (p)[1] = (uint8_t) ((v) >> 16); \
+                             (p)[2] = (uint8_t) ((v) >> 8); (p)[3] = (uint8_t) (v); } while (0)
+
+static uint8_t gmul(uint8_t a, uint8_t b)
+{
+    uint8_t p = 0;
+
+    for (; b; b >>= 1)
+    {
+        if (b & 1)
+            p ^= a;
+        a = (uint8_t) ((a << 1) ^ (a & 0x80 ? 0x1b : 0));
+    }
+    return p;
+}
+
+/* The S-box from the multiplicative inverse (walking the powers of 3) and
+ * the affine map, then the round tables from the S-box */
+static void build_tables(void)
+{
+    uint8_t p = 1, q = 1, x, s, si;
+
+    do
+    {
+        p = (uint8_t) (p ^ (p << 1) ^ (p & 0x80 ? 0x1b : 0));
+        q ^= (uint8_t) (q << 1);
+        q ^= (uint8_t) (q << 2);
+        q ^= (uint8_t) (q << 4);
+        if (q & 0x80)
+            q ^= 0x09;
+        x = (uint8_t) (q ^ ROTL8(q, 1) ^ ROTL8(q, 2) ^ ROTL8(q, 3) ^ ROTL8(q, 4));
+        sbox[p] = x ^ 0x63;
+    } while (p != 1);
+    sbox[0] = 0x63;
+
+    for (int i = 0; i < 256; i++)
+        rsbox[sbox[i]] = (uint8_t) i;
+
+    for (int i = 0; i < 256; i++)
+    {
+        s = sbox[i];
+        si = rsbox[i];
+        Te[0][i] = ((uint32_t) gmul(s, 2) << 24) | ((uint32_t) s << 16) | ((uint32_t) s << 8) | gmul(s, 3);
+        Td[0][i] = ((uint32_t) gmul(si, 14) << 24) | ((uint32_t) gmul(si, 9) << 16)
+                   | ((uint32_t) gmul(si, 13) << 8) | gmul(si, 11);
+        for (int t = 1; t < 4; t++)
+        {
+            Te[t][i] = ROR32(Te[0][i], 8 * t);
+            Td[t][i] = ROR32(Td[0][i], 8 * t);
+        }
+    }
+}
+
+static void tt_encrypt_block(const uint32_t *rk, const uint8_t *in, uint8_t *out)
+{
+    uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+
+    s0 = GETU32(in) ^ rk[0];
+    s1 = GETU32(in + 4) ^ rk[1];
+    s2 = GETU32(in + 8) ^ rk[2];
+    s3 = GETU32(in + 12) ^ rk[3];
+    for (int r = 1; r < 10; r++)
+    {
+        rk += 4;
+        t0 = Te[0][s0 >> 24] ^ Te[1][(s1 >> 16) & 0xff] ^ Te[2][(s2 >> 8) & 0xff] ^ Te[3][s3 & 0xff] ^ rk[0];
+        t1 = Te[0][s1 >> 24] ^ Te[1][(s2 >> 16) & 0xff] ^ Te[2][(s3 >> 8) & 0xff] ^ Te[3][s0 & 0xff] ^ rk[1];
+        t2 = Te[0][s2 >> 24] ^ Te[1][(s3 >> 16) & 0xff] ^ Te[2][(s0 >> 8) & 0xff] ^ Te[3][s1 & 0xff] ^ rk[2];
+        t3 = Te[0][s3 >> 24] ^ Te[1][(s0 >> 16) & 0xff] ^ Te[2][(s1 >> 8) & 0xff] ^ Te[3][s2 & 0xff] ^ rk[3];
+        s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+    }
+    rk += 4;
+    t0 = ((uint32_t) sbox[s0 >> 24] << 24) ^ ((uint32_t) sbox[(s1 >> 16) & 0xff] << 16)
+         ^ ((uint32_t) sbox[(s2 >> 8) & 0xff] << 8) ^ sbox[s3 & 0xff] ^ rk[0];
+    t1 = ((uint32_t) sbox[s1 >> 24] << 24) ^ ((uint32_t) sbox[(s2 >> 16) & 0xff] << 16)
+         ^ ((uint32_t) sbox[(s3 >> 8) & 0xff] << 8) ^ sbox[s0 & 0xff] ^ rk[1];
+    t2 = ((uint32_t) sbox[s2 >> 24] << 24) ^ ((uint32_t) sbox[(s3 >> 16) & 0xff] << 16)
+         ^ ((uint32_t) sbox[(s0 >> 8) & 0xff] << 8) ^ sbox[s1 & 0xff] ^ rk[2];
+    t3 = ((uint32_t) sbox[s3 >> 24] << 24) ^ ((uint32_t) sbox[(s0 >> 16) & 0xff] << 16)
+         ^ ((uint32_t) sbox[(s1 >> 8) & 0xff] << 8) ^ sbox[s2 & 0xff] ^ rk[3];
+    PUTU32(out, t0);
+    PUTU32(out + 4, t1);
+    PUTU32(out + 8, t2);
+    PUTU32(out + 12, t3);
+}
+
+static void tt_decrypt_block(const uint32_t *dk, const uint8_t *in, uint8_t *out)
+{
+    uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+
+    s0 = GETU32(in) ^ dk[0];
+    s1 = GETU32(in + 4) ^ dk[1];
+    s2 = GETU32(in + 8) ^ dk[2];
+    s3 = GETU32(in + 12) ^ dk[3];
+    for (int r = 1; r < 10; r++)
+    {
+        dk += 4;
+        t0 = Td[0][s0 >> 24] ^ Td[1][(s3 >> 16) & 0xff] ^ Td[2][(s2 >> 8) & 0xff] ^ Td[3][s1 & 0xff] ^ dk[0];
+        t1 = Td[0][s1 >> 24] ^ Td[1][(s0 >> 16) & 0xff] ^ Td[2][(s3 >> 8) & 0xff] ^ Td[3][s2 & 0xff] ^ dk[1];
+        t2 = Td[0][s2 >> 24] ^ Td[1][(s1 >> 16) & 0xff] ^ Td[2][(s0 >> 8) & 0xff] ^ Td[3][s3 & 0xff] ^ dk[2];
+        t3 = Td[0][s3 >> 24] ^ Td[1][(s2 >> 16) & 0xff] ^ Td[2][(s1 >> 8) & 0xff] ^ Td[3][s0 & 0xff] ^ dk[3];
+        s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+    }
+    dk += 4;
+    t0 = ((uint32_t) rsbox[s0 >> 24] << 24) ^ ((uint32_t) rsbox[(s3 >> 16) & 0xff] << 16)
+         ^ ((uint32_t) rsbox[(s2 >> 8) & 0xff] << 8) ^ rsbox[s1 & 0xff] ^ dk[0];
+    t1 = ((uint32_t) rsbox[s1 >> 24] << 24) ^ ((uint32_t) rsbox[(s0 >> 16) & 0xff] << 16)
+         ^ ((uint32_t) rsbox[(s3 >> 8) & 0xff] << 8) ^ rsbox[s2 & 0xff] ^ dk[1];
+    t2 = ((uint32_t) rsbox[s2 >> 24] << 24) ^ ((uint32_t) rsbox[(s1 >> 16) & 0xff] << 16)
+         ^ ((uint32_t) rsbox[(s0 >> 8) & 0xff] << 8) ^ rsbox[s3 & 0xff] ^ dk[2];
+    t3 = ((uint32_t) rsbox[s3 >> 24] << 24) ^ ((uint32_t) rsbox[(s2 >> 16) & 0xff] << 16)
+         ^ ((uint32_t) rsbox[(s1 >> 8) & 0xff] << 8) ^ rsbox[s0 & 0xff] ^ dk[3];
+    PUTU32(out, t0);
+    PUTU32(out + 4, t1);
+    PUTU32(out + 8, t2);
+    PUTU32(out + 12, t3);
+}
+
+static void tt_enc_key(const uint8_t *round_key, uint32_t *rk)
+{
+    for (int i = 0; i < 44; i++)
+        rk[i] = GETU32(round_key + 4 * i);
+}
+
+/* Equivalent inverse cipher: round keys in reverse, the inner ones
+ * through InvMixColumns */
+static void tt_dec_key(const uint8_t *round_key, uint32_t *dk)
+{
+    uint32_t w;
+
+    for (int r = 0; r <= 10; r++)
+        for (int i = 0; i < 4; i++)
+        {
+            w = GETU32(round_key + 16 * (10 - r) + 4 * i);
+            if (r > 0 && r < 10)
+                w = Td[0][sbox[w >> 24]] ^ Td[1][sbox[(w >> 16) & 0xff]]
+                    ^ Td[2][sbox[(w >> 8) & 0xff]] ^ Td[3][sbox[w & 0xff]];
+            dk[4 * r + i] = w;
+        }
+}
+
+static int tt_available(void)
+{
+    pthread_once(&tables_once, build_tables);
+    return 1;
+}
+
+static void tt_cbc_encrypt(struct AES_ctx *ctx, uint8_t *buf, uint32_t length)
+{
+    uint32_t rk[44];
+    const uint8_t *iv = ctx->Iv;
+
+    tt_enc_key(ctx->RoundKey, rk);
+    for (uint32_t i = 0; i < length; i += AES_BLOCKLEN, buf += AES_BLOCKLEN)
+    {
+        for (int j = 0; j < AES_BLOCKLEN; j++)
+            buf[j] ^= iv[j];
+        tt_encrypt_block(rk, buf, buf);
+        iv = buf;
+    }
+    memmove(ctx->Iv, iv, AES_BLOCKLEN);
+}
+
+static void tt_cbc_decrypt(struct AES_ctx *ctx, uint8_t *buf, uint32_t length)
+{
+    uint32_t dk[44];
+    uint8_t next[AES_BLOCKLEN];
+
+    tt_dec_key(ctx->RoundKey, dk);
+    for (uint32_t i = 0; i < length; i += AES_BLOCKLEN, buf += AES_BLOCKLEN)
+    {
+        memcpy(next, buf, AES_BLOCKLEN);
+        tt_decrypt_block(dk, buf, buf);
+        for (int j = 0; j < AES_BLOCKLEN; j++)
+            buf[j] ^= ctx->Iv[j];
+        memcpy(ctx->Iv, next, AES_BLOCKLEN);
+    }
+}
+
+static void tt_ecb_encrypt(const uint8_t *round_key, uint8_t *blocks, size_t nblocks)
+{
+    uint32_t rk[44];
+
+    tt_enc_key(round_key, rk);
+    for (size_t i = 0; i < nblocks; i++)
+        tt_encrypt_block(rk, blocks + i * AES_BLOCKLEN, blocks + i * AES_BLOCKLEN);
+}
+
+/* -------------------- aesni -------------------- */
+
+#ifdef SW_ENGINE_AESNI
+
+static int ni_available(void)
+{
+    return __builtin_cpu_supports("aes");
+}
+
+static void ni_load_key(const uint8_t *round_key, __m128i *k)
+{
+    for (int i = 0; i <= 10; i++)
+        k[i] = _mm_loadu_si128((const __m128i *) (round_key + 16 * i));
+}
+
+static inline __m128i ni_encrypt(const __m128i *k, __m128i x)
+{
+    x = _mm_xor_si128(x, k[0]);
+    for (int r = 1; r < 10; r++)
+        x = _mm_aesenc_si128(x, k[r]);
+    return _mm_aesenclast_si128(x, k[10]);
+}
+
+static void ni_cbc_encrypt(struct AES_ctx *ctx, uint8_t *buf, uint32_t length)
+{
+    __m128i k[11], iv = _mm_loadu_si128((const __m128i *) ctx->Iv);
+
+    ni_load_key(ctx->RoundKey, k);
+    for (uint32_t i = 0; i < length; i += AES_BLOCKLEN)
+    {
+        iv = ni_encrypt(k, _mm_xor_si128(_mm_loadu_si128((const __m128i *) (buf + i)), iv));
+        _mm_storeu_si128((__m128i *) (buf + i), iv);
+    }
+    _mm_storeu_si128((__m128i *) ctx->Iv, iv);
+}
+
+/* Blocks are independent when decrypting, so four are kept in flight */
+static void ni_cbc_decrypt(struct AES_ctx *ctx, uint8_t *buf, uint32_t length)
+{
+    __m128i k[11], dk[11], iv = _mm_loadu_si128((const __m128i *) ctx->Iv);
+    __m128i c[4], x[4];
+    uint32_t i = 0;
+    int j, r;
+
+    ni_load_key(ctx->RoundKey, k);
+    dk[0] = k[10];
+    for (r = 1; r < 10; r++)
+        dk[r] = _mm_aesimc_si128(k[10 - r]);
+    dk[10] = k[0];
+
+    for (; i + 4 * AES_BLOCKLEN <= length; i += 4 * AES_BLOCKLEN)
+    {
+        for (j = 0; j < 4; j++)
+        {
+            c[j] = _mm_loadu_si128((const __m128i *) (buf + i + j * AES_BLOCKLEN));
+            x[j] = _mm_xor_si128(c[j], dk[0]);
+        }
+        for (r = 1; r < 10; r++)
+            for (j = 0; j < 4; j++)
+                x[j] = _mm_aesdec_si128(x[j], dk[r]);
+        for (j = 0; j < 4; j++)
+        {
+            x[j] = _mm_xor_si128(_mm_aesdeclast_si128(x[j], dk[10]), j ? c[j - 1] : iv);
+            _mm_storeu_si128((__m128i *) (buf + i + j * AES_BLOCKLEN), x[j]);
+        }
+        iv = c[3];
+    }
+    for (; i < length; i += AES_BLOCKLEN)
+    {
+        c[0] = _mm_loadu_si128((const __m128i *) (buf + i));
+        x[0] = _mm_xor_si128(c[0], dk[0]);
+        for (r = 1; r < 10; r++)
+            x[0] = _mm_aesdec_si128(x[0], dk[r]);
+        _mm_storeu_si128((__m128i *) (buf + i), _mm_xor_si128(_mm_aesdeclast_si128(x[0], dk[10]), iv));
+        iv = c[0];
+    }
+    _mm_storeu_si128((__m128i *) ctx->Iv, iv);
+}
+
+static void ni_ecb_encrypt(const uint8_t *round_key, uint8_t *blocks, size_t nblocks)
+{
+    __m128i k[11];
+
+    ni_load_key(round_key, k);
+    for (size_t i = 0; i < nblocks; i++)
+        _mm_storeu_si128((__m128i *) (blocks + i * AES_BLOCKLEN),
+                         ni_encrypt(k, _mm_loadu_si128((const __m128i *) (blocks + i * AES_BLOCKLEN))));
+}
+
+#endif
+
+/* -------------------- dispatcher -------------------- */
+
+static const struct sw_engine engines[] =
+{
+    { "bytewise", always, AES_CBC_encrypt_buffer_bytewise, AES_CBC_decrypt_buffer_bytewise,
+      AES_ECB_encrypt_blocks_bytewise },
+    { "ttable", tt_available, tt_cbc_encrypt, tt_cbc_decrypt, tt_ecb_encrypt },
+#ifdef SW_ENGINE_AESNI
+    { "aesni", ni_available, ni_cbc_encrypt, ni_cbc_decrypt, ni_ecb_encrypt },
+#endif
+};
+#define NENGINES ((int) (sizeof(engines) / sizeof(engines[0])))
+
+static const struct sw_engine *chosen[SW_NMODES];
+static pthread_once_t chosen_once = PTHREAD_ONCE_INIT;
+static int forced;          /* set by sw_engine_force() */
+static int recalibrate;
+
+static const struct sw_engine *find_engine(const char *name)
+{
+    for (int i = 0; name && i < NENGINES; i++)
+        if (0 == strcmp(engines[i].name, name))
+            return engines[i].available() ? &engines[i] : NULL;
+    return NULL;
+}
+
+static void run_mode(const struct sw_engine *e, int mode, struct AES_ctx *ctx, uint8_t *buf, uint32_t len)
+{
+    if (SW_MODE_CBC_ENC == mode)
+        e->cbc_encrypt(ctx, buf, len);
+    else if (SW_MODE_CBC_DEC == mode)
+        e->cbc_decrypt(ctx, buf, len);
+    else
+        e->ecb_encrypt(ctx->RoundKey, buf, len / AES_BLOCKLEN);
+}
+
+static long elapsed_ns(const struct timespec *a, const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) * 1000000000L + (b->tv_nsec - a->tv_nsec);
+}
+
+/* Return: MB/s, or 0 if the engine's output differs from the reference */
+static double bench(const struct sw_engine *e, int mode, uint8_t *buf, const uint8_t *data)
+{
+    struct AES_ctx ref, ctx;
+    uint8_t key[AES_KEYLEN], iv[AES_BLOCKLEN];
+    struct timespec t0, t1;
+    double best = 0, rate;
+    long ns;
+    int reps;
+
+    for (int i = 0; i < AES_BLOCKLEN; i++)
+    {
+        key[i] = data[i];
+        iv[i] = data[AES_BLOCKLEN + i];
+    }
+    AES_init_ctx_iv(&ref, key, iv);
+    ctx = ref;
+    memcpy(buf, data, CAL_CHECK_BYTES);
+    memcpy(buf + CAL_CHECK_BYTES, data, CAL_CHECK_BYTES);
+    run_mode(&engines[0], mode, &ref, buf, CAL_CHECK_BYTES);
+    run_mode(e, mode, &ctx, buf + CAL_CHECK_BYTES, CAL_CHECK_BYTES);
+    if (memcmp(buf, buf + CAL_CHECK_BYTES, CAL_CHECK_BYTES)
+        || (SW_MODE_CTR != mode && memcmp(ref.Iv, ctx.Iv, AES_BLOCKLEN)))
+    {
+        fprintf(stderr, "[INFO] Engine %s gives wrong %s results. Not using it.\n", e->name, mode_names[mode]);
+        return 0;
+    }
+
+    for (int round = 0; round < CAL_ROUNDS; round++)
+    {
+        reps = 0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        do
+        {
+            run_mode(e, mode, &ctx, buf, CAL_BYTES);
+            reps++;
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+        } while ((ns = elapsed_ns(&t0, &t1)) < CAL_MIN_NS);
+        rate = (double) CAL_BYTES * reps * 1000.0 / ns;     /* bytes/ns * 1000 == MB/s */
+        if (rate > best)
+            best = rate;
+    }
+    return best;
+}
+
+static void calibrate(int mode)
+{
+    uint8_t *buf = malloc(CAL_BYTES), *data = malloc(CAL_BYTES);
+    double rate, best = 0;
+    uint32_t seed = 1;
+
+    chosen[mode] = &engines[0];
+    if (NULL == buf || NULL == data)
+        goto out;
+    for (int i = 0; i < CAL_BYTES; i++)
+    {
+        /* A local LCG, so the caller's rand() sequence is left alone */
+        seed = seed * 1103515245u + 12345u;
+        data[i] = (uint8_t) (seed >> 24);
+    }
+
+    for (int i = 0; i < NENGINES; i++)
+    {
+        if (!engines[i].available())
+            continue;
+        rate = bench(&engines[i], mode, buf, data);
+        if (recalibrate)
+            fprintf(stderr, "[INFO] %-7s %-8s %8.1f MB/s\n", mode_names[mode], engines[i].name, rate);
+        if (rate > best)
+        {
+            best = rate;
+            chosen[mode] = &engines[i];
+        }
+    }
+out:
+    free(buf);
+    free(data);
+}
+
+static void choose_engines(void)
+{
+    char key[32];
+    int changed = 0;
+
+    if (forced)
+        return;
+    profile_load();
+    for (int m = 0; m < SW_NMODES; m++)
+    {
+        snprintf(key, sizeof(key), "sw.%s", mode_names[m]);
+        if (!recalibrate && NULL != (chosen[m] = find_engine(profile_get(key))))
+            continue;
+
+        /* Not measured yet, or measured on a CPU with other features */
+        calibrate(m);
+        profile_set(key, chosen[m]->name);
+        changed = 1;
+    }
+    fprintf(stderr, "[INFO] Software engines: CBC encryption %s, CBC decryption %s, CTR %s.\n",
+            chosen[SW_MODE_CBC_ENC]->name, chosen[SW_MODE_CBC_DEC]->name, chosen[SW_MODE_CTR]->name);
+    /* Only an explicit "-E auto" writes the profile; otherwise the choice
+     * lives for this process, and library users never touch $HOME */
+    if (changed && recalibrate)
+        profile_save();
+}
+
+const struct sw_engine *sw_engine_get(int mode)
+{
+    pthread_once(&chosen_once, choose_engines);
+    return chosen[mode];
+}
+
+int sw_engine_force(const char *name)
+{
+    const struct sw_engine *e;
+
+    if (0 == strcmp(name, "auto"))
+    {
+        recalibrate = 1;
+        return 0;
+    }
+    if (NULL == (e = find_engine(name)))
+        return -1;
+    for (int m = 0; m < SW_NMODES; m++)
+        chosen[m] = e;
+    forced = 1;
+    return 0;
+}
+
+const char *sw_engine_names()
+{
+    static char names[64];
+
+    if ('\0' == names[0])
+        for (int i = 0; i < NENGINES; i++)
+            snprintf(names + strlen(names), sizeof(names) - strlen(names), "%s%s", i ? " " : "", engines[i].name);
+    return names;
+}
@@ -0,0 +1,59 @@
+/**
+ *  sw_engine.h - software AES engines and the dispatcher that picks one.
+ *
+ *  Each engine implements CBC encryption, CBC decryption and the block
+ *  encryption behind CTR. On first use every engine this CPU can run is
+ *  checked against the byte-wise reference and timed, per mode, unless
+ *  the tuning profile (see profile.h) already names one. The result is
+ *  only saved to the profile when asked for with sw_engine_force("auto"),
+ *  so later runs can skip the benchmark. AES_CBC_encrypt_buffer(),
+ *  AES_CBC_decrypt_buffer() and the CTR functions in sw_aes.h go through
+ *  the selected engine.
+ *
+ *  Author: Hsiang-Ju Lai <happyx94@gmail.com>
+ */
+#ifndef _SW_ENGINE_H
+#define _SW_ENGINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sw_aes.h"
+
+/* Modes an engine is picked for */
+#define SW_MODE_CBC_ENC     0
+#define SW_MODE_CBC_DEC     1
+#define SW_MODE_CTR         2
+#define SW_NMODES           3
+
+struct sw_engine
+{
+    const char *name;
+    int (*available)(void);     /* can this CPU run it? */
+    void (*cbc_encrypt)(struct AES_ctx *ctx, uint8_t *buf, uint32_t length);
+    void (*cbc_decrypt)(struct AES_ctx *ctx, uint8_t *buf, uint32_t length);
+    /* Encrypt nblocks blocks in place, as the CTR keystream */
+    void (*ecb_encrypt)(const uint8_t *round_key, uint8_t *blocks, size_t nblocks);
+};
+
+/**
+ *  Return: the engine for mode (SW_MODE_*). The first call loads the
+ *  choice from the profile, or benchmarks the engines and keeps the
+ *  result in memory. Thread-safe.
+ */
+extern const struct sw_engine *sw_engine_get(int mode);
+
+/**
+ *  Use the engine called name for every mode, instead of the profile.
+ *  "auto" benchmarks again and saves the result.
+ *
+ *  Return: 0, or -1 if there is no such engine or this CPU can't run it.
+ */
+extern int sw_engine_force(const char *name);
+
+/**
+ *  Return: the names of the engines built in, separated by spaces.
+ */
+extern const char *sw_engine_names();
+
+#endif
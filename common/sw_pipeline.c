@@ -0,0 +1,374 @@
+/*
+ * File name: sw_pipeline.c
+ * Version: 1.0
+ * Author: Hsiang-Ju Lai
+ * Description:
+ *  Reader -> cipher -> writer pipeline for the software CBC path. Buffers
+ *  circulate through lock-free SPSC rings and are never copied: the reader
+ *  takes a free one, the cipher works in place and the writer hands it
+ *  back to the reader.
+ *
+ *  With more than one worker (decryption only), the reader deals chunks
+ *  round-robin into per-worker rings and the writer collects them in the
+ *  same order, so every ring keeps a single producer and a single consumer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "sw_aes.h"
+#include "crc32c.h"
+#include "sw_pipeline.h"
+#include "trace.h"
+
+#define PIPELINE_BUFS_PER_WORKER    4
+#define PIPELINE_DEFAULT_LEN        (1024 * 1024)
+#define PIPELINE_SPINS              64      /* yields before sleeping */
+#define PIPELINE_SLEEP_NS           50000
+
+struct segment
+{
+    uint8_t *data;
+    size_t len;
+    uint8_t iv[AES_BLOCKLEN];   /* chaining value before this chunk (decryption) */
+    uint64_t seq;               /* chunk number, for the trace */
+    int eof;
+};
+
+struct spsc_ring
+{
+    _Alignas(64) atomic_size_t head;    /* advanced by the consumer */
+    _Alignas(64) atomic_size_t tail;    /* advanced by the producer */
+    _Alignas(64) size_t mask;
+    struct segment **slots;
+};
+
+struct pipeline
+{
+    int fdin, fdout, rev, dec, nworkers, forced;
+    size_t read_len;
+    uint8_t key[AES_BLOCKLEN];
+    uint8_t iv[AES_BLOCKLEN];
+    atomic_int failed;
+    struct spsc_ring free_ring;                 /* writer -> reader */
+    struct spsc_ring in_ring[PIPELINE_MAX_WORKERS];   /* reader -> worker i */
+    struct spsc_ring out_ring[PIPELINE_MAX_WORKERS];  /* worker i -> writer */
+    struct segment eof_seg[PIPELINE_MAX_WORKERS];
+};
+
+struct worker_arg
+{
+    struct pipeline *p;
+    int id;
+};
+
+static int ring_init(struct spsc_ring *r, size_t min_slots)
+{
+    size_t n = 2;
+
+    while (n < min_slots)
+        n <<= 1;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    r->mask = n - 1;
+    r->slots = calloc(n, sizeof(*r->slots));
+    return NULL == r->slots ? -1 : 0;
+}
+
+static int ring_push(struct spsc_ring *r, struct segment *s)
+{
+    size_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    if (t - atomic_load_explicit(&r->head, memory_order_acquire) > r->mask)
+        return 0;
+    r->slots[t & r->mask] = s;
+    atomic_store_explicit(&r->tail, t + 1, memory_order_release);
+    return 1;
+}
+
+static struct segment *ring_pop(struct spsc_ring *r)
+{
+    size_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+    struct segment *s;
+
+    if (h == atomic_load_explicit(&r->tail, memory_order_acquire))
+        return NULL;
+    s = r->slots[h & r->mask];
+    atomic_store_explicit(&r->head, h + 1, memory_order_release);
+    return s;
+}
+
+/* Spin politely first, then sleep, so an I/O-bound stage doesn't burn a CPU */
+static void backoff(unsigned *spins)
+{
+    struct timespec ts = { 0, PIPELINE_SLEEP_NS };
+
+    if (++*spins < PIPELINE_SPINS)
+        sched_yield();
+    else
+        nanosleep(&ts, NULL);
+}
+
+/* Return NULL only if another stage has failed */
+static struct segment *wait_pop(struct pipeline *p, struct spsc_ring *r)
+{
+    struct segment *s;
+    unsigned spins = 0;
+
+    while (NULL == (s = ring_pop(r)))
+    {
+        if (atomic_load(&p->failed))
+            return NULL;
+        backoff(&spins);
+    }
+    return s;
+}
+
+static void wait_push(struct pipeline *p, struct spsc_ring *r, struct segment *s)
+{
+    unsigned spins = 0;
+
+    while (!ring_push(r, s))
+    {
+        if (atomic_load(&p->failed))
+            return;
+        backoff(&spins);
+    }
+}
+
+static void *reader_stage(void *arg)
+{
+    struct pipeline *p = arg;
+    uint8_t chain[AES_BLOCKLEN];
+    struct segment *seg;
+    ssize_t n;
+    size_t cnt;
+    uint64_t seq = 0;
+    int w = 0;
+
+    trace_thread_name("reader");
+    memcpy(chain, p->iv, AES_BLOCKLEN);
+    while (NULL != (seg = wait_pop(p, &p->free_ring)))
+    {
+        trace_begin(TRACE_READ, seq);
+        if ((n = read(p->fdin, seg->data, p->read_len)) <= 0)
+        {
+            trace_end(TRACE_READ, seq);
+            if (n < 0)
+            {
+                perror("infile");
+                atomic_store(&p->failed, 1);
+            }
+            break;
+        }
+        cnt = (size_t) n;
+        if (p->forced)
+        {
+            while (cnt < p->read_len && (n = read(p->fdin, seg->data + cnt, p->read_len - cnt)) > 0)
+                cnt += (size_t) n;
+        }
+        for (; cnt % AES_BLOCKLEN != 0; cnt++)
+            seg->data[cnt] = 0;
+        seg->len = cnt;
+        seg->seq = seq;
+        trace_end(TRACE_READ, seq++);
+
+        if (checksum_mode & (p->dec ? CKSUM_CIPHER : CKSUM_PLAIN))
+        {
+            if (p->dec)
+                checksum_cipher = crc32c_update(checksum_cipher, seg->data, cnt);
+            else
+                checksum_plain = crc32c_update(checksum_plain, seg->data, cnt);
+        }
+
+        /* The next chunk chains off this chunk's last ciphertext block */
+        if (p->dec)
+        {
+            const uint8_t *last = seg->data + cnt - AES_BLOCKLEN;
+
+            memcpy(seg->iv, chain, AES_BLOCKLEN);
+            for (int i = 0; i < AES_BLOCKLEN; i++)
+                chain[i] = p->rev ? last[AES_BLOCKLEN - 1 - i] : last[i];
+        }
+
+        wait_push(p, &p->in_ring[w], seg);
+        w = (w + 1) % p->nworkers;
+    }
+
+    for (int i = 0; i < p->nworkers; i++)
+        wait_push(p, &p->in_ring[i], &p->eof_seg[i]);
+    return NULL;
+}
+
+static void *cipher_stage(void *arg)
+{
+    struct worker_arg *wa = arg;
+    struct pipeline *p = wa->p;
+    struct segment *seg;
+    struct AES_ctx ctx;
+    void (*cbc_fn)(struct AES_ctx *, uint8_t *, uint32_t);
+
+    if (p->dec)
+        cbc_fn = p->rev ? AES_CBC_decrypt_buffer_rev : AES_CBC_decrypt_buffer;
+    else
+        cbc_fn = p->rev ? AES_CBC_encrypt_buffer_rev : AES_CBC_encrypt_buffer;
+
+    trace_thread_name("cipher");
+    AES_init_ctx_iv(&ctx, p->key, p->iv);
+    while (NULL != (seg = wait_pop(p, &p->in_ring[wa->id])))
+    {
+        if (!seg->eof)
+        {
+            trace_begin(TRACE_CIPHER, seg->seq);
+            if (p->dec)
+                AES_ctx_set_iv(&ctx, seg->iv);
+            cbc_fn(&ctx, seg->data, (uint32_t) seg->len);
+            trace_end(TRACE_CIPHER, seg->seq);
+        }
+        wait_push(p, &p->out_ring[wa->id], seg);
+        if (seg->eof)
+            break;
+    }
+    return NULL;
+}
+
+static void *writer_stage(void *arg)
+{
+    struct pipeline *p = arg;
+    struct segment *seg;
+    int w = 0;
+
+    trace_thread_name("writer");
+    while (NULL != (seg = wait_pop(p, &p->out_ring[w])) && !seg->eof)
+    {
+        if (checksum_mode & (p->dec ? CKSUM_PLAIN : CKSUM_CIPHER))
+        {
+            if (p->dec)
+                checksum_plain = crc32c_update(checksum_plain, seg->data, seg->len);
+            else
+                checksum_cipher = crc32c_update(checksum_cipher, seg->data, seg->len);
+        }
+
+        trace_begin(TRACE_WRITE, seg->seq);
+        for (size_t done = 0; done < seg->len; )
+        {
+            ssize_t n = write(p->fdout, seg->data + done, seg->len - done);
+            if (n <= 0)
+            {
+                perror("outfile");
+                atomic_store(&p->failed, 1);
+                return NULL;
+            }
+            done += (size_t) n;
+        }
+        trace_end(TRACE_WRITE, seg->seq);
+
+        wait_push(p, &p->free_ring, seg);
+        w = (w + 1) % p->nworkers;
+    }
+    return NULL;
+}
+
+int cipher_file_pipelined(int fdin, int fdout, void *key, void *iv, int rev, int dec,
+                          int forced_block_len, int nworkers)
+{
+    struct pipeline *p;
+    struct segment *segs = NULL;
+    struct worker_arg wargs[PIPELINE_MAX_WORKERS];
+    pthread_t reader, writer, workers[PIPELINE_MAX_WORKERS];
+    int nsegs, nstarted = 0, ret = -1;
+
+    if (NULL == (p = calloc(1, sizeof(*p))))
+        return -1;
+
+    /* Only decryption can run chunks in parallel */
+    if (!dec || nworkers < 1)
+        nworkers = 1;
+    if (nworkers > PIPELINE_MAX_WORKERS)
+        nworkers = PIPELINE_MAX_WORKERS;
+    p->fdin = fdin;
+    p->fdout = fdout;
+    p->rev = rev;
+    p->dec = dec;
+    p->nworkers = nworkers;
+    p->forced = forced_block_len > 0;
+    p->read_len = (size_t) (forced_block_len > 0 ? forced_block_len : PIPELINE_DEFAULT_LEN);
+    memcpy(p->key, key, AES_BLOCKLEN);
+    memcpy(p->iv, iv, AES_BLOCKLEN);
+    atomic_init(&p->failed, 0);
+
+    /* Every ring must be able to hold all buffers plus an end marker */
+    nsegs = nworkers * PIPELINE_BUFS_PER_WORKER;
+    if (NULL == (segs = calloc((size_t) nsegs, sizeof(*segs)))
+        || ring_init(&p->free_ring, (size_t) nsegs + 1) < 0)
+        goto out;
+    for (int i = 0; i < nworkers; i++)
+    {
+        p->eof_seg[i].eof = 1;
+        if (ring_init(&p->in_ring[i], (size_t) nsegs + 1) < 0
+            || ring_init(&p->out_ring[i], (size_t) nsegs + 1) < 0)
+            goto out;
+    }
+    for (int i = 0; i < nsegs; i++)
+    {
+        /* Room for the zero padding of a short chunk */
+        if (NULL == (segs[i].data = malloc(p->read_len + AES_BLOCKLEN)))
+        {
+            perror("malloc");
+            goto out;
+        }
+        ring_push(&p->free_ring, &segs[i]);
+    }
+
+    fprintf(stderr, "[INFO] Pipelined %scryption: %d cipher thread(s), %d buffers of %lu KB.\n",
+            dec ? "de" : "en", nworkers, nsegs, (unsigned long) (p->read_len / 1024));
+
+    for (; nstarted < nworkers; nstarted++)
+    {
+        wargs[nstarted].p = p;
+        wargs[nstarted].id = nstarted;
+        if (0 != pthread_create(&workers[nstarted], NULL, cipher_stage, &wargs[nstarted]))
+        {
+            atomic_store(&p->failed, 1);
+            break;
+        }
+    }
+    if (nstarted == nworkers)
+    {
+        if (0 != pthread_create(&reader, NULL, reader_stage, p))
+            atomic_store(&p->failed, 1);
+        else
+        {
+            if (0 != pthread_create(&writer, NULL, writer_stage, p))
+                atomic_store(&p->failed, 1);
+            else
+                pthread_join(writer, NULL);
+            pthread_join(reader, NULL);
+        }
+    }
+    for (int i = 0; i < nstarted; i++)
+        pthread_join(workers[i], NULL);
+
+    ret = atomic_load(&p->failed) ? -1 : 0;
+
+out:
+    if (segs)
+        for (int i = 0; i < nsegs; i++)
+            free(segs[i].data);
+    free(segs);
+    free(p->free_ring.slots);
+    for (int i = 0; i < nworkers; i++)
+    {
+        free(p->in_ring[i].slots);
+        free(p->out_ring[i].slots);
+    }
+    free(p);
+    return ret;
+}
@@ -0,0 +1,28 @@
+/**
+ *  sw_pipeline.h - threaded read/cipher/write pipeline for software CBC.
+ *
+ *  A reader thread fills recycled buffers from the infile, cipher threads
+ *  process them and a writer thread drains them to the outfile, so file I/O
+ *  overlaps with the crypto. The stages are connected by lock-free
+ *  single-producer/single-consumer rings.
+ *
+ *  Author: Hsiang-Ju Lai <happyx94@gmail.com>
+ */
+#ifndef _SW_PIPELINE_H
+#define _SW_PIPELINE_H
+
+#define PIPELINE_MAX_WORKERS    16
+
+/**
+ *  Encrypt or decrypt fdin into fdout with software AES-CBC, chunked and
+ *  padded the same way as encrypt_file_sw()/decrypt_file_sw().
+ *  Encryption is sequential, so it uses one cipher thread. Decryption of
+ *  a chunk only needs the last ciphertext block of the previous one, so
+ *  up to nworkers chunks are decrypted in parallel.
+ *
+ *  Return: 0 on success, -1 on failure.
+ */
+extern int cipher_file_pipelined(int fdin, int fdout, void *key, void *iv, int rev, int dec,
+                                 int forced_block_len, int nworkers);
+
+#endif
@@ -0,0 +1,163 @@
+/*
+ * File name: trace.c
+ * Version: 1.0
+ * Author: Hsiang-Ju Lai
+ * Description:
+ *  Per-thread event buffers for the chunk timeline. A thread allocates
+ *  its buffer on its first event and pushes it onto a global list with
+ *  a compare-and-swap. Only the owner ever writes to a buffer; it
+ *  publishes each event by bumping the count with a release store.
+ */
+
+#define _GNU_SOURCE     /* syscall(SYS_gettid) */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+struct trace_rec
+{
+    uint64_t ns;            /* since trace_open() */
+    uint64_t chunk;
+    const char *stage;
+    char phase;
+};
+
+struct trace_buf
+{
+    struct trace_buf *next;
+    int tid;
+    const char *name;       /* thread name, or NULL */
+    uint32_t n;             /* published events */
+    uint32_t dropped;
+    struct trace_rec recs[TRACE_BUF_EVENTS];
+};
+
+int trace_enabled;
+static int trace_opened;         /* once only: threads may still point at freed buffers */
+static FILE *trace_fp;
+static uint64_t trace_start_ns;
+static struct trace_buf *trace_bufs;
+static __thread struct trace_buf *my_buf;
+
+static uint64_t trace_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static struct trace_buf *get_buf()
+{
+    struct trace_buf *b = my_buf;
+
+    if (NULL != b)
+        return b;
+    if (NULL == (b = malloc(sizeof(*b))))
+        return NULL;
+    b->tid = (int) syscall(SYS_gettid);
+    b->name = NULL;
+    b->n = 0;
+    b->dropped = 0;
+    b->next = __atomic_load_n(&trace_bufs, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&trace_bufs, &b->next, b, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    return my_buf = b;
+}
+
+int trace_open(const char *path)
+{
+    if (trace_opened)
+        return trace_enabled ? 0 : -1;
+    if (NULL == (trace_fp = fopen(path, "w")))
+    {
+        perror(path);
+        return -1;
+    }
+    trace_opened = 1;
+    trace_start_ns = trace_now();
+    __atomic_store_n(&trace_enabled, 1, __ATOMIC_RELEASE);
+    atexit(trace_close);
+    return 0;
+}
+
+void trace_thread_name(const char *name)
+{
+    struct trace_buf *b;
+
+    if (trace_enabled && NULL != (b = get_buf()))
+        b->name = name;
+}
+
+void trace_event(const char *stage, uint64_t chunk, char phase)
+{
+    struct trace_buf *b = get_buf();
+    struct trace_rec *r;
+
+    if (NULL == b)
+        return;
+    if (b->n >= TRACE_BUF_EVENTS)
+    {
+        b->dropped++;
+        return;
+    }
+    r = &b->recs[b->n];
+    r->ns = trace_now() - trace_start_ns;
+    r->chunk = chunk;
+    r->stage = stage;
+    r->phase = phase;
+    __atomic_store_n(&b->n, b->n + 1, __ATOMIC_RELEASE);
+}
+
+void trace_close()
+{
+    struct trace_buf *b, *next;
+    int pid = (int) getpid(), first = 1;
+    unsigned long dropped = 0;
+
+    if (!trace_enabled)
+        return;
+    __atomic_store_n(&trace_enabled, 0, __ATOMIC_RELAXED);
+
+    fprintf(trace_fp, "{\"traceEvents\":[\n");
+    for (b = __atomic_load_n(&trace_bufs, __ATOMIC_ACQUIRE); NULL != b; b = b->next)
+    {
+        uint32_t n = __atomic_load_n(&b->n, __ATOMIC_ACQUIRE);
+
+        if (NULL != b->name)
+        {
+            fprintf(trace_fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                    first ? "" : ",\n", pid, b->tid, b->name);
+            first = 0;
+        }
+        /* Async events: the viewer gives every chunk id its own row */
+        for (uint32_t i = 0; i < n; i++)
+        {
+            const struct trace_rec *r = &b->recs[i];
+
+            fprintf(trace_fp, "%s{\"name\":\"%s\",\"cat\":\"chunk\",\"ph\":\"%c\",\"id\":%llu,"
+                              "\"ts\":%llu.%03u,\"pid\":%d,\"tid\":%d}",
+                    first ? "" : ",\n", r->stage, r->phase, (unsigned long long) r->chunk,
+                    (unsigned long long) (r->ns / 1000), (unsigned) (r->ns % 1000), pid, b->tid);
+            first = 0;
+        }
+        dropped += b->dropped;
+    }
+    fprintf(trace_fp, "\n],\"displayTimeUnit\":\"ns\"}\n");
+    fclose(trace_fp);
+    trace_fp = NULL;
+    if (dropped > 0)
+        fprintf(stderr, "[INFO] Trace buffers were full: %lu events were dropped.\n", dropped);
+
+    for (b = trace_bufs; NULL != b; b = next)
+    {
+        next = b->next;
+        free(b);
+    }
+    trace_bufs = NULL;
+    my_buf = NULL;
+}
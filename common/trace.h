@@ -0,0 +1,60 @@
+/**
+ *  trace.h - chunk timeline in Chrome trace-event format.
+ *
+ *  The file loops mark when each chunk is read, in the DMA, ciphered and
+ *  written. Every thread appends to its own fixed buffer without locks,
+ *  and trace_close() (run at exit) writes all of them as JSON that
+ *  chrome://tracing or Perfetto can open. Each chunk gets its own row, so
+ *  overlap between the stages and the gaps between chunks are easy to see.
+ *  While tracing is off, a mark costs one branch.
+ *
+ *  Author: Hsiang-Ju Lai <happyx94@gmail.com>
+ */
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_BUF_EVENTS    16384   /* per thread; later events are dropped */
+
+/* Stage names */
+#define TRACE_READ          "read"
+#define TRACE_DMA           "dma"
+#define TRACE_CIPHER        "cipher"
+#define TRACE_WRITE         "write"
+
+/* Set by trace_open() */
+extern int trace_enabled;
+
+/**
+ *  Start recording. The trace is written to path by trace_close(),
+ *  which is registered with atexit(). A process records one trace.
+ *
+ *  Return: 0, or -1 if path can't be created or a trace was already
+ *  written.
+ */
+extern int trace_open(const char *path);
+
+/**
+ *  Write the trace and stop recording. Every thread that recorded events
+ *  must be done by then. Later calls do nothing.
+ */
+extern void trace_close();
+
+/**
+ *  Name the calling thread in the trace.
+ */
+extern void trace_thread_name(const char *name);
+
+/**
+ *  Record the start ('b') or end ('e') of stage for chunk at the current
+ *  time. stage must be a string that outlives the trace (see TRACE_*).
+ */
+extern void trace_event(const char *stage, uint64_t chunk, char phase);
+
+#define trace_begin(stage, chunk) \
+    do { if (trace_enabled) trace_event((stage), (uint64_t) (chunk), 'b'); } while (0)
+#define trace_end(stage, chunk) \
+    do { if (trace_enabled) trace_event((stage), (uint64_t) (chunk), 'e'); } while (0)
+
+#endif
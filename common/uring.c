@@ -0,0 +1,139 @@
+/*
+ * File name: uring.c
+ * Version: 1.0
+ * Author: Hsiang-Ju Lai
+ * Description:
+ *  Minimal io_uring set-up, submission and completion handling.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+#ifdef __NR_io_uring_setup
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+int uring_init(struct uring *ring, unsigned entries)
+{
+    struct io_uring_params p;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+
+    ring->fd = sys_io_uring_setup(entries, &p);
+    if (ring->fd < 0)
+        return -errno;
+    ring->entries = p.sq_entries;
+
+    ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (MAP_FAILED == ring->sq_ptr || MAP_FAILED == ring->cq_ptr || MAP_FAILED == ring->sqes)
+    {
+        int err = errno;
+        uring_exit(ring);
+        return -err;
+    }
+
+    ring->sq_head = (unsigned *) ((char *) ring->sq_ptr + p.sq_off.head);
+    ring->sq_tail = (unsigned *) ((char *) ring->sq_ptr + p.sq_off.tail);
+    ring->sq_mask = (unsigned *) ((char *) ring->sq_ptr + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) ((char *) ring->sq_ptr + p.sq_off.array);
+    ring->cq_head = (unsigned *) ((char *) ring->cq_ptr + p.cq_off.head);
+    ring->cq_tail = (unsigned *) ((char *) ring->cq_ptr + p.cq_off.tail);
+    ring->cq_mask = (unsigned *) ((char *) ring->cq_ptr + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) ((char *) ring->cq_ptr + p.cq_off.cqes);
+    return 0;
+}
+
+void uring_exit(struct uring *ring)
+{
+    if (ring->sqes && MAP_FAILED != ring->sqes)
+        munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_ptr && MAP_FAILED != ring->cq_ptr)
+        munmap(ring->cq_ptr, ring->cq_len);
+    if (ring->sq_ptr && MAP_FAILED != ring->sq_ptr)
+        munmap(ring->sq_ptr, ring->sq_len);
+    if (ring->fd >= 0)
+        close(ring->fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+int uring_register_buffers(struct uring *ring, const struct iovec *iov, unsigned n)
+{
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov, n) < 0)
+        return -errno;
+    return 0;
+}
+
+struct io_uring_sqe *uring_get_sqe(struct uring *ring)
+{
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring->sq_tail + ring->to_submit;
+    struct io_uring_sqe *sqe;
+
+    if (tail - head >= ring->entries)
+        return NULL;
+
+    sqe = &ring->sqes[tail & *ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+    ring->to_submit++;
+    return sqe;
+}
+
+int uring_submit(struct uring *ring, unsigned wait_nr)
+{
+    unsigned n = ring->to_submit;
+    int ret;
+
+    /* Publish the new entries before telling the kernel about them */
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + n, __ATOMIC_RELEASE);
+    ring->to_submit = 0;
+
+    if (0 == n && 0 == wait_nr)
+        return 0;
+    do
+    {
+        ret = sys_io_uring_enter(ring->fd, n, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    } while (ret < 0 && EINTR == errno);
+
+    return ret < 0 ? -errno : ret;
+}
+
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring)
+{
+    unsigned head = *ring->cq_head;
+
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+void uring_cqe_seen(struct uring *ring)
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,76 @@
+/**
+ *  uring.h - minimal io_uring wrapper on top of the raw system calls, so
+ *  the asynchronous I/O path doesn't need liburing on the target.
+ *
+ *  Author: Hsiang-Ju Lai <happyx94@gmail.com>
+ */
+#ifndef _URING_H
+#define _URING_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+struct uring
+{
+    int fd;
+    unsigned entries;
+    unsigned to_submit;
+
+    /* Submission queue */
+    void *sq_ptr;
+    size_t sq_len;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+
+    /* Completion queue */
+    void *cq_ptr;
+    size_t cq_len;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+/**
+ *  Set up a ring with room for entries submissions.
+ * 
+ *  Return: 0 or -errno (-ENOSYS if the kernel has no io_uring)
+ */
+extern int uring_init(struct uring *ring, unsigned entries);
+
+extern void uring_exit(struct uring *ring);
+
+/**
+ *  Register iovecs as fixed buffers for IORING_OP_READ_FIXED/WRITE_FIXED.
+ * 
+ *  Return: 0 or -errno
+ */
+extern int uring_register_buffers(struct uring *ring, const struct iovec *iov, unsigned n);
+
+/**
+ *  Get a zeroed submission entry, or NULL if the queue is full.
+ *  The entry is queued by the next uring_submit().
+ */
+extern struct io_uring_sqe *uring_get_sqe(struct uring *ring);
+
+/**
+ *  Submit queued entries and wait for at least wait_nr completions.
+ * 
+ *  Return: number submitted or -errno
+ */
+extern int uring_submit(struct uring *ring, unsigned wait_nr);
+
+/**
+ *  Return the oldest completion without waiting, or NULL.
+ *  Call uring_cqe_seen() once it has been handled.
+ */
+extern struct io_uring_cqe *uring_peek_cqe(struct uring *ring);
+
+extern void uring_cqe_seen(struct uring *ring);
+
+#endif
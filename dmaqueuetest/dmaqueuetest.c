@@ -0,0 +1,300 @@
+/*
+ * File name: dmaqueuetest.c
+ * Program name: dmaqueuetest
+ * Version: 1.0
+ * Author: Hsiang-Ju Lai
+ * Description:
+ *  This program tests dma_queue without the hardware. The driver calls
+ *  the queue makes are stood in for by software CBC on as many simulated
+ *  devices as asked, so several dispatchers run at once. Each round
+ *  starts the queue, has several threads submit requests of mixed sizes
+ *  and classes, checks every result against software CBC and stops the
+ *  queue. Other rounds stop a queue that is idle, one flooded with tiny
+ *  requests, and one that still has requests in flight. A watchdog fails
+ *  the test if any round hangs.
+ *      Usage: dmaqueuetest [rounds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "dma_driver.h"
+#include "dma_queue.h"
+#include "sw_aes.h"
+
+#define TEST_ROUNDS         20
+#define TEST_SUBMITTERS     8
+#define TEST_REQUESTS       64      /* per submitter and round */
+#define TEST_TINY_REQUESTS  2000    /* per submitter in the flood rounds */
+#define TEST_INFLIGHT       12      /* left queued when dma_queue_destroy() is called */
+#define TEST_MAX_LEN        (300 * 1024)
+#define TEST_BUF_LEN        (1024 * 1024)
+#define TEST_DEPTH          16
+#define TEST_TIMEOUT        120     /* seconds for the whole run */
+
+/* -------------------- software stand-in for the driver -------------------- */
+
+void *pbuf;
+u32 rsv_buf_len;
+int dma_ndevices;
+
+static __thread struct AES_ctx dev_ctx;
+
+int dma_select(int dev)
+{
+    return dev >= 0 && dev < (dma_ndevices > 0 ? dma_ndevices : 1) ? SUCCESS : FAILURE;
+}
+
+int dma_set_window(int dev, void *base, u32 len)
+{
+    (void) base;
+    (void) len;
+    return dev >= 0 && dev < dma_ndevices ? SUCCESS : FAILURE;
+}
+
+void *dma_window()
+{
+    return pbuf;
+}
+
+u32 dma_window_len()
+{
+    return rsv_buf_len / (u32) (dma_ndevices > 0 ? dma_ndevices : 1);
+}
+
+int aes_set_key(void *pkey)
+{
+    uint8_t iv[AES_BLOCKLEN];
+
+    memcpy(iv, dev_ctx.Iv, AES_BLOCKLEN);
+    AES_init_ctx_iv(&dev_ctx, pkey, iv);
+    return SUCCESS;
+}
+
+int aes_set_iv(void *piv)
+{
+    AES_ctx_set_iv(&dev_ctx, piv);
+    return SUCCESS;
+}
+
+int dma_transfer(const void *src, void *dst, size_t len)
+{
+    memmove(dst, src, len);
+    sched_yield();      /* give the other dispatchers a chance to interleave */
+    AES_CBC_encrypt_buffer(&dev_ctx, dst, (uint32_t) len);
+    return SUCCESS;
+}
+
+int aes_run_batch(const struct aes_job *jobs, int njobs)
+{
+    for (int i = 0; i < njobs; i++)
+    {
+        if ((jobs[i].key && FAILURE == aes_set_key((void *) jobs[i].key))
+            || (jobs[i].iv && FAILURE == aes_set_iv((void *) jobs[i].iv))
+            || FAILURE == dma_transfer(jobs[i].src, jobs[i].dst, jobs[i].len))
+            return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/* -------------------- the test -------------------- */
+
+static const u8 test_key[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+static const u8 other_key[16] = { 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0 };
+static int failures;
+
+struct submitter
+{
+    pthread_t thread;
+    unsigned int seed;
+    int nreqs;
+    u32 max_blocks;     /* 0 for the mixed sizes */
+};
+
+static void timeout(int sig)
+{
+    static const char msg[] = "FAILED: a round did not finish (hang)\n";
+
+    (void) sig;
+    (void) !write(2, msg, sizeof(msg) - 1);
+    _exit(1);
+}
+
+static u32 random_len(unsigned int *seed, u32 max_blocks)
+{
+    /* Mostly small requests, which get batched, and some over a slice */
+    u32 blocks = max_blocks ? 1 + (u32) rand_r(seed) % max_blocks
+                 : rand_r(seed) % 4 ? 1 + (u32) rand_r(seed) % 256 : 1 + (u32) rand_r(seed) % (TEST_MAX_LEN / 16);
+
+    return blocks * 16;
+}
+
+static void check(const char *what, int i, int status, const u8 *key, const u8 *iv,
+                  const u8 *src, const u8 *dst, u8 *ref, u32 len)
+{
+    struct AES_ctx ctx;
+
+    memcpy(ref, src, len);
+    AES_init_ctx_iv(&ctx, key, iv);
+    AES_CBC_encrypt_buffer(&ctx, ref, len);
+    if (SUCCESS != status || 0 != memcmp(dst, ref, len))
+    {
+        fprintf(stderr, "FAILED: %s request %d of %u bytes: %s\n", what, i, len,
+                SUCCESS != status ? "status" : "wrong output");
+        __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void *submit_run(void *arg)
+{
+    struct submitter *s = arg;
+    u8 *src = malloc(TEST_MAX_LEN), *dst = malloc(TEST_MAX_LEN), *ref = malloc(TEST_MAX_LEN);
+    struct dma_req *req = calloc(1, sizeof(*req));
+    u8 iv[16];
+
+    if (NULL == src || NULL == dst || NULL == ref || NULL == req)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    for (int i = 0; i < s->nreqs; i++)
+    {
+        u32 len = random_len(&s->seed, s->max_blocks);
+        int status, own_key = rand_r(&s->seed) % 2;
+
+        for (u32 j = 0; j < len; j++)
+            src[j] = (u8) rand_r(&s->seed);
+        for (int j = 0; j < 16; j++)
+            iv[j] = (u8) rand_r(&s->seed);
+
+        /* Half go through dma_request, half through dma_submit with a class */
+        if (i % 2)
+            status = dma_request(src, dst, len, iv);
+        else
+        {
+            memset(req, 0, sizeof(*req));
+            req->src = src;
+            req->dst = dst;
+            req->len = len;
+            memcpy(req->iv, iv, 16);
+            req->key = own_key ? other_key : NULL;
+            req->cls = rand_r(&s->seed) % DMA_NCLASSES;
+            req->deadline = rand_r(&s->seed) % 2 ? dma_queue_now() + 1000 : 0;
+            while (FAILURE == dma_submit(req))
+                sched_yield();
+            status = dma_wait(req);
+        }
+
+        check("submitted", i, status, (i % 2 == 0 && own_key) ? other_key : test_key, iv, src, dst, ref, len);
+    }
+    free(src);
+    free(dst);
+    free(ref);
+    free(req);
+    return NULL;
+}
+
+static void start_queue(int ndevices)
+{
+    dma_ndevices = ndevices;
+    if (FAILURE == dma_queue_init(TEST_DEPTH, test_key))
+    {
+        fprintf(stderr, "FAILED: dma_queue_init\n");
+        exit(1);
+    }
+}
+
+static void run_round(int round, int ndevices, int nsubmitters, int nreqs, u32 max_blocks)
+{
+    struct submitter subs[TEST_SUBMITTERS];
+
+    start_queue(ndevices);
+    for (int i = 0; i < nsubmitters; i++)
+    {
+        subs[i].seed = (unsigned int) (round * TEST_SUBMITTERS + i + 1);
+        subs[i].nreqs = nreqs;
+        subs[i].max_blocks = max_blocks;
+        if (0 != pthread_create(&subs[i].thread, NULL, submit_run, &subs[i]))
+        {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < nsubmitters; i++)
+        pthread_join(subs[i].thread, NULL);
+    dma_queue_destroy();
+}
+
+/* Stop the queue while its requests are still running: it must finish them */
+static void run_inflight_round(int round, int ndevices)
+{
+    static struct dma_req reqs[TEST_INFLIGHT];
+    static u8 src[TEST_INFLIGHT][TEST_MAX_LEN], dst[TEST_INFLIGHT][TEST_MAX_LEN], ref[TEST_MAX_LEN];
+    u8 ivs[TEST_INFLIGHT][16];      /* the queue keeps the chain in reqs[i].iv */
+    unsigned int seed = (unsigned int) round + 1000;
+
+    start_queue(ndevices);
+    for (int i = 0; i < TEST_INFLIGHT; i++)
+    {
+        memset(&reqs[i], 0, sizeof(reqs[i]));
+        reqs[i].src = src[i];
+        reqs[i].dst = dst[i];
+        reqs[i].len = random_len(&seed, 0);
+        reqs[i].cls = i % DMA_NCLASSES;
+        for (u32 j = 0; j < reqs[i].len; j++)
+            src[i][j] = (u8) rand_r(&seed);
+        for (int j = 0; j < 16; j++)
+            ivs[i][j] = (u8) rand_r(&seed);
+        memcpy(reqs[i].iv, ivs[i], 16);
+        if (FAILURE == dma_submit(&reqs[i]))
+        {
+            fprintf(stderr, "FAILED: dma_submit with room in the ring\n");
+            exit(1);
+        }
+    }
+    dma_queue_destroy();
+    for (int i = 0; i < TEST_INFLIGHT; i++)
+        check("in-flight", i, dma_wait(&reqs[i]), test_key, ivs[i], src[i], dst[i], ref, reqs[i].len);
+}
+
+int main(int argc, char *argv[])
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : TEST_ROUNDS;
+    static const int ndevices[] = { 1, 2, 4 };
+
+    rsv_buf_len = TEST_BUF_LEN;
+    if (NULL == (pbuf = malloc(TEST_BUF_LEN)))
+    {
+        perror("malloc");
+        exit(1);
+    }
+    signal(SIGALRM, timeout);
+    alarm(TEST_TIMEOUT);
+
+    for (int r = 0; r < rounds; r++)
+    {
+        int n = ndevices[r % 3];
+
+        run_round(r, n, 0, 0, 0);           /* idle start/stop */
+        run_round(r, n, TEST_SUBMITTERS, TEST_REQUESTS, 0);
+        run_round(r, n, TEST_SUBMITTERS, TEST_TINY_REQUESTS, 2);
+        run_inflight_round(r, n);
+        printf("Round %d: %d device(s), %d submitters: %s\n", r, n, TEST_SUBMITTERS,
+               failures ? "FAILED" : "passed");
+        if (failures)
+            break;
+    }
+
+    free(pbuf);
+    if (failures)
+    {
+        printf("%d request(s) FAILED\n", failures);
+        exit(1);
+    }
+    printf("All tests passed\n");
+    return 0;
+}
@@ -3,24 +3,47 @@
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/kernel.h> /* printk() */
-#include <linux/slab.h>   /* kmalloc() */
+#include <linux/slab.h>   /* kzalloc() */
 #include <linux/fs.h>     /* everything... */
 #include <linux/errno.h>  /* error codes */
 #include <linux/types.h>  /* size_t */
 #include <linux/proc_fs.h>
 #include <linux/fcntl.h> /* O_ACCMODE */
+#include <linux/moduleparam.h>
+#include <linux/device.h>
+#include <linux/mm.h>
+#include <linux/version.h>
+#include <linux/sched.h>  /* current */
+#include <linux/dma-mapping.h>
+#include <linux/mutex.h>
 #include <asm/uaccess.h> /* copy_from/to_user */
 #include <asm/io.h>      /* virt_to_phys() */
 
+#include "rsvmem_ioctl.h"
+
 #define RESERVED_SIZE 1048576
 
 MODULE_LICENSE("Dual BSD/GPL");
 
+/* Size of the shared pool, e.g. insmod rsvmem.ko rsv_size=4194304.
+ * Multi-megabyte sizes come from CMA when the kernel has it (cma= on the
+ * kernel command line reserves the area at boot). */
+static unsigned long rsv_size = RESERVED_SIZE;
+module_param(rsv_size, ulong, 0444);
+MODULE_PARM_DESC(rsv_size, "Size of the shared DMA pool in bytes");
+
+/* Upper bound for one per-open buffer */
+static unsigned long max_alloc = 64 * 1024 * 1024;
+module_param(max_alloc, ulong, 0644);
+MODULE_PARM_DESC(max_alloc, "Largest buffer a single open file may allocate");
+
 /* Declaration of memory.c functions */
 int memory_open(struct inode *inode, struct file *filp);
 int memory_release(struct inode *inode, struct file *filp);
 ssize_t memory_read(struct file *filp, char *buf, size_t count, loff_t *f_pos);
 ssize_t memory_write(struct file *filp, const char *buf, size_t count, loff_t *f_pos);
+long memory_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
+int memory_mmap(struct file *filp, struct vm_area_struct *vma);
 void memory_exit(void);
 int memory_init(void);
 
@@ -30,20 +53,33 @@ struct file_operations rsvmem_fops =
         read : memory_read,
         write : memory_write,
         open : memory_open,
-        release : memory_release
+        release : memory_release,
+        unlocked_ioctl : memory_ioctl,
+        mmap : memory_mmap
     };
 
 /* Declaration of the init and exit functions */
 module_init(memory_init);
 module_exit(memory_exit);
 
+/* A DMA-coherent buffer: the shared pool or one owned by an open file */
+struct rsvmem_buf
+{
+    void *va;
+    dma_addr_t phys;
+    size_t size;
+    struct mutex lock;  /* serializes RSVMEM_IOC_ALLOC on one open file */
+};
+
 /* Global variables of the driver */
 /* Major number */
 int rsvmem_major = 60;
-/* Buffer to store data */
-void *prsvmem;
+/* Device used for the DMA API */
+static struct class *rsvmem_class;
+static struct device *rsvmem_dev;
+/* Shared pool, kept for tools that read() the address and map /dev/mem */
+static struct rsvmem_buf pool;
 unsigned long phy_addr;
-unsigned long bus_addr;
 
 int memory_init(void)
 {
@@ -57,23 +93,45 @@ int memory_init(void)
         return result;
     }
 
-    /* Allocating memory for the buffer */
-    prsvmem = kmalloc(RESERVED_SIZE, GFP_DMA);
-    if (!prsvmem)
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+    rsvmem_class = class_create("rsvmem");
+#else
+    rsvmem_class = class_create(THIS_MODULE, "rsvmem");
+#endif
+    if (IS_ERR(rsvmem_class))
+    {
+        result = PTR_ERR(rsvmem_class);
+        rsvmem_class = NULL;
+        goto fail;
+    }
+    rsvmem_dev = device_create(rsvmem_class, NULL, MKDEV(rsvmem_major, 0), NULL, "rsvmem");
+    if (IS_ERR(rsvmem_dev))
+    {
+        result = PTR_ERR(rsvmem_dev);
+        rsvmem_dev = NULL;
+        goto fail;
+    }
+    /* The AXI DMA only drives 32-bit addresses */
+    result = dma_coerce_mask_and_coherent(rsvmem_dev, DMA_BIT_MASK(32));
+    if (result)
+        goto fail;
+
+    /* Allocating memory for the shared pool */
+    pool.size = PAGE_ALIGN(rsv_size);
+    pool.va = dma_alloc_coherent(rsvmem_dev, pool.size, &pool.phys, GFP_KERNEL);
+    if (!pool.va)
     {
         result = -ENOMEM;
         goto fail;
     }
-    phy_addr = (unsigned long)virt_to_phys(prsvmem);
-    bus_addr = (unsigned long)virt_to_bus(prsvmem);
-    printk("rsvmem: Reserved %dKB at %08lx(bus=%08lx, va=%p)\n",
-        RESERVED_SIZE / 1024,  
+    phy_addr = (unsigned long)pool.phys;
+    printk("rsvmem: Reserved %luKB at %08lx(va=%p)\n",
+        (unsigned long)pool.size / 1024,
         phy_addr,
-        bus_addr,
-        prsvmem);
-    memset(prsvmem, (int)'G', RESERVED_SIZE);
-    ((char *)prsvmem)[10] = 0;
-    printk("rsvmem: First 10 bytes of the buffer is... %s\n", (char *)prsvmem);
+        pool.va);
+    memset(pool.va, (int)'G', pool.size);
+    ((char *)pool.va)[10] = 0;
+    printk("rsvmem: First 10 bytes of the buffer is... %s\n", (char *)pool.va);
     printk("rsvmem: Successfully inserted module\n");
     return 0;
 fail:
@@ -83,57 +141,141 @@ fail:
 
 void memory_exit(void)
 {
-    /* Freeing the major number */
-    unregister_chrdev(rsvmem_major, "rsvmem");
     /* Freeing buffer memory */
-    if (prsvmem)
+    if (pool.va)
     {
-        kfree(prsvmem);
+        dma_free_coherent(rsvmem_dev, pool.size, pool.va, pool.phys);
+        pool.va = NULL;
     }
+    if (rsvmem_dev)
+        device_destroy(rsvmem_class, MKDEV(rsvmem_major, 0));
+    if (rsvmem_class)
+        class_destroy(rsvmem_class);
+    /* Freeing the major number */
+    unregister_chrdev(rsvmem_major, "rsvmem");
     printk("rsvmem: Removed module\n");
 }
 
+/* The buffer an open file works on: its own if it allocated one, else the pool */
+static struct rsvmem_buf *file_buf(struct file *filp)
+{
+    struct rsvmem_buf *own = filp->private_data;
+
+    /* Pairs with the release in memory_ioctl: size and phys are set first */
+    return (own && smp_load_acquire(&own->va)) ? own : &pool;
+}
+
 int memory_open(struct inode *inode, struct file *filp)
 {
-    /* Success */
+    struct rsvmem_buf *own = kzalloc(sizeof(struct rsvmem_buf), GFP_KERNEL);
+
+    if (!own)
+        return -ENOMEM;
+    mutex_init(&own->lock);
+    filp->private_data = own;
     return 0;
 }
 
 int memory_release(struct inode *inode, struct file *filp)
 {
-    /* Success */
+    struct rsvmem_buf *own = filp->private_data;
+
+    /* mmap() holds a reference on the file, so no mapping is left by now */
+    if (own && own->va)
+        dma_free_coherent(rsvmem_dev, own->size, own->va, own->phys);
+    kfree(own);
     return 0;
 }
 
+long memory_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    struct rsvmem_buf *own = filp->private_data;
+    struct rsvmem_alloc req;
+    dma_addr_t phys;
+    size_t size;
+    void *va;
+
+    if (cmd != RSVMEM_IOC_ALLOC)
+        return -ENOTTY;
+    if (copy_from_user(&req, (void __user *)arg, sizeof(req)) != 0)
+        return -EFAULT;
+    if (req.size == 0 || req.size > max_alloc)
+        return -EINVAL;
+
+    /* Two threads sharing the file must not both allocate */
+    mutex_lock(&own->lock);
+    if (own->va)
+    {
+        mutex_unlock(&own->lock);
+        return -EBUSY;
+    }
+    size = PAGE_ALIGN(req.size);
+    va = dma_alloc_coherent(rsvmem_dev, size, &phys, GFP_KERNEL);
+    if (!va)
+    {
+        mutex_unlock(&own->lock);
+        return -ENOMEM;
+    }
+    own->size = size;
+    own->phys = phys;
+    smp_store_release(&own->va, va);
+    mutex_unlock(&own->lock);
+
+    req.size = own->size;
+    req.phys = own->phys;
+    if (copy_to_user((void __user *)arg, &req, sizeof(req)) != 0)
+        return -EFAULT;
+    printk("rsvmem: Allocated %luKB at %08lx for pid %d\n",
+        (unsigned long)own->size / 1024, (unsigned long)own->phys, current->pid);
+    return 0;
+}
+
+int memory_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    struct rsvmem_buf *b = file_buf(filp);
+    size_t len = vma->vm_end - vma->vm_start;
+
+    if (vma->vm_pgoff != 0 || len > b->size)
+        return -EINVAL;
+    return dma_mmap_coherent(rsvmem_dev, vma, b->va, b->phys, len);
+}
+
+/* Returns the physical address, followed by the buffer size if there is room */
 ssize_t memory_read(struct file *filp, char *buf, size_t count, loff_t *f_pos)
 {
+    struct rsvmem_buf *b = file_buf(filp);
+    unsigned long info[2] = { (unsigned long)b->phys, (unsigned long)b->size };
     unsigned long size = sizeof(unsigned long);
 
     if ((unsigned long)count < size)
         return 0;
+    if ((unsigned long)count >= sizeof(info))
+        size = sizeof(info);
 
     /* Transfering data to user space */
-    copy_to_user(buf, &phy_addr, size);
+    if (copy_to_user(buf, info, size) != 0)
+        return -EFAULT;
 
     return size;
 }
 
 ssize_t memory_write(struct file *filp, const char *buf, size_t count, loff_t *f_pos)
 {
+    struct rsvmem_buf *b = file_buf(filp);
     char c;
 
 
 
-    if (count > RESERVED_SIZE)
+    if (count > b->size)
         return 0;
     if (count == 1)
     {
 	if (copy_from_user((void *)&c, buf, 1) != 0)
             return 0;
         printk("rsvmem: write 1 byte %c\n", c);
-        memset(prsvmem, c, RESERVED_SIZE);
+        memset(b->va, c, b->size);
         return 1;
     }
     printk("rsvmem: Write %d bytes to the buffer\n", (int)count);
-    return (ssize_t)(count - copy_from_user(prsvmem, buf, (unsigned long)count));
+    return (ssize_t)(count - copy_from_user(b->va, buf, (unsigned long)count));
 }
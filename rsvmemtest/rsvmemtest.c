@@ -12,12 +12,15 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 
-#define RESERVED_SIZE (1024*1024)
+#define DEFAULT_RESERVED_SIZE (1024*1024)
 
 int main()
 {
     int mem, rsv;
+    ssize_t ret;
     unsigned long offset;
+    unsigned long info[2];
+    unsigned long reserved_size = DEFAULT_RESERVED_SIZE;
     char* buf;
 
     mem = open("/dev/mem", O_RDWR | O_SYNC);
@@ -34,14 +37,19 @@ int main()
         exit(1);
     }
 
-    if (read(rsv, (void *)&offset, sizeof(unsigned long)) <= 0)
+    /* Newer rsvmem modules also report the buffer size */
+    ret = read(rsv, (void *)info, sizeof(info));
+    if (ret <= 0)
     {
         perror("Failed to read from /dev/rsvmem.\n");
         exit(1);
     }
+    offset = info[0];
+    if (ret == sizeof(info))
+        reserved_size = info[1];
 
-    printf("Phys. address of the reserved memory is at %08lx\n\n", offset);
-    buf = (char *)mmap(NULL, RESERVED_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, mem, (off_t)offset);
+    printf("Phys. address of the reserved memory is at %08lx (%lu KB)\n\n", offset, reserved_size / 1024);
+    buf = (char *)mmap(NULL, reserved_size, PROT_READ | PROT_WRITE, MAP_SHARED, mem, (off_t)offset);
     if (NULL == buf)
     {
         perror("mmap() failed.\n");
@@ -54,11 +62,11 @@ int main()
         exit(1);
     }
 
-    for (int i = 0; i < RESERVED_SIZE; i++)
+    for (unsigned long i = 0; i < reserved_size; i++)
     {
         if (buf[i] != 'G')
         {
-            printf("Error: buf[%d]'s content is not right.\n", i);
+            printf("Error: buf[%lu]'s content is not right.\n", i);
             break;
         }
     }
@@ -72,13 +80,13 @@ int main()
     printf("Memory content: %s\n", buf);
     
     printf("Writing to the memory region directly...\n");
-    for (int i = 0; i < RESERVED_SIZE; i++)
+    for (unsigned long i = 0; i < reserved_size; i++)
     {
         buf[i] = i % 256;
     }
 
     printf("The ending 256 bytes are...\n");
-    for (int i = RESERVED_SIZE - 256; i < RESERVED_SIZE; i++)
+    for (unsigned long i = reserved_size - 256; i < reserved_size; i++)
     {
         printf("%02x", (unsigned int)buf[i]);
         if (i % 4 == 3) printf(" ");
@@ -0,0 +1,17 @@
+#!/bin/sh
+# Capture the transfer sizes and arrival times of a running aes128 (or any
+# program linked with the driver) as an aes128load workload.
+# Needs bpftrace and a build with the USDT probes (see common/dma_probe.h).
+#   Usage: aes128_capture.sh pid [seconds] > workload
+
+pid=$1
+secs=${2:-10}
+if [ -z "$pid" ]; then
+    echo "Usage: $0 pid [seconds] > workload" >&2
+    exit 64
+fi
+
+echo "# aes128 workload: <time_ns> <bytes>, captured from pid $pid for $secs s"
+exec bpftrace -q -p "$pid" -e "
+usdt:/proc/$pid/exe:aes128:dma_start { printf(\"%llu %u\n\", nsecs, arg3); }
+interval:s:$secs { exit(); }"
@@ -1,4 +1,4 @@
 #!/bin/sh                                                                       
                                                                                 
-insmod /lib/modules/`uname -r`/extra/rsvmem.ko                        
-mknod /dev/rsvmem c 60 0
+insmod /lib/modules/`uname -r`/extra/rsvmem.ko "$@"                       
+[ -e /dev/rsvmem ] || mknod /dev/rsvmem c 60 0
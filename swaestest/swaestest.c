@@ -0,0 +1,240 @@
+/*
+ * File name: swaestest.c
+ * Program name: swaestest
+ * Version: 1.0
+ * Author: Hsiang-Ju Lai
+ * Description:
+ *  This program tests the software AES-CTR against the SP 800-38A
+ *  vectors, and checks that data fed in pieces of any length, on one
+ *  thread or several, gives the same result as one call. It also tests
+ *  AES-GCM against the vectors of the GCM specification, and the
+ *  byte-reversed CBC (-r) against reversing around the plain CBC.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sw_aes.h"
+
+#define TEST_LENGTH     (1024 * 1024 + 7)
+#define TEST_THREADS    4
+
+/* SP 800-38A F.5.1, CTR-AES128.Encrypt */
+static const uint8_t ctr_key[16] = {
+    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+static const uint8_t ctr_iv[16] = {
+    0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff };
+static const uint8_t ctr_plain[64] = {
+    0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+    0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+    0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+    0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10 };
+static const uint8_t ctr_cipher[64] = {
+    0x87, 0x4d, 0x61, 0x91, 0xb6, 0x20, 0xe3, 0x26, 0x1b, 0xef, 0x68, 0x64, 0x99, 0x0d, 0xb6, 0xce,
+    0x98, 0x06, 0xf6, 0x6b, 0x79, 0x70, 0xfd, 0xff, 0x86, 0x17, 0x18, 0x7b, 0xb9, 0xff, 0xfd, 0xff,
+    0x5a, 0xe4, 0xdf, 0x3e, 0xdb, 0xd5, 0xd3, 0x5e, 0x5b, 0x4f, 0x09, 0x02, 0x0d, 0xb0, 0x3e, 0xab,
+    0x1e, 0x03, 0x1d, 0xda, 0x2f, 0xbe, 0x03, 0xd1, 0x79, 0x21, 0x70, 0xa0, 0xf3, 0x00, 0x9c, 0xee };
+
+/* The GCM specification (McGrew and Viega), test cases 2 to 4 */
+static const uint8_t gcm_key3[16] = {
+    0xfe, 0xff, 0xe9, 0x92, 0x86, 0x65, 0x73, 0x1c, 0x6d, 0x6a, 0x8f, 0x94, 0x67, 0x30, 0x83, 0x08 };
+static const uint8_t gcm_iv3[12] = {
+    0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad, 0xde, 0xca, 0xf8, 0x88 };
+static const uint8_t gcm_plain3[64] = {
+    0xd9, 0x31, 0x32, 0x25, 0xf8, 0x84, 0x06, 0xe5, 0xa5, 0x59, 0x09, 0xc5, 0xaf, 0xf5, 0x26, 0x9a,
+    0x86, 0xa7, 0xa9, 0x53, 0x15, 0x34, 0xf7, 0xda, 0x2e, 0x4c, 0x30, 0x3d, 0x8a, 0x31, 0x8a, 0x72,
+    0x1c, 0x3c, 0x0c, 0x95, 0x95, 0x68, 0x09, 0x53, 0x2f, 0xcf, 0x0e, 0x24, 0x49, 0xa6, 0xb5, 0x25,
+    0xb1, 0x6a, 0xed, 0xf5, 0xaa, 0x0d, 0xe6, 0x57, 0xba, 0x63, 0x7b, 0x39, 0x1a, 0xaf, 0xd2, 0x55 };
+static const uint8_t gcm_cipher3[64] = {
+    0x42, 0x83, 0x1e, 0xc2, 0x21, 0x77, 0x74, 0x24, 0x4b, 0x72, 0x21, 0xb7, 0x84, 0xd0, 0xd4, 0x9c,
+    0xe3, 0xaa, 0x21, 0x2f, 0x2c, 0x02, 0xa4, 0xe0, 0x35, 0xc1, 0x7e, 0x23, 0x29, 0xac, 0xa1, 0x2e,
+    0x21, 0xd5, 0x14, 0xb2, 0x54, 0x66, 0x93, 0x1c, 0x7d, 0x8f, 0x6a, 0x5a, 0xac, 0x84, 0xaa, 0x05,
+    0x1b, 0xa3, 0x0b, 0x39, 0x6a, 0x0a, 0xac, 0x97, 0x3d, 0x58, 0xe0, 0x91, 0x47, 0x3f, 0x59, 0x85 };
+static const uint8_t gcm_aad4[20] = {
+    0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef, 0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef,
+    0xab, 0xad, 0xda, 0xd2 };
+static const uint8_t gcm_zero[16];
+static const uint8_t gcm_cipher2[16] = {
+    0x03, 0x88, 0xda, 0xce, 0x60, 0xb6, 0xa3, 0x92, 0xf3, 0x28, 0xc2, 0xb9, 0x71, 0xb2, 0xfe, 0x78 };
+static const uint8_t gcm_tag2[16] = {
+    0xab, 0x6e, 0x47, 0xd4, 0x2c, 0xec, 0x13, 0xbd, 0xf5, 0x3a, 0x67, 0xb2, 0x12, 0x57, 0xbd, 0xdf };
+static const uint8_t gcm_tag3[16] = {
+    0x4d, 0x5c, 0x2a, 0xf3, 0x27, 0xcd, 0x64, 0xa6, 0x2c, 0xf3, 0x5a, 0xbd, 0x2b, 0xa6, 0xfa, 0xb4 };
+static const uint8_t gcm_tag4[16] = {
+    0x5b, 0xc9, 0x4f, 0xbc, 0x32, 0x21, 0xa5, 0xdb, 0x94, 0xfa, 0xe9, 0x5a, 0xe7, 0x12, 0x1a, 0x47 };
+
+/* Piece lengths, used in turn until the data runs out */
+static const uint32_t small_pieces[] = { 1, 15, 16, 17, 3, 5, 31, 33, 7 };
+static const uint32_t large_pieces[] = { 1000, 70001, 65536 * 3 + 9, 5, 131071, 16 };
+
+/* Encrypt len bytes in pieces and compare with expect.
+ * Return: 0 if they match, 1 otherwise */
+static int check_pieces(const char *name, const uint8_t *plain, const uint8_t *expect, uint32_t len,
+                        const uint32_t *pieces, int npieces, int nthreads)
+{
+    struct AES_ctx ctx;
+    uint8_t *buf = malloc(len);
+    uint32_t off = 0, n;
+    int i = 0, ret;
+
+    if (NULL == buf)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    memcpy(buf, plain, len);
+    AES_init_ctx_iv(&ctx, ctr_key, ctr_iv);
+    while (off < len)
+    {
+        n = pieces[i++ % npieces];
+        if (n > len - off)
+            n = len - off;
+        if (nthreads > 1)
+            AES_CTR_xcrypt_buffer_mt(&ctx, buf + off, n, nthreads);
+        else
+            AES_CTR_xcrypt_buffer(&ctx, buf + off, n);
+        off += n;
+    }
+    ret = memcmp(buf, expect, len) != 0;
+    printf("%s: %s\n", name, ret ? "FAILED" : "passed");
+    free(buf);
+    return ret;
+}
+
+/* Encrypt and decrypt with GCM, in one call and block by block, and
+ * compare with the vector.
+ * Return: the number of mismatches */
+static int check_gcm(const char *name, const uint8_t *key, const uint8_t *iv, const uint8_t *aad,
+                     uint32_t aad_len, const uint8_t *plain, const uint8_t *cipher, uint32_t len,
+                     const uint8_t *tag)
+{
+    struct AES_GCM_ctx ctx;
+    uint8_t buf[64], out[16];
+    int ret = 0;
+
+    for (uint32_t piece = len; piece >= 16; piece = (piece == 16 ? 0 : 16))
+    {
+        memcpy(buf, plain, len);
+        AES_GCM_init(&ctx, key, iv);
+        AES_GCM_aad(&ctx, aad, aad_len);
+        for (uint32_t off = 0; off < len; off += piece)
+            AES_GCM_encrypt_buffer(&ctx, buf + off, len - off < piece ? len - off : piece);
+        AES_GCM_finish(&ctx, out);
+        ret += memcmp(buf, cipher, len) != 0 || memcmp(out, tag, 16) != 0;
+
+        AES_GCM_init(&ctx, key, iv);
+        AES_GCM_aad(&ctx, aad, aad_len);
+        for (uint32_t off = 0; off < len; off += piece)
+            AES_GCM_decrypt_buffer(&ctx, buf + off, len - off < piece ? len - off : piece);
+        AES_GCM_finish(&ctx, out);
+        ret += memcmp(buf, plain, len) != 0 || memcmp(out, tag, 16) != 0;
+    }
+    printf("%s: %s\n", name, ret ? "FAILED" : "passed");
+    return ret != 0;
+}
+
+static void reverse_each_block(uint8_t *buf, uint32_t len)
+{
+    uint8_t t;
+
+    for (uint32_t b = 0; b < len; b += AES_BLOCKLEN)
+        for (int i = 0; i < AES_BLOCKLEN / 2; i++)
+        {
+            t = buf[b + i];
+            buf[b + i] = buf[b + AES_BLOCKLEN - 1 - i];
+            buf[b + AES_BLOCKLEN - 1 - i] = t;
+        }
+}
+
+/* Run AES_CBC_*_buffer_rev in two calls, split at first, and compare with
+ * reversing every block, running AES_CBC_*_buffer and reversing again.
+ * Return: 0 if they match, 1 otherwise */
+static int check_rev(const char *name, const uint8_t *data, uint32_t len, uint32_t first, int dec)
+{
+    struct AES_ctx ctx, ref_ctx;
+    uint8_t *buf = malloc(len), *ref = malloc(len);
+    int ret;
+
+    if (NULL == buf || NULL == ref)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    memcpy(buf, data, len);
+    memcpy(ref, data, len);
+    AES_init_ctx_iv(&ctx, ctr_key, ctr_iv);
+    AES_init_ctx_iv(&ref_ctx, ctr_key, ctr_iv);
+
+    if (dec)
+    {
+        AES_CBC_decrypt_buffer_rev(&ctx, buf, first);
+        AES_CBC_decrypt_buffer_rev(&ctx, buf + first, len - first);
+        reverse_each_block(ref, len);
+        AES_CBC_decrypt_buffer(&ref_ctx, ref, len);
+    }
+    else
+    {
+        AES_CBC_encrypt_buffer_rev(&ctx, buf, first);
+        AES_CBC_encrypt_buffer_rev(&ctx, buf + first, len - first);
+        reverse_each_block(ref, len);
+        AES_CBC_encrypt_buffer(&ref_ctx, ref, len);
+    }
+    reverse_each_block(ref, len);
+    ret = memcmp(buf, ref, len) != 0 || memcmp(ctx.Iv, ref_ctx.Iv, AES_BLOCKLEN) != 0;
+    printf("%s: %s\n", name, ret ? "FAILED" : "passed");
+    free(buf);
+    free(ref);
+    return ret;
+}
+
+int main()
+{
+    struct AES_ctx ctx;
+    uint8_t *plain, *expect;
+    int failed = 0;
+
+    failed += check_pieces("CTR SP 800-38A, one call", ctr_plain, ctr_cipher, sizeof(ctr_plain),
+                           (const uint32_t []) { sizeof(ctr_plain) }, 1, 1);
+    failed += check_pieces("CTR SP 800-38A, small pieces", ctr_plain, ctr_cipher, sizeof(ctr_plain),
+                           small_pieces, sizeof(small_pieces) / sizeof(small_pieces[0]), 1);
+
+    failed += check_gcm("GCM test case 2", gcm_zero, gcm_zero, NULL, 0, gcm_zero, gcm_cipher2, 16, gcm_tag2);
+    failed += check_gcm("GCM test case 3", gcm_key3, gcm_iv3, NULL, 0, gcm_plain3, gcm_cipher3, 64, gcm_tag3);
+    failed += check_gcm("GCM test case 4", gcm_key3, gcm_iv3, gcm_aad4, sizeof(gcm_aad4),
+                        gcm_plain3, gcm_cipher3, 60, gcm_tag4);
+
+    plain = malloc(TEST_LENGTH);
+    expect = malloc(TEST_LENGTH);
+    if (NULL == plain || NULL == expect)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < TEST_LENGTH; i++)
+        plain[i] = (uint8_t) (i * 7 + (i >> 8));
+    memcpy(expect, plain, TEST_LENGTH);
+    AES_init_ctx_iv(&ctx, ctr_key, ctr_iv);
+    AES_CTR_xcrypt_buffer(&ctx, expect, TEST_LENGTH);
+
+    failed += check_rev("CBC -r encryption, one block", plain, 16, 0, 0);
+    failed += check_rev("CBC -r encryption", plain, 4096, 1008, 0);
+    failed += check_rev("CBC -r decryption, one block", plain, 16, 16, 1);
+    failed += check_rev("CBC -r decryption", plain, 4096, 2048, 1);
+
+    failed += check_pieces("CTR small pieces", plain, expect, TEST_LENGTH,
+                           small_pieces, sizeof(small_pieces) / sizeof(small_pieces[0]), 1);
+    failed += check_pieces("CTR large pieces", plain, expect, TEST_LENGTH,
+                           large_pieces, sizeof(large_pieces) / sizeof(large_pieces[0]), 1);
+    failed += check_pieces("CTR large pieces, threads", plain, expect, TEST_LENGTH,
+                           large_pieces, sizeof(large_pieces) / sizeof(large_pieces[0]), TEST_THREADS);
+
+    free(plain);
+    free(expect);
+    if (failed)
+    {
+        printf("%d test(s) FAILED\n", failed);
+        exit(1);
+    }
+    printf("All tests passed\n");
+    return 0;
+}